@@ -0,0 +1,489 @@
+#include "ahci.h"
+#include "blk.h"
+#include "debug.h"
+#include "interrupt.h"
+#include "memory.h"
+#include "partition.h"
+#include "pci.h"
+#include "stdio-kernel.h"
+#include "stdio.h"
+#include "string.h"
+#include "thread.h"
+#include "timer.h"
+
+/* hba的全局寄存器 */
+#define HBA_CAP 0x00 // 能力
+#define HBA_GHC 0x04 // 全局控制
+#define HBA_IS 0x08  // 各端口的中断状态,写1清除
+#define HBA_PI 0x0c  // 实现了的端口
+
+#define HBA_CAP_NCS(cap) ((((cap) >> 8) & 0x1f) + 1) // 命令槽数
+#define HBA_CAP_SNCQ 0x40000000                       // 支持ncq
+#define HBA_GHC_IE 0x2                                // 允许中断
+#define HBA_GHC_AE 0x80000000                         // 工作在ahci模式
+
+/* 端口寄存器,第n个端口的寄存器从0x100+n*0x80开始 */
+#define HBA_PORT_BASE 0x100
+#define HBA_PORT_SIZE 0x80
+#define PX_CLB 0x00 // 命令列表的物理地址
+#define PX_CLBU 0x04
+#define PX_FB 0x08 // 收到的fis的物理地址
+#define PX_FBU 0x0c
+#define PX_IS 0x10 // 中断状态,写1清除
+#define PX_IE 0x14 // 中断允许
+#define PX_CMD 0x18
+#define PX_TFD 0x20 // 硬盘的状态和错误寄存器
+#define PX_SIG 0x24 // 硬盘类型
+#define PX_SSTS 0x28
+#define PX_SERR 0x30
+#define PX_SACT 0x34 // 发出的ncq命令,硬盘完成后清位
+#define PX_CI 0x38   // 发出的命令,hba完成后清位
+
+#define PX_CMD_ST 0x1     // 处理命令列表
+#define PX_CMD_FRE 0x10   // 接收fis
+#define PX_CMD_FR 0x4000  // fis接收正在运行
+#define PX_CMD_CR 0x8000  // 命令列表正在处理
+
+#define PX_IS_DHRS 0x1        // 收到d2h寄存器fis,普通命令完成
+#define PX_IS_SDBS 0x8        // 收到set device bits fis,ncq命令完成
+#define PX_IS_ERR 0x78000000  // 任务文件,总线和接口错误
+#define PX_IS_TFES 0x40000000 // 硬盘报告了错误
+
+#define PX_SSTS_DET_OK 0x3     // 检测到硬盘且已建立通信
+#define PX_SIG_ATA 0x00000101  // sata硬盘
+
+#define FIS_TYPE_REG_H2D 0x27
+#define FIS_H2D_LEN 5 // 以双字计
+
+/* ata命令 */
+#define ATA_CMD_IDENTIFY 0xec
+#define ATA_CMD_READ_DMA 0xc8
+#define ATA_CMD_WRITE_DMA 0xca
+#define ATA_CMD_READ_DMA_EXT 0x25
+#define ATA_CMD_WRITE_DMA_EXT 0x35
+#define ATA_CMD_READ_FPDMA 0x60  // ncq读
+#define ATA_CMD_WRITE_FPDMA 0x61 // ncq写
+#define ATA_CMD_FLUSH_CACHE 0xe7
+#define ATA_CMD_FLUSH_CACHE_EXT 0xea
+
+#define ATA_DEV_LBA 0x40
+#define ATA_STAT_ERR 0x1 // tfd中状态寄存器的出错位
+
+/* 一个请求最多的扇区数,理由同ide的IDE_REQ_SECS */
+#define AHCI_REQ_SECS (AHCI_PRDT_MAX / 2)
+
+#define reg(addr) (*(volatile uint32_t*) (addr))
+#define hba_reg(port, off) reg ((port)->hba + (off))
+#define port_reg(port, off) reg ((port)->regs + (off))
+
+static struct ahci_port ahci_ports[AHCI_MAX_PORTS];
+static uint32_t         ahci_port_cnt;
+
+/* bits中最低的为1的位的下标,bits不能为0 */
+static uint32_t
+lowest_bit (uint32_t bits) {
+  uint32_t idx;
+  asm ("bsfl %1, %0" : "=r"(idx) : "r"(bits));
+  return idx;
+}
+
+/* 让端口停止处理命令列表和接收fis,在中断处理程序中也会调用,所以忙等 */
+static void
+ahci_port_stop (struct ahci_port* port) {
+  port_reg (port, PX_CMD)&= ~(PX_CMD_ST | PX_CMD_FRE);
+  uint32_t spin= 1000000;
+  while ((port_reg (port, PX_CMD) & (PX_CMD_CR | PX_CMD_FR)) && spin-- > 0)
+    ;
+}
+
+static void
+ahci_port_start (struct ahci_port* port) {
+  port_reg (port, PX_CMD)|= PX_CMD_FRE;
+  port_reg (port, PX_CMD)|= PX_CMD_ST;
+}
+
+/**
+ * 把请求中各bio的缓冲区按物理页拆开填入命令表的prd表,物理相邻的页合并为一项.
+ * 返回用掉的项数,缓冲区没有2字节对齐时返回0. 缓冲区可能在提交者的用户空间,
+ * 由派发线程在换到提交者页目录后调用,addr_v2p才能查到正确的物理页.
+ */
+static uint32_t
+ahci_prdt_build (struct ahci_cmd_table* table, struct blk_request* req) {
+  ASSERT (running_thread ()->borrowed_pgdir == req->pgdir);
+  uint32_t          cnt     = 0;
+  uint32_t          last_end= 0; // 最后一项的结束物理地址
+  struct list_elem* elem    = req->bios.head.next;
+  while (elem != &req->bios.tail) {
+    struct bio* bio  = elem2entry (struct bio, tag, elem);
+    uint32_t    vaddr= (uint32_t) bio->buf;
+    uint32_t    size = bio->sec_cnt * 512;
+    if (vaddr & 1) {
+      return 0;
+    }
+    while (size > 0) {
+      uint32_t phy= addr_v2p (vaddr);
+      uint32_t len= PG_SIZE - (vaddr & (PG_SIZE - 1));
+      if (len > size) {
+        len= size;
+      }
+      if (cnt > 0 && phy == last_end) {
+        table->prdt[cnt - 1].dbc+= len;
+      }
+      else {
+        ASSERT (cnt < AHCI_PRDT_MAX);
+        table->prdt[cnt].dba     = phy;
+        table->prdt[cnt].dbau    = 0;
+        table->prdt[cnt].reserved= 0;
+        table->prdt[cnt].dbc     = len - 1;
+        cnt++;
+      }
+      last_end= phy + len;
+      vaddr+= len;
+      size-= len;
+    }
+    elem= elem->next;
+  }
+  return cnt;
+}
+
+/* 在命令表中填好主机到硬盘的寄存器fis */
+static void
+fis_h2d (struct ahci_cmd_table* table, uint8_t cmd, uint32_t lba,
+         uint16_t count, uint16_t feature, uint8_t device) {
+  uint8_t* fis= table->cfis;
+  memset (fis, 0, 20);
+  fis[0] = FIS_TYPE_REG_H2D;
+  fis[1] = 0x80; // 第7位为1表示这是命令
+  fis[2] = cmd;
+  fis[3] = feature;
+  fis[4] = lba;
+  fis[5] = lba >> 8;
+  fis[6] = lba >> 16;
+  fis[7] = device;
+  fis[8] = lba >> 24;
+  fis[11]= feature >> 8;
+  fis[12]= count;
+  fis[13]= count >> 8;
+}
+
+/* 按是否用ncq和lba48为请求req在命令槽slot的命令表中填好命令fis */
+static void
+ahci_setup_cmd (struct ahci_port* port, uint32_t slot,
+                struct blk_request* req) {
+  struct ahci_cmd_table* table= port->tables[slot];
+  if (port->ncq) {
+    /* ncq命令的扇区数在feature中,count的第3~7位是tag */
+    fis_h2d (table, req->write ? ATA_CMD_WRITE_FPDMA : ATA_CMD_READ_FPDMA,
+             req->lba, slot << 3, req->sec_cnt, ATA_DEV_LBA);
+  }
+  else if (port->lba48) {
+    fis_h2d (table, req->write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT,
+             req->lba, req->sec_cnt, 0, ATA_DEV_LBA);
+  }
+  else {
+    /* lba的24~27位在device的低4位 */
+    fis_h2d (table, req->write ? ATA_CMD_WRITE_DMA : ATA_CMD_READ_DMA,
+             req->lba & 0xffffff, req->sec_cnt, 0,
+             ATA_DEV_LBA | ((req->lba >> 24) & 0xf));
+  }
+}
+
+/**
+ * 块层派发来的请求. 填好空闲命令槽的命令表和命令头后置位发出即返回,
+ * 完成在中断处理程序中报告. 派发线程保证在途请求数不超过命令槽数.
+ */
+static void
+ahci_request (struct blk_queue* q, struct blk_request* req) {
+  struct ahci_port* port      = q->queuedata;
+  enum intr_status  old_status= intr_disable ();
+  uint32_t          slot      = lowest_bit (~port->issued);
+  ASSERT (slot < port->slot_cnt);
+
+  uint32_t prd_cnt= ahci_prdt_build (port->tables[slot], req);
+  if (prd_cnt == 0) {
+    printk ("%s: buffer not word aligned\n", port->bdev.name);
+    intr_set_status (old_status);
+    blk_request_end (req, false);
+    return;
+  }
+  ahci_setup_cmd (port, slot, req);
+
+  struct ahci_cmd_header* hdr= &port->cmd_list[slot];
+  hdr->flags                 = FIS_H2D_LEN | (req->write ? 0x40 : 0);
+  hdr->prdtl                 = prd_cnt;
+  hdr->prdbc                 = 0;
+
+  port->reqs[slot]= req;
+  port->issued|= 1 << slot;
+  if (port->ncq) {
+    port_reg (port, PX_SACT)= 1 << slot; // 写1置位,写0不影响
+  }
+  port_reg (port, PX_CI)= 1 << slot;
+  intr_set_status (old_status);
+}
+
+/**
+ * 端口出错后hba停止处理命令,ncq下所有在途命令都被硬盘放弃.
+ * 清除出错状态后重新启动端口,已发出的命令全部按失败结束.
+ */
+static void
+ahci_port_recover (struct ahci_port* port) {
+  printk ("%s: command error, tfd 0x%x, serr 0x%x\n", port->bdev.name,
+          port_reg (port, PX_TFD), port_reg (port, PX_SERR));
+  ahci_port_stop (port);
+  port_reg (port, PX_SERR)= 0xffffffff;
+  port_reg (port, PX_IS)  = 0xffffffff;
+  ahci_port_start (port);
+
+  while (port->issued != 0) {
+    uint32_t slot= lowest_bit (port->issued);
+    port->issued&= ~(1 << slot);
+    blk_request_end (port->reqs[slot], false);
+  }
+}
+
+/* ahci的中断处理程序,结束各端口上已完成的命令 */
+static void
+intr_ahci_handler (uint8_t irq_no) {
+  uint32_t idx= 0;
+  while (idx < ahci_port_cnt) {
+    struct ahci_port* port= &ahci_ports[idx++];
+    if (port->irq_no != irq_no) {
+      continue;
+    }
+    uint32_t is= port_reg (port, PX_IS);
+    if (is == 0) {
+      continue;
+    }
+    port_reg (port, PX_IS)= is; // 先清端口的再清hba的
+    hba_reg (port, HBA_IS)= 1 << port->port_no;
+    if (is & PX_IS_ERR) {
+      ahci_port_recover (port);
+      continue;
+    }
+
+    /* 已发出且ci和sact中都已清位的命令槽已完成 */
+    uint32_t busy= port_reg (port, PX_CI);
+    if (port->ncq) {
+      busy|= port_reg (port, PX_SACT);
+    }
+    uint32_t done= port->issued & ~busy;
+    while (done != 0) {
+      uint32_t slot= lowest_bit (done);
+      done&= ~(1 << slot);
+      port->issued&= ~(1 << slot);
+      blk_request_end (port->reqs[slot], true);
+    }
+  }
+}
+
+/**
+ * 用0号命令槽发出不带参数的普通命令cmd并轮询等它完成,buf不为NULL时
+ * 是硬盘读入的512字节,须2字节对齐. 调用时0号命令槽须空闲,
+ * 即端口中断还未打开或请求队列已停止派发. 成功返回true.
+ */
+static bool
+ahci_exec_polled (struct ahci_port* port, uint8_t cmd, uint16_t* buf) {
+  struct ahci_cmd_table* table= port->tables[0];
+  fis_h2d (table, cmd, 0, 0, 0, 0);
+  port->cmd_list[0].prdtl= 0;
+  if (buf != NULL) {
+    table->prdt[0].dba = addr_v2p ((uint32_t) buf);
+    table->prdt[0].dbau= 0;
+    table->prdt[0].dbc = 512 - 1;
+    /* 512字节的栈上缓冲区可能跨页 */
+    uint32_t first= PG_SIZE - ((uint32_t) buf & (PG_SIZE - 1));
+    port->cmd_list[0].prdtl= 1;
+    if (first < 512) {
+      table->prdt[0].dbc     = first - 1;
+      table->prdt[1].dba     = addr_v2p ((uint32_t) buf + first);
+      table->prdt[1].dbau    = 0;
+      table->prdt[1].dbc     = 512 - first - 1;
+      port->cmd_list[0].prdtl= 2;
+    }
+  }
+  port->cmd_list[0].flags= FIS_H2D_LEN;
+  port->cmd_list[0].prdbc= 0;
+  port_reg (port, PX_CI) = 1;
+
+  uint32_t time_limit= 3000; // 最多等3秒
+  while (port_reg (port, PX_CI) & 1) {
+    if ((port_reg (port, PX_IS) & PX_IS_TFES) || time_limit-- == 0) {
+      return false;
+    }
+    mtime_sleep (1);
+  }
+  return !(port_reg (port, PX_TFD) & ATA_STAT_ERR);
+}
+
+/**
+ * 块设备的flush操作. flush cache不能与ncq命令混用,
+ * 先让请求队列停止派发并等在途命令完成,再用0号命令槽发出.
+ */
+static bool
+ahci_flush (struct block_device* bdev) {
+  struct ahci_port* port= bdev->private_data;
+  blk_queue_quiesce (&port->queue);
+  bool ok= ahci_exec_polled (
+      port, port->lba48 ? ATA_CMD_FLUSH_CACHE_EXT : ATA_CMD_FLUSH_CACHE, NULL);
+  blk_queue_resume (&port->queue);
+  return ok;
+}
+
+static const struct block_device_ops ahci_bdev_ops= {blk_queue_submit,
+                                                     ahci_flush};
+
+/* 用identify的结果设置硬盘参数,与ide的identify_disk相同,失败时返回0 */
+static uint32_t
+ahci_identify_disk (struct ahci_port* port, bool hba_ncq) {
+  uint16_t id_info[256];
+  if (!ahci_exec_polled (port, ATA_CMD_IDENTIFY, id_info)) {
+    printk ("   %s identify failed\n", port->bdev.name);
+    return 0;
+  }
+
+  /* 第83个字的第10位表示支持lba48 */
+  uint32_t sectors;
+  port->lba48= (id_info[83] & 0x400) != 0;
+  if (port->lba48) {
+    uint32_t high= *(uint32_t*) &id_info[102];
+    sectors      = high != 0 ? 0xffffffff : *(uint32_t*) &id_info[100];
+  }
+  else {
+    sectors= *(uint32_t*) &id_info[60];
+  }
+
+  /* 第76个字的第8位表示支持ncq,第75个字的低5位是队列深度减1 */
+  uint32_t depth= (id_info[75] & 0x1f) + 1;
+  port->ncq     = hba_ncq && (id_info[76] & 0x100) && port->lba48;
+  if (!port->ncq) {
+    depth= 1;
+  }
+  if (depth < port->slot_cnt) {
+    port->slot_cnt= depth;
+  }
+  printk ("   disk %s info:\n      AHCI port %d, SECTORS: %d, CAPACITY: %dMB\n",
+          port->bdev.name, port->port_no, sectors, sectors / 2048);
+  printk ("      LBA48: %s, NCQ: %s, DEPTH: %d\n", port->lba48 ? "yes" : "no",
+          port->ncq ? "yes" : "no", port->slot_cnt);
+  return sectors;
+}
+
+/**
+ * 设置hba上的端口port_no: 分配命令列表,fis接收区和各命令槽的命令表,
+ * identify后接入块层并扫描分区. 端口上没有sata硬盘或出错时返回.
+ */
+static void
+ahci_port_probe (uint32_t hba, uint8_t port_no, uint32_t cap, uint8_t irq_no) {
+  if (ahci_port_cnt == AHCI_MAX_PORTS) {
+    return;
+  }
+  struct ahci_port* port= &ahci_ports[ahci_port_cnt];
+  port->hba             = hba;
+  port->regs            = hba + HBA_PORT_BASE + port_no * HBA_PORT_SIZE;
+  port->port_no         = port_no;
+  port->irq_no          = irq_no;
+  if ((port_reg (port, PX_SSTS) & 0xf) != PX_SSTS_DET_OK
+      || port_reg (port, PX_SIG) != PX_SIG_ATA) {
+    return;
+  }
+
+  /* 1 停下端口后换上自己的命令列表和fis接收区,两者共用一页 */
+  ahci_port_stop (port);
+  port->cmd_list= get_kernel_pages (1);
+  if (port->cmd_list == NULL) {
+    return;
+  }
+  port->fis= (uint8_t*) port->cmd_list + 1024;
+  port_reg (port, PX_CLB) = addr_v2p ((uint32_t) port->cmd_list);
+  port_reg (port, PX_CLBU)= 0;
+  port_reg (port, PX_FB)  = addr_v2p ((uint32_t) port->fis);
+  port_reg (port, PX_FBU) = 0;
+
+  /* 2 每个命令槽的命令表占一页 */
+  port->slot_cnt= HBA_CAP_NCS (cap);
+  uint32_t slot = 0;
+  while (slot < port->slot_cnt) {
+    port->tables[slot]= get_kernel_pages (1);
+    if (port->tables[slot] == NULL) {
+      port->slot_cnt= slot;
+      break;
+    }
+    port->cmd_list[slot].ctba = addr_v2p ((uint32_t) port->tables[slot]);
+    port->cmd_list[slot].ctbau= 0;
+    slot++;
+  }
+  if (port->slot_cnt == 0) {
+    return;
+  }
+
+  /* 3 清除出错和中断状态后启动端口 */
+  port_reg (port, PX_SERR)= 0xffffffff;
+  port_reg (port, PX_IS)  = 0xffffffff;
+  ahci_port_start (port);
+
+  /* 4 identify,之后再打开端口中断 */
+  sprintf (port->bdev.name, "sd%c", 'e' + ahci_port_cnt); // sda~sdd留给ide
+  uint32_t sectors= ahci_identify_disk (port, (cap & HBA_CAP_SNCQ) != 0);
+  if (sectors == 0) {
+    ahci_port_stop (port);
+    return;
+  }
+  port->issued= 0;
+  port_reg (port, PX_IS)= 0xffffffff;
+  port_reg (port, PX_IE)= PX_IS_DHRS | PX_IS_SDBS | PX_IS_ERR;
+  ahci_port_cnt++;
+
+  blk_queue_init (&port->queue, port->bdev.name, ahci_request, port,
+                  AHCI_REQ_SECS, port->slot_cnt);
+  bdev_register (&port->bdev, &ahci_bdev_ops, sectors, AHCI_REQ_SECS,
+                 &port->queue, port);
+  partition_scan (&port->bdev);
+}
+
+/* 设置一个ahci控制器,bar5是hba寄存器的物理地址 */
+static void
+ahci_hba_probe (struct pci_dev* pdev) {
+  if (pdev->irq_line == 0 || pdev->irq_line >= 16) {
+    return;
+  }
+  uint32_t hba= (uint32_t) ioremap (pdev->bar[5] & 0xfffffff0,
+                                    HBA_PORT_BASE + 32 * HBA_PORT_SIZE);
+  if (hba == 0) {
+    return;
+  }
+  pci_enable_master (pdev);
+
+  /* 打开hba的中断后再设置端口,扫描分区时要靠中断报告完成,
+   * 各端口的中断在identify之后才打开. 引脚可能与其它pci设备共用 */
+  uint8_t irq_no= 0x20 + pdev->irq_line;
+  if (!pci_request_irq (pdev, intr_ahci_handler)) {
+    printk ("   ahci: request irq %d failed\n", pdev->irq_line);
+    return;
+  }
+  reg (hba + HBA_GHC)|= HBA_GHC_AE;
+  reg (hba + HBA_IS)= 0xffffffff;
+  reg (hba + HBA_GHC)|= HBA_GHC_IE;
+
+  uint32_t cap= reg (hba + HBA_CAP);
+  uint32_t pi = reg (hba + HBA_PI);
+  uint8_t  idx= 0;
+  while (idx < 32) {
+    if (pi & (1 << idx)) {
+      ahci_port_probe (hba, idx, cap, irq_no);
+    }
+    idx++;
+  }
+}
+
+/* 找出pci上所有ahci模式的sata控制器并接入其上的硬盘 */
+void
+ahci_init (void) {
+  struct pci_dev* pdev= NULL;
+  while ((pdev= pci_find_class (PCI_CLASS_STORAGE, PCI_SUBCLASS_SATA, pdev))
+         != NULL) {
+    if (pdev->prog_if == PCI_PROG_IF_AHCI) {
+      ahci_hba_probe (pdev);
+    }
+  }
+}
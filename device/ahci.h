@@ -0,0 +1,60 @@
+#ifndef __DEVICE_AHCI_H
+#define __DEVICE_AHCI_H
+#include "blk.h"
+#include "global.h"
+#include "stdint.h"
+
+#define AHCI_MAX_PORTS 4  // 接入的ahci硬盘数上限
+#define AHCI_MAX_SLOTS 32 // 每个端口最多的命令槽数
+#define AHCI_PRDT_MAX 248 // 每个命令表的prd项数,使命令表正好占一页
+
+/* 命令列表中的命令头,每个命令槽一个 */
+struct ahci_cmd_header {
+  uint16_t flags; // 第0~4位为命令fis的双字数,第6位表示写
+  uint16_t prdtl; // prd表项数
+  uint32_t prdbc; // 已传输的字节数,由hba写回
+  uint32_t ctba;  // 命令表的物理地址,128字节对齐
+  uint32_t ctbau;
+  uint32_t reserved[4];
+};
+
+/* 命令表中的prd表项,描述一段物理地址连续的缓冲区 */
+struct ahci_prd {
+  uint32_t dba; // 缓冲区的物理地址,须2字节对齐
+  uint32_t dbau;
+  uint32_t reserved;
+  uint32_t dbc; // 第0~21位为字节数减1,第31位表示完成时中断
+};
+
+/* 命令表,由命令fis和prd表组成 */
+struct ahci_cmd_table {
+  uint8_t         cfis[64];
+  uint8_t         acmd[16];
+  uint8_t         reserved[48];
+  struct ahci_prd prdt[AHCI_PRDT_MAX];
+};
+
+/**
+ * 接有sata硬盘的一个ahci端口. 硬盘支持ncq时每个命令槽对应一个tag,
+ * 最多AHCI_MAX_SLOTS个命令同时交给硬盘,由硬盘自行安排执行顺序.
+ * 其中的bdev接入块设备层,请求经queue排序合并后交给端口.
+ */
+struct ahci_port {
+  struct block_device     bdev;
+  struct blk_queue        queue;
+  uint32_t                hba;      // hba寄存器的虚拟地址
+  uint32_t                regs;     // 本端口寄存器的虚拟地址
+  uint8_t                 port_no;  // 在hba上的端口号
+  uint8_t                 irq_no;   // 中断向量号
+  bool                    lba48;    // 是否用48位lba寻址
+  bool                    ncq;      // 是否用ncq
+  uint32_t                slot_cnt; // 可用的命令槽数
+  uint32_t                issued;   // 已发出未完成的命令槽位图
+  struct ahci_cmd_header* cmd_list; // 命令列表,1KB
+  uint8_t*                fis;      // hba写入收到的fis的区域,256字节
+  struct ahci_cmd_table*  tables[AHCI_MAX_SLOTS]; // 各命令槽的命令表
+  struct blk_request*     reqs[AHCI_MAX_SLOTS];   // 各命令槽上的请求
+};
+
+void ahci_init (void);
+#endif
@@ -0,0 +1,466 @@
+#include "blk.h"
+#include "ahci.h"
+#include "clocksource.h"
+#include "debug.h"
+#include "ide.h"
+#include "interrupt.h"
+#include "iostat.h"
+#include "partition.h"
+#include "process.h"
+#include "ramdisk.h"
+#include "stdio-kernel.h"
+#include "stdio.h"
+#include "string.h"
+#include "thread.h"
+#include "virtio_blk.h"
+
+#define BLK_RW_BATCH 4 // bdev_rw每批同时提交的bio数
+
+struct list block_devices; // 所有块设备
+
+/* 把请求按lba插入排序队列,调用时须关中断 */
+static void
+blk_sort_insert (struct blk_queue* q, struct blk_request* req) {
+  struct list_elem* elem= q->sorted.head.next;
+  while (elem != &q->sorted.tail) {
+    struct blk_request* next= elem2entry (struct blk_request, sort_tag, elem);
+    if (next->lba > req->lba) {
+      break;
+    }
+    elem= elem->next;
+  }
+  list_insert_before (elem, &req->sort_tag);
+}
+
+/* 把请求按lba插入排序队列,并排到先后队列末尾,调用时须关中断 */
+static void
+blk_insert (struct blk_queue* q, struct blk_request* req) {
+  blk_sort_insert (q, req);
+  list_append (&q->fifo, &req->fifo_tag);
+}
+
+/* 取一个空闲请求,没有时等待,调用时须关中断 */
+static struct blk_request*
+blk_get_request (struct blk_queue* q) {
+  while (list_empty (&q->free_reqs)) {
+    wait_queue_wait (&q->free_wait, true, 0);
+  }
+  return elem2entry (struct blk_request, sort_tag, list_pop (&q->free_reqs));
+}
+
+/**
+ * 把bio并入队列中扇区与之相接,方向和页目录都相同的请求,
+ * 接在请求之后为后向合并,接在之前为前向合并. 成功返回true,调用时须关中断.
+ * 前向合并改小了请求的lba,要重新按lba放回排序队列,
+ * 否则队列中有相互重叠的请求时就不再有序.
+ */
+static bool
+blk_merge (struct blk_queue* q, struct bio* bio) {
+  struct list_elem* elem= q->sorted.head.next;
+  while (elem != &q->sorted.tail) {
+    struct blk_request* req= elem2entry (struct blk_request, sort_tag, elem);
+    if (req->write == bio->write && req->pgdir == bio->pgdir
+        && req->sec_cnt + bio->sec_cnt <= q->max_secs) {
+      if (req->lba + req->sec_cnt == bio->lba) {
+        list_append (&req->bios, &bio->tag);
+        req->sec_cnt+= bio->sec_cnt;
+        return true;
+      }
+      if (bio->lba + bio->sec_cnt == req->lba) {
+        list_push (&req->bios, &bio->tag);
+        req->lba= bio->lba;
+        req->sec_cnt+= bio->sec_cnt;
+        list_remove (&req->sort_tag);
+        blk_sort_insert (q, req);
+        return true;
+      }
+    }
+    elem= elem->next;
+  }
+  return false;
+}
+
+/**
+ * 选出下一个派发的请求,调用时须关中断且队列非空.
+ * 最早到达的请求超时了就先派发它,否则按c-look取head_pos之后的第一个,
+ * 之后没有请求时回到lba最小的请求.
+ */
+static struct blk_request*
+blk_pick (struct blk_queue* q) {
+  struct blk_request* oldest=
+      elem2entry (struct blk_request, fifo_tag, q->fifo.head.next);
+  if (ktime_get_ns () >= oldest->expire) {
+    return oldest;
+  }
+  struct list_elem* elem= q->sorted.head.next;
+  while (elem != &q->sorted.tail) {
+    struct blk_request* req= elem2entry (struct blk_request, sort_tag, elem);
+    if (req->lba >= q->head_pos) {
+      return req;
+    }
+    elem= elem->next;
+  }
+  return elem2entry (struct blk_request, sort_tag, q->sorted.head.next);
+}
+
+/* 完成请求中各bio,回收请求并让派发线程继续派发,调用时须关中断 */
+static void
+blk_request_finish (struct blk_request* req, bool ok) {
+  struct blk_queue* q= req->queue;
+  while (!list_empty (&req->bios)) {
+    struct bio* bio= elem2entry (struct bio, tag, list_pop (&req->bios));
+    bio->start_ns  = req->start_ns;
+    bio_endio (bio, ok);
+  }
+  list_push (&q->free_reqs, &req->sort_tag);
+  q->in_flight--;
+  if (q->in_flight == 0) {
+    wait_queue_wake_all (&q->drain_wait);
+  }
+  wait_queue_wake (&q->free_wait, 1);
+  wait_queue_wake (&q->more_work, 1);
+}
+
+/* 派发线程,驱动还能接收请求时把选出的请求交给驱动 */
+static void
+blk_dispatch (void* arg) {
+  struct blk_queue* q= arg;
+
+  intr_disable ();
+  while (1) {
+    if (list_empty (&q->sorted) || q->in_flight >= q->depth || q->stopped) {
+      wait_queue_wait (&q->more_work, true, 0);
+      continue;
+    }
+    struct blk_request* req= blk_pick (q);
+    list_remove (&req->sort_tag);
+    list_remove (&req->fifo_tag);
+    q->head_pos= req->lba + req->sec_cnt;
+    q->in_flight++;
+    req->start_ns= ktime_get_ns ();
+
+    /**
+     * bio的buf可能在提交者的用户空间,先换到它的页目录,
+     * 驱动才能访问buf或取得其物理地址. 同步的驱动在request_fn中做完请求,
+     * 期间开中断,异步驱动的完成中断也可能在request_fn返回前到来.
+     * bio一完成提交者就可能退出并释放页目录,所以request_fn期间结束的请求
+     * 由blk_request_end记下,等换回内核页目录后再完成其中的bio.
+     */
+    struct task_struct* cur= running_thread ();
+    cur->borrowed_pgdir    = req->pgdir;
+    q->dispatching         = req;
+    req->end_pending       = false;
+    page_dir_activate (cur);
+    intr_enable ();
+    q->request_fn (q, req);
+    intr_disable ();
+    cur->borrowed_pgdir= NULL;
+    page_dir_activate (cur);
+    q->dispatching= NULL;
+    if (req->end_pending) {
+      blk_request_finish (req, req->end_ok);
+    }
+  }
+}
+
+/**
+ * 驱动处理完请求后调用,可在中断处理程序中调用.
+ * 依次完成请求中各bio,回收请求并让派发线程继续派发.
+ * 请求还在request_fn中时只记下结果,由派发线程换回内核页目录后完成.
+ */
+void
+blk_request_end (struct blk_request* req, bool ok) {
+  enum intr_status old_status= intr_disable ();
+  if (req->queue->dispatching == req) {
+    req->end_pending= true;
+    req->end_ok     = ok;
+  }
+  else {
+    blk_request_finish (req, ok);
+  }
+  intr_set_status (old_status);
+}
+
+/**
+ * 把bio加入队列q,能与已有请求合并时并入,否则新建一个请求.
+ * 调用时须关中断,不唤醒派发线程.
+ */
+static void
+blk_queue_bio (struct blk_queue* q, struct bio* bio) {
+  ASSERT (bio->sec_cnt > 0 && bio->sec_cnt <= q->max_secs);
+  if (blk_merge (q, bio)) {
+    iostat_merge (bio);
+  }
+  else {
+    uint64_t expire_ms= bio->write ? BLK_WRITE_EXPIRE_MS : BLK_READ_EXPIRE_MS;
+    struct blk_request* req= blk_get_request (q);
+
+    req->lba    = bio->lba;
+    req->sec_cnt= bio->sec_cnt;
+    req->write  = bio->write;
+    req->pgdir  = bio->pgdir;
+    req->expire = ktime_get_ns () + expire_ms * NSEC_PER_MSEC;
+    list_init (&req->bios);
+    list_append (&req->bios, &bio->tag);
+    blk_insert (q, req);
+  }
+}
+
+/**
+ * 有请求队列的块设备的submit操作,bio经排序合并后由派发线程交给驱动.
+ * 关中断期间连续提交的bio要等开中断后派发线程才会运行,因此能合并.
+ */
+void
+blk_queue_submit (struct block_device* bdev, struct bio* bio) {
+  enum intr_status old_status= intr_disable ();
+  blk_queue_bio (bdev->queue, bio);
+  wait_queue_wake (&bdev->queue->more_work, 1);
+  intr_set_status (old_status);
+}
+
+/**
+ * 停止派发并等在途请求全部完成,之后驱动可以独占设备,
+ * 如发出不能与ncq命令混用的普通命令. 与blk_queue_resume成对使用.
+ */
+void
+blk_queue_quiesce (struct blk_queue* q) {
+  enum intr_status old_status= intr_disable ();
+  q->stopped                 = true;
+  while (q->in_flight > 0) {
+    wait_queue_wait (&q->drain_wait, false, 0);
+  }
+  intr_set_status (old_status);
+}
+
+void
+blk_queue_resume (struct blk_queue* q) {
+  enum intr_status old_status= intr_disable ();
+  q->stopped                 = false;
+  wait_queue_wake (&q->more_work, 1);
+  intr_set_status (old_status);
+}
+
+/* 初始化bio,读写块设备bdev上以lba起始的sec_cnt个扇区,不超过设备的max_secs */
+void
+bio_init (struct bio* bio, struct block_device* bdev, uint32_t lba, void* buf,
+          uint32_t sec_cnt, bool write) {
+  bio->bdev        = bdev;
+  bio->lba         = lba;
+  bio->sec_cnt     = sec_cnt;
+  bio->buf         = buf;
+  bio->write       = write;
+  bio->error       = false;
+  bio->completed   = false;
+  bio->end_io      = NULL;
+  bio->private_data= NULL;
+  bio->pgdir       = NULL;
+  semaphore_init (&bio->done, 0);
+  bio->done.waiters.reason= BLOCK_IO;
+}
+
+/* 驱动完成bio时调用,可在中断处理程序中调用 */
+void
+bio_endio (struct bio* bio, bool ok) {
+  enum intr_status old_status= intr_disable ();
+  iostat_done (bio, ok);
+  intr_set_status (old_status);
+
+  bio->error    = !ok;
+  bio->completed= true;
+  semaphore_up (&bio->done);
+  /* 回调可能释放bio,放在最后 */
+  if (bio->end_io != NULL) {
+    bio->end_io (bio);
+  }
+}
+
+/**
+ * 提交bio后立即返回,完成前bio和buf都不能释放.
+ * 记下当前的页目录,代进程做I/O的内核线程用借来的页目录,
+ * sys_malloc给进程的buf在用户空间,派发线程要换到这个页目录才能访问.
+ */
+void
+submit_bio (struct bio* bio) {
+  ASSERT (bio->sec_cnt > 0 && bio->lba + bio->sec_cnt <= bio->bdev->sectors);
+  struct task_struct* cur= running_thread ();
+
+  bio->pgdir= cur->pgdir != NULL ? cur->pgdir : cur->borrowed_pgdir;
+
+  enum intr_status old_status= intr_disable ();
+  iostat_submit (bio);
+  intr_set_status (old_status);
+  bio->bdev->ops->submit (bio->bdev, bio);
+}
+
+/**
+ * 一次提交数组bios中的cnt个bio,可以属于不同的块设备.
+ * 全部提交完才开中断,有请求队列的设备上相接的bio因此能合并成一个请求.
+ */
+void
+submit_bio_batch (struct bio* bios, uint32_t cnt) {
+  enum intr_status old_status= intr_disable ();
+  uint32_t         idx       = 0;
+  while (idx < cnt) {
+    submit_bio (&bios[idx]);
+    idx++;
+  }
+  intr_set_status (old_status);
+}
+
+/* bio是否已完成,不阻塞 */
+bool
+bio_done (struct bio* bio) {
+  return bio->completed;
+}
+
+/* 等bio完成,成功返回true. 一个bio只能等一次 */
+bool
+bio_wait (struct bio* bio) {
+  semaphore_down (&bio->done);
+  return !bio->error;
+}
+
+/**
+ * 读写bdev上以lba起始的sec_cnt个扇区,按设备的max_secs拆成bio,
+ * 每批提交BLK_RW_BATCH个后等它们完成. 全部完成后返回,有bio出错时返回false.
+ */
+bool
+bdev_rw (struct block_device* bdev, uint32_t lba, void* buf, uint32_t sec_cnt,
+         bool write) {
+  bool     ok  = true;
+  uint32_t done= 0; // 已提交的扇区数
+  while (done < sec_cnt) {
+    struct bio bios[BLK_RW_BATCH];
+    uint32_t   cnt= 0;
+    while (cnt < BLK_RW_BATCH && done < sec_cnt) {
+      uint32_t secs=
+          sec_cnt - done < bdev->max_secs ? sec_cnt - done : bdev->max_secs;
+      bio_init (&bios[cnt++], bdev, lba + done,
+                (void*) ((uint32_t) buf + done * bdev->sector_size), secs,
+                write);
+      done+= secs;
+    }
+    submit_bio_batch (bios, cnt);
+
+    uint32_t idx= 0;
+    while (idx < cnt) {
+      ok= bio_wait (&bios[idx]) && ok;
+      idx++;
+    }
+  }
+  return ok;
+}
+
+/* 从块设备读取sec_cnt个扇区到buf,出错时停机,文件系统不处理读写错误 */
+void
+bdev_read (struct block_device* bdev, uint32_t lba, void* buf,
+           uint32_t sec_cnt) {
+  if (!bdev_rw (bdev, lba, buf, sec_cnt, false)) {
+    char error[64];
+    sprintf (error, "%s read sector %d failed!!!!!!\n", bdev->name, lba);
+    PANIC (error);
+  }
+}
+
+/* 将buf中sec_cnt扇区数据写入块设备,出错时停机 */
+void
+bdev_write (struct block_device* bdev, uint32_t lba, void* buf,
+            uint32_t sec_cnt) {
+  if (!bdev_rw (bdev, lba, buf, sec_cnt, true)) {
+    char error[64];
+    sprintf (error, "%s write sector %d failed!!!!!!\n", bdev->name, lba);
+    PANIC (error);
+  }
+}
+
+/* 让块设备把已完成的写入落盘,成功返回true */
+bool
+bdev_flush (struct block_device* bdev) {
+  return bdev->ops->flush == NULL || bdev->ops->flush (bdev);
+}
+
+/**
+ * 填好块设备bdev的通用字段并登记到block_devices,名称须已由驱动填好.
+ * queue为设备的请求队列,没有时为NULL.
+ */
+void
+bdev_register (struct block_device* bdev, const struct block_device_ops* ops,
+               uint32_t sectors, uint32_t max_secs, struct blk_queue* queue,
+               void* private_data) {
+  bdev->sector_size = 512;
+  bdev->sectors     = sectors;
+  bdev->max_secs    = max_secs;
+  bdev->ops         = ops;
+  bdev->queue       = queue;
+  bdev->private_data= private_data;
+  iostat_init (&bdev->stat, bdev->name);
+  list_append (&block_devices, &bdev->bdev_tag);
+}
+
+/* 按名称找块设备,没有时返回NULL */
+struct block_device*
+bdev_find (const char* name) {
+  struct list_elem* elem= block_devices.head.next;
+  while (elem != &block_devices.tail) {
+    struct block_device* bdev=
+        elem2entry (struct block_device, bdev_tag, elem);
+    if (!strcmp (bdev->name, name)) {
+      return bdev;
+    }
+    elem= elem->next;
+  }
+  return NULL;
+}
+
+/**
+ * 初始化请求队列q并启动派发线程. fn为驱动处理请求的函数,
+ * max_secs为一个请求最多的扇区数,depth为驱动能同时处理的请求数.
+ */
+void
+blk_queue_init (struct blk_queue* q, char* name, blk_request_fn* fn,
+                void* queuedata, uint32_t max_secs, uint32_t depth) {
+  ASSERT (strlen (name) < sizeof (q->name));
+  ASSERT (depth > 0 && depth <= BLK_NR_REQUESTS);
+  strcpy (q->name, name);
+  list_init (&q->sorted);
+  list_init (&q->fifo);
+  list_init (&q->free_reqs);
+  uint32_t idx= 0;
+  while (idx < BLK_NR_REQUESTS) {
+    q->reqs[idx].queue= q;
+    list_append (&q->free_reqs, &q->reqs[idx].sort_tag);
+    idx++;
+  }
+  q->head_pos   = 0;
+  q->max_secs   = max_secs;
+  q->depth      = depth;
+  q->in_flight  = 0;
+  q->stopped    = false;
+  q->dispatching= NULL;
+  q->request_fn = fn;
+  q->queuedata  = queuedata;
+  wait_queue_init (&q->more_work);
+  wait_queue_init (&q->free_wait);
+  wait_queue_init (&q->drain_wait);
+  q->more_work.reason = BLOCK_IDLE;
+  q->free_wait.reason = BLOCK_IO;
+  q->drain_wait.reason= BLOCK_IO;
+  q->dispatcher       = thread_start (name, 31, blk_dispatch, q);
+}
+
+/**
+ * 初始化块设备层: 依次接入ide,virtio-blk和ahci硬盘以及内存盘,
+ * 各驱动接入硬盘后扫描其上的分区,最后打印所有分区.
+ */
+void
+blk_dev_init (void) {
+  printk ("blk_dev_init start\n");
+  list_init (&block_devices);
+  list_init (&partition_list);
+  ide_init ();
+  virtio_blk_init ();
+  ahci_init ();
+  ramdisk_init ();
+  partition_show ();
+  printk ("blk_dev_init done\n");
+}
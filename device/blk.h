@@ -0,0 +1,140 @@
+#ifndef __DEVICE_BLK_H
+#define __DEVICE_BLK_H
+#include "global.h"
+#include "iostat.h"
+#include "list.h"
+#include "stdint.h"
+#include "sync.h"
+
+#define BLK_NR_REQUESTS 32       // 每个队列的请求数上限
+#define BLK_READ_EXPIRE_MS 500   // 读请求最长等待时间,超过后优先派发
+#define BLK_WRITE_EXPIRE_MS 5000 // 写请求最长等待时间
+
+struct bio;
+struct blk_queue;
+struct blk_request;
+struct block_device;
+/**
+ * 驱动处理请求的函数,可以同步做完,也可以启动后在中断中完成.
+ * 调用时已切换到提交者的页目录,可以直接访问bio的buf并用addr_v2p取物理地址.
+ */
+typedef void blk_request_fn (struct blk_queue* q, struct blk_request* req);
+/* bio完成时的回调,可能在中断处理程序中调用,不能睡眠 */
+typedef void bio_end_io (struct bio* bio);
+
+/**
+ * 对一段连续扇区的一次读写,合并后的请求由多个bio组成.
+ * 用bio_init填好后submit_bio提交即返回,完成后可以
+ * 用bio_done轮询,用bio_wait等待,或由end_io回调得知.
+ */
+struct bio {
+  struct list_elem     tag;  // 在所属请求的bio队列中的结点
+  struct block_device* bdev; // 读写的块设备
+  uint32_t             lba;
+  uint32_t             sec_cnt;
+  void*                buf;
+  bool                 write;
+  bool                 error;        // 完成时是否出错
+  bool                 completed;    // 是否已完成
+  struct semaphore     done;         // 完成后由驱动up
+  bio_end_io*          end_io;       // 完成时的回调,可为NULL
+  void*                private_data; // 供end_io使用
+  uint64_t             submit_ns;    // 提交的时刻,用于统计
+  uint64_t             start_ns;     // 驱动开始处理的时刻
+  uint32_t*            pgdir;        // 提交者的页目录,buf在其中,内核线程为NULL
+};
+
+/* 块设备的操作,由驱动实现 */
+struct block_device_ops {
+  /* 提交bio后即返回,完成时调用bio_endio,可以在中断处理程序中 */
+  void (*submit) (struct block_device* bdev, struct bio* bio);
+  /* 让设备把写缓存中已完成的写入落盘,成功返回true. 没有写缓存时可为NULL */
+  bool (*flush) (struct block_device* bdev);
+};
+
+/**
+ * 块设备. 各种硬盘和内存盘都实现为块设备,分区和文件系统只通过它读写,
+ * 不关心背后是哪种驱动. lba以sector_size字节为单位,目前都是512.
+ */
+struct block_device {
+  char                           name[8];
+  uint32_t                       sector_size; // 每扇区的字节数
+  uint32_t                       sectors;     // 容量,即扇区总数
+  uint32_t                       max_secs;    // 一个bio最多的扇区数
+  const struct block_device_ops* ops;
+  struct blk_queue*              queue;        // 有请求队列时指向它
+  void*                          private_data; // 驱动的私有数据
+  struct list_elem               bdev_tag;     // 在block_devices中的结点
+  struct io_stat                 stat;         // 读写统计
+};
+
+/* 队列中的请求,由扇区连续且方向相同的若干bio合并而成 */
+struct blk_request {
+  struct list_elem sort_tag;    // 在按lba排序的队列中的结点
+  struct list_elem fifo_tag;    // 在按到达先后排列的队列中的结点
+  uint32_t         lba;
+  uint32_t         sec_cnt;
+  bool             write;
+  uint64_t         expire;      // 超过此时刻仍未派发时优先派发
+  uint64_t         start_ns;    // 驱动开始处理的时刻,派发时记下,驱动可改写
+  uint32_t*        pgdir;       // 各bio共同的页目录,派发线程处理时切换到它
+  bool             end_pending; // 驱动在request_fn返回前就结束了请求
+  bool             end_ok;      // 推迟结束时驱动报告的结果
+  struct list      bios;        // 按lba排列的bio
+  struct blk_queue* queue;
+};
+
+/**
+ * 每个硬盘的请求队列. 请求按lba排序,派发线程按c-look的顺序,
+ * 即沿lba增大方向扫描到头后回到最小的lba,把请求交给驱动;
+ * 等待超时的请求优先派发,避免远处的请求被饿死.
+ */
+struct blk_queue {
+  char            name[16];
+  struct list     sorted;    // 按lba升序排列的待派发请求
+  struct list     fifo;      // 按到达先后排列的待派发请求
+  struct list     free_reqs; // 空闲的请求
+  uint32_t        head_pos;  // 最近派发的请求结束处的lba
+  uint32_t        max_secs;  // 一个请求最多的扇区数
+  uint32_t        depth;     // 驱动能同时处理的请求数
+  uint32_t        in_flight; // 已派发未完成的请求数
+  bool            stopped;   // 为true时不再派发,见blk_queue_quiesce
+  blk_request_fn* request_fn;
+  void*           queuedata; // 驱动的私有数据,如struct disk
+  struct wait_queue   more_work;  // 派发线程在此等待请求
+  struct wait_queue   free_wait;  // 在此等待空闲的请求
+  struct wait_queue   drain_wait; // 在此等待在途请求全部完成
+  struct task_struct* dispatcher;
+  struct blk_request* dispatching; // 正在request_fn中的请求,其结束要推迟
+  struct blk_request  reqs[BLK_NR_REQUESTS];
+};
+
+void blk_queue_init (struct blk_queue* q, char* name, blk_request_fn* fn,
+                     void* queuedata, uint32_t max_secs, uint32_t depth);
+void blk_request_end (struct blk_request* req, bool ok);
+void blk_queue_submit (struct block_device* bdev, struct bio* bio);
+void blk_queue_quiesce (struct blk_queue* q);
+void blk_queue_resume (struct blk_queue* q);
+void bio_init (struct bio* bio, struct block_device* bdev, uint32_t lba,
+               void* buf, uint32_t sec_cnt, bool write);
+void bio_endio (struct bio* bio, bool ok);
+void submit_bio (struct bio* bio);
+void submit_bio_batch (struct bio* bios, uint32_t cnt);
+bool bio_done (struct bio* bio);
+bool bio_wait (struct bio* bio);
+
+extern struct list block_devices;
+void bdev_register (struct block_device* bdev,
+                    const struct block_device_ops* ops, uint32_t sectors,
+                    uint32_t max_secs, struct blk_queue* queue,
+                    void* private_data);
+struct block_device* bdev_find (const char* name);
+bool bdev_rw (struct block_device* bdev, uint32_t lba, void* buf,
+              uint32_t sec_cnt, bool write);
+void bdev_read (struct block_device* bdev, uint32_t lba, void* buf,
+                uint32_t sec_cnt);
+void bdev_write (struct block_device* bdev, uint32_t lba, void* buf,
+                 uint32_t sec_cnt);
+bool bdev_flush (struct block_device* bdev);
+void blk_dev_init (void);
+#endif
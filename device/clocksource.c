@@ -0,0 +1,171 @@
+#include "clocksource.h"
+#include "global.h"
+#include "interrupt.h"
+#include "io.h"
+#include "print.h"
+#include "timer.h"
+
+#define PIT_CHANNEL2_PORT 0x42
+#define PIT_CONTROL_PORT 0x43
+#define PPI_PORT_B 0x61 // 8255端口B,bit0为通道2的门控,bit1为扬声器,bit5为通道2的输出
+
+/* 用8253通道2计时50ms来校准TSC */
+#define CALIBRATE_LATCH (INPUT_FREQUENCY / 20)
+#define CALIBRATE_NS                                                           \
+  ((uint32_t) (((uint64_t) CALIBRATE_LATCH * NSEC_PER_SEC) / INPUT_FREQUENCY))
+#define CALIBRATE_MAX_LOOPS (1 << 24) // 通道2无输出时放弃校准
+
+static struct clocksource* cur_clocksource;
+
+/* 64位数除以32位数,不依赖libgcc的__udivdi3 */
+uint64_t
+div_u64_rem (uint64_t dividend, uint32_t divisor, uint32_t* remainder) {
+  uint32_t high  = (uint32_t) (dividend >> 32);
+  uint32_t low   = (uint32_t) dividend;
+  uint32_t q_high= high / divisor;
+  uint32_t rem   = high % divisor;
+  uint32_t q_low;
+
+  /* 余数小于除数,所以edx:eax / divisor的商一定能放进32位 */
+  asm ("divl %4" : "=a"(q_low), "=d"(rem) : "a"(low), "d"(rem), "rm"(divisor));
+  if (remainder != NULL) {
+    *remainder= rem;
+  }
+  return (uint64_t) q_high << 32 | q_low;
+}
+
+/* 读取时间戳计数器 */
+static uint64_t
+rdtsc (void) {
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A"(tsc));
+  return tsc;
+}
+
+/* 通过cpuid判断cpu是否支持rdtsc指令 */
+static bool
+cpu_has_tsc (void) {
+  uint32_t eax= 1, ebx, ecx, edx;
+  asm volatile ("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+  return (edx & 0x10) != 0;
+}
+
+/* 在CALIBRATE_NS纳秒内TSC走过的计数,校准失败返回0 */
+static uint64_t
+tsc_calibrate (void) {
+  uint8_t ppi= inb (PPI_PORT_B);
+
+  /* 打开通道2的门控并关闭扬声器,通道2工作在方式0,计数结束时输出变高 */
+  outb (PPI_PORT_B, (ppi & ~0x02) | 0x01);
+  outb (PIT_CONTROL_PORT, (uint8_t) (2 << 6 | 3 << 4 | 0 << 1));
+  outb (PIT_CHANNEL2_PORT, (uint8_t) CALIBRATE_LATCH);
+  outb (PIT_CHANNEL2_PORT, (uint8_t) (CALIBRATE_LATCH >> 8));
+
+  uint64_t start= rdtsc ();
+  uint32_t loops= 0;
+  while (!(inb (PPI_PORT_B) & 0x20)) {
+    if (++loops > CALIBRATE_MAX_LOOPS) {
+      outb (PPI_PORT_B, ppi);
+      return 0;
+    }
+  }
+  uint64_t end= rdtsc ();
+
+  outb (PPI_PORT_B, ppi);
+  return end - start;
+}
+
+/* 根据ns纳秒内走过cycles个计数,算出换算用的mult和shift */
+static void
+clocksource_set_rate (struct clocksource* cs, uint32_t cycles, uint32_t ns) {
+  uint32_t shift= 32;
+  uint64_t mult;
+
+  /* shift尽量大以保留精度,但mult必须能放进32位 */
+  while (1) {
+    mult= div_u64_rem ((uint64_t) ns << shift, cycles, NULL);
+    if (mult <= 0xffffffff || shift == 0) {
+      break;
+    }
+    shift--;
+  }
+  cs->mult = (uint32_t) mult;
+  cs->shift= shift;
+  cs->khz  = (uint32_t) div_u64_rem ((uint64_t) cycles * NSEC_PER_MSEC, ns, NULL);
+}
+
+/* 把计数换算为纳秒,拆成高低32位分别相乘以免溢出 */
+static uint64_t
+clocksource_cyc2ns (struct clocksource* cs, uint64_t cycles) {
+  uint32_t high= (uint32_t) (cycles >> 32);
+  uint32_t low = (uint32_t) cycles;
+  return (((uint64_t) high * cs->mult) << (32 - cs->shift)) +
+         (((uint64_t) low * cs->mult) >> cs->shift);
+}
+
+static struct clocksource tsc_clocksource= {
+    .name= "tsc", .read= rdtsc, .user_readable= true};
+
+static struct clocksource pit_clocksource= {.name= "pit",
+                                            .read= timer_clock_now};
+
+/* 返回时钟源初始化以来经过的纳秒数 */
+uint64_t
+ktime_get_ns (void) {
+  struct clocksource* cs= cur_clocksource;
+  if (cs == NULL) { // 时钟源初始化之前
+    return 0;
+  }
+  return clocksource_cyc2ns (cs, cs->read () - cs->base);
+}
+
+/* 读出当前时钟源的原始计数,用于测量短时长,初始化之前为0 */
+uint64_t
+clocksource_read (void) {
+  struct clocksource* cs= cur_clocksource;
+  return cs == NULL ? 0 : cs->read ();
+}
+
+/* 返回当前使用的时钟源,初始化之前为NULL */
+const struct clocksource*
+clocksource_current (void) {
+  return cur_clocksource;
+}
+
+/* 获取时钟clock_id的当前时间,目前只支持CLOCK_MONOTONIC */
+int32_t
+sys_clock_gettime (int32_t clock_id, struct timespec* tp) {
+  if (clock_id != CLOCK_MONOTONIC || tp == NULL) {
+    return -1;
+  }
+  uint32_t nsec;
+  tp->tv_sec = (uint32_t) div_u64_rem (ktime_get_ns (), NSEC_PER_SEC, &nsec);
+  tp->tv_nsec= nsec;
+  return 0;
+}
+
+/* 选择时钟源:优先用以8253校准过的TSC,否则退回8253计数器 */
+void
+clocksource_init (void) {
+  put_str ("clocksource_init start\n");
+  enum intr_status old_status= intr_disable ();
+
+  uint64_t tsc_cycles= cpu_has_tsc () ? tsc_calibrate () : 0;
+  if (tsc_cycles != 0 && tsc_cycles <= 0xffffffff) {
+    clocksource_set_rate (&tsc_clocksource, (uint32_t) tsc_cycles,
+                          CALIBRATE_NS);
+    cur_clocksource= &tsc_clocksource;
+  }
+  else {
+    clocksource_set_rate (&pit_clocksource, INPUT_FREQUENCY, NSEC_PER_SEC);
+    cur_clocksource= &pit_clocksource;
+  }
+  cur_clocksource->base= cur_clocksource->read ();
+
+  intr_set_status (old_status);
+  put_str ("   clocksource: ");
+  put_str ((char*) cur_clocksource->name);
+  put_str (", khz: 0x");
+  put_int (cur_clocksource->khz);
+  put_str ("\nclocksource_init done\n");
+}
@@ -0,0 +1,24 @@
+#ifndef __DEVICE_CLOCKSOURCE_H
+#define __DEVICE_CLOCKSOURCE_H
+#include "global.h"
+#include "stdint.h"
+#include "time.h"
+
+/* 时钟源,提供单调递增的计数,纳秒数= (计数 * mult) >> shift */
+struct clocksource {
+  const char* name;
+  uint64_t (*read) (void); // 读出当前计数
+  uint32_t mult;
+  uint32_t shift;
+  uint32_t khz;  // 计数频率(kHz),仅用于显示
+  uint64_t base; // 初始化时的计数,ktime从此处开始计时
+  bool     user_readable; // 计数能否在用户态直接读出
+};
+
+void     clocksource_init (void);
+const struct clocksource* clocksource_current (void);
+uint64_t clocksource_read (void);
+uint64_t ktime_get_ns (void);
+uint64_t div_u64_rem (uint64_t dividend, uint32_t divisor, uint32_t* remainder);
+int32_t  sys_clock_gettime (int32_t clock_id, struct timespec* tp);
+#endif
@@ -9,6 +9,7 @@ static struct lock console_lock;
 void
 console_init () {
   lock_init (&console_lock);
+  lock_stat_register (&console_lock, "console");
 }
 
 void
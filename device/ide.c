@@ -1,10 +1,14 @@
 #include "ide.h"
+#include "blk.h"
+#include "clocksource.h"
 #include "console.h"
 #include "debug.h"
 #include "interrupt.h"
 #include "io.h"
 #include "list.h"
 #include "memory.h"
+#include "partition.h"
+#include "pci.h"
 #include "stdio-kernel.h"
 #include "stdio.h"
 #include "string.h"
@@ -24,10 +28,22 @@
 #define reg_alt_status(channel) (channel->port_base + 0x206)
 #define reg_ctl(channel) reg_alt_status (channel)
 
+/* 总线主控(bus master ide)寄存器的端口号 */
+#define reg_bm_cmd(channel) (channel->bmide_base + 0)
+#define reg_bm_status(channel) (channel->bmide_base + 2)
+#define reg_bm_prdt(channel) (channel->bmide_base + 4)
+
 /* reg_status寄存器的一些关键位 */
 #define BIT_STAT_BSY 0x80  // 硬盘忙
 #define BIT_STAT_DRDY 0x40 // 驱动器准备好
 #define BIT_STAT_DRQ 0x8   // 数据传输准备好了
+#define BIT_STAT_ERR 0x1   // 上一条命令出错
+
+/* 总线主控寄存器的一些关键位 */
+#define BIT_BM_START 0x1 // 启动dma引擎
+#define BIT_BM_READ 0x8  // 传输方向为硬盘到内存
+#define BIT_BM_ERR 0x2   // dma出错,写1清除
+#define BIT_BM_INTR 0x4  // 硬盘发出了中断,写1清除
 
 /* device寄存器的一些关键位 */
 #define BIT_DEV_MBS 0xa0 // 第7位和第5位固定为1
@@ -38,42 +54,31 @@
 #define CMD_IDENTIFY 0xec     // identify指令
 #define CMD_READ_SECTOR 0x20  // 读扇区指令
 #define CMD_WRITE_SECTOR 0x30 // 写扇区指令
-
-/* 定义可读写的最大扇区数,调试用的 */
-#define max_lba ((80 * 1024 * 1024 / 512) - 1) // 只支持80MB硬盘
+#define CMD_READ_SECTOR_EXT 0x24    // lba48读扇区指令
+#define CMD_READ_DMA_EXT 0x25       // lba48的dma读扇区指令
+#define CMD_READ_MULTIPLE_EXT 0x29  // lba48的多扇区模式读指令
+#define CMD_WRITE_SECTOR_EXT 0x34   // lba48写扇区指令
+#define CMD_WRITE_DMA_EXT 0x35      // lba48的dma写扇区指令
+#define CMD_WRITE_MULTIPLE_EXT 0x39 // lba48的多扇区模式写指令
+#define CMD_READ_MULTIPLE 0xc4  // 多扇区模式读指令
+#define CMD_WRITE_MULTIPLE 0xc5 // 多扇区模式写指令
+#define CMD_SET_MULTIPLE 0xc6   // 设置多扇区模式每块的扇区数
+#define CMD_READ_DMA 0xc8     // dma读扇区指令
+#define CMD_WRITE_DMA 0xca    // dma写扇区指令
+#define CMD_FLUSH_CACHE 0xe7     // 把写缓存中的数据落盘
+#define CMD_FLUSH_CACHE_EXT 0xea // lba48的落盘指令
+
+#define PRD_EOT 0x8000                         // prd表最后一项的标记
+#define PRD_MAX (PG_SIZE / sizeof (struct prd)) // prd表最多的项数
+#define PRD_BOUNDARY 0x10000                   // 一项不能跨越64KB边界
+
+/* 一个请求最多的扇区数.每个bio至少1个扇区,最多占两倍于扇区数的物理页,
+ * 因此不超过PRD_MAX/2个扇区的请求总能用一张prd表描述 */
+#define IDE_REQ_SECS (PRD_MAX / 2)
 
 uint8_t            channel_cnt; // 按硬盘数计算的通道数
 struct ide_channel channels[2]; // 有两个ide通道
 
-/* 用于记录总扩展分区的起始lba,初始为0,partition_scan时以此为标记 */
-int32_t ext_lba_base= 0;
-
-uint8_t p_no= 0, l_no= 0; // 用来记录硬盘主分区和逻辑分区的下标
-
-struct list partition_list; // 分区队列
-
-/* 构建一个16字节大小的结构体,用来存分区表项 */
-struct partition_table_entry {
-  uint8_t bootable;         // 是否可引导
-  uint8_t start_head;       // 起始磁头号
-  uint8_t start_sec;        // 起始扇区号
-  uint8_t start_chs;        // 起始柱面号
-  uint8_t fs_type;          // 分区类型
-  uint8_t end_head;         // 结束磁头号
-  uint8_t end_sec;          // 结束扇区号
-  uint8_t end_chs;          // 结束柱面号
-                            /* 更需要关注的是下面这两项 */
-  uint32_t start_lba;       // 本分区起始扇区的lba地址
-  uint32_t sec_cnt;         // 本分区的扇区数目
-} __attribute__ ((packed)); // 保证此结构是16字节大小
-
-/* 引导扇区,mbr或ebr所在的扇区 */
-struct boot_sector {
-  uint8_t other[446];                              // 引导代码
-  struct partition_table_entry partition_table[4]; // 分区表中有4项,共64字节
-  uint16_t signature; // 启动扇区的结束标志是0x55,0xaa,
-} __attribute__ ((packed));
-
 /* 选择读写的硬盘 */
 static void
 select_disk (struct disk* hd) {
@@ -86,12 +91,29 @@ select_disk (struct disk* hd) {
 
 /* 向硬盘控制器写入起始扇区地址及要读写的扇区数 */
 static void
-select_sector (struct disk* hd, uint32_t lba, uint8_t sec_cnt) {
-  ASSERT (lba <= max_lba);
+select_sector (struct disk* hd, uint32_t lba, uint32_t sec_cnt) {
+  ASSERT (sec_cnt > 0 && sec_cnt <= hd->max_secs);
+  ASSERT (lba + sec_cnt <= hd->bdev.sectors);
   struct ide_channel* channel= hd->my_channel;
 
+  if (hd->lba48) {
+    /* lba48的扇区数和地址寄存器各有两级,先写高字节再写低字节.
+     * lba只有32位,地址的32~47位总是0,扇区数为65536时两次都写0 */
+    outb (reg_sect_cnt (channel), sec_cnt >> 8);
+    outb (reg_lba_l (channel), lba >> 24);
+    outb (reg_lba_m (channel), 0);
+    outb (reg_lba_h (channel), 0);
+    outb (reg_sect_cnt (channel), sec_cnt);
+    outb (reg_lba_l (channel), lba);
+    outb (reg_lba_m (channel), lba >> 8);
+    outb (reg_lba_h (channel), lba >> 16);
+    outb (reg_dev (channel),
+          BIT_DEV_MBS | BIT_DEV_LBA | (hd->dev_no == 1 ? BIT_DEV_DEV : 0));
+    return;
+  }
+
   /* 写入要读写的扇区数*/
-  outb (reg_sect_cnt (channel), sec_cnt); // 如果sec_cnt为0,则表示写入256个扇区
+  outb (reg_sect_cnt (channel), sec_cnt); // 256个扇区时只写入低8位的0
 
   /* 写入lba地址(即扇区号) */
   outb (reg_lba_l (channel), lba); // lba地址的低8位,不用单独取出低8位.outb函数中的汇编指令outb
@@ -113,34 +135,42 @@ cmd_out (struct ide_channel* channel, uint8_t cmd) {
   outb (reg_cmd (channel), cmd);
 }
 
-/* 硬盘读入sec_cnt个扇区的数据到buf */
+/* 硬盘读入sec_cnt个扇区的数据到buf,控制器支持时按双字读 */
 static void
-read_from_sector (struct disk* hd, void* buf, uint8_t sec_cnt) {
-  uint32_t size_in_byte;
-  if (sec_cnt == 0) {
-    /* 因为sec_cnt是8位变量,由主调函数将其赋值时,若为256则会将最高位的1丢掉变为0
-     */
-    size_in_byte= 256 * 512;
+read_from_sector (struct disk* hd, void* buf, uint32_t sec_cnt) {
+  uint32_t size_in_byte= sec_cnt * 512;
+  if (hd->io32) {
+    insl (reg_data (hd->my_channel), buf, size_in_byte / 4);
   }
   else {
-    size_in_byte= sec_cnt * 512;
+    insw (reg_data (hd->my_channel), buf, size_in_byte / 2);
   }
-  insw (reg_data (hd->my_channel), buf, size_in_byte / 2);
 }
 
-/* 将buf中sec_cnt扇区的数据写入硬盘 */
+/* 将buf中sec_cnt扇区的数据写入硬盘,控制器支持时按双字写 */
 static void
-write2sector (struct disk* hd, void* buf, uint8_t sec_cnt) {
-  uint32_t size_in_byte;
-  if (sec_cnt == 0) {
-    /* 因为sec_cnt是8位变量,由主调函数将其赋值时,若为256则会将最高位的1丢掉变为0
-     */
-    size_in_byte= 256 * 512;
+write2sector (struct disk* hd, void* buf, uint32_t sec_cnt) {
+  uint32_t size_in_byte= sec_cnt * 512;
+  if (hd->io32) {
+    outsl (reg_data (hd->my_channel), buf, size_in_byte / 4);
   }
   else {
-    size_in_byte= sec_cnt * 512;
+    outsw (reg_data (hd->my_channel), buf, size_in_byte / 2);
   }
-  outsw (reg_data (hd->my_channel), buf, size_in_byte / 2);
+}
+
+/* 按传输方式,方向和硬盘是否用lba48选出读写命令 */
+static uint8_t
+rw_cmd (struct disk* hd, bool dma, bool write) {
+  /* 依次为单扇区,多扇区和dma,每组先读后写,每项先28位后48位 */
+  static const uint8_t cmds[3][2][2]= {
+      {{CMD_READ_SECTOR, CMD_READ_SECTOR_EXT},
+       {CMD_WRITE_SECTOR, CMD_WRITE_SECTOR_EXT}},
+      {{CMD_READ_MULTIPLE, CMD_READ_MULTIPLE_EXT},
+       {CMD_WRITE_MULTIPLE, CMD_WRITE_MULTIPLE_EXT}},
+      {{CMD_READ_DMA, CMD_READ_DMA_EXT}, {CMD_WRITE_DMA, CMD_WRITE_DMA_EXT}}};
+  uint8_t mode= dma ? 2 : (hd->multi_secs != 0 ? 1 : 0);
+  return cmds[mode][write != 0][hd->lba48 != 0];
 }
 
 /* 等待30秒 */
@@ -159,100 +189,198 @@ busy_wait (struct disk* hd) {
   return false;
 }
 
-/* 从硬盘读取sec_cnt个扇区到buf */
-void
-ide_read (struct disk* hd, uint32_t lba, void* buf,
-          uint32_t sec_cnt) { // 此处的sec_cnt为32位大小
-  ASSERT (lba <= max_lba);
-  ASSERT (sec_cnt > 0);
-  lock_acquire (&hd->my_channel->lock);
-
-  /* 1 先选择操作的硬盘 */
-  select_disk (hd);
-
-  uint32_t secs_op;      // 每次操作的扇区数
-  uint32_t secs_done= 0; // 已完成的扇区数
-  while (secs_done < sec_cnt) {
-    if ((secs_done + 256) <= sec_cnt) {
-      secs_op= 256;
+/**
+ * 把请求中各bio的缓冲区按物理页拆成prd表项写入通道的prd表,
+ * 物理相邻且不跨64KB边界的页合并为一项.
+ * 缓冲区没有2字节对齐或表放不下时返回false,此时只能用pio传输.
+ */
+static bool
+prdt_build (struct ide_channel* channel, struct blk_request* req) {
+  uint32_t          cnt     = 0; // 已用的表项数
+  uint32_t          prd_len = 0; // 最后一项的字节数
+  uint32_t          last_end= 0; // 最后一项的结束物理地址
+  struct list_elem* elem    = req->bios.head.next;
+  while (elem != &req->bios.tail) {
+    struct bio* bio  = elem2entry (struct bio, tag, elem);
+    uint32_t    vaddr= (uint32_t) bio->buf;
+    uint32_t    size = bio->sec_cnt * 512;
+    if (vaddr & 1) {
+      return false;
     }
-    else {
-      secs_op= sec_cnt - secs_done;
+    while (size > 0) {
+      uint32_t phy= addr_v2p (vaddr);
+      uint32_t len= PG_SIZE - (vaddr & (PG_SIZE - 1));
+      if (len > size) {
+        len= size;
+      }
+      if (cnt > 0 && phy == last_end && (phy & (PRD_BOUNDARY - 1)) != 0) {
+        prd_len+= len;
+      }
+      else {
+        if (cnt == PRD_MAX) {
+          return false;
+        }
+        channel->prdt[cnt].phy_addr= phy;
+        channel->prdt[cnt].flags   = 0;
+        prd_len                    = len;
+        cnt++;
+      }
+      channel->prdt[cnt - 1].byte_cnt= prd_len & 0xffff; // 64KB时正好为0
+      last_end                       = phy + len;
+      vaddr+= len;
+      size-= len;
     }
+    elem= elem->next;
+  }
+  channel->prdt[cnt - 1].flags= PRD_EOT;
+  return true;
+}
 
-    /* 2 写入待读入的扇区数和起始扇区号 */
-    select_sector (hd, lba + secs_done, secs_op);
+/**
+ * 用总线主控dma完成请求req,prd表须已由prdt_build填好.
+ * 发出命令后阻塞,传输完成的中断将自己唤醒,期间cpu可运行其它任务.
+ * 调用时须持有通道锁,出错返回false.
+ */
+static bool
+dma_transfer (struct disk* hd, struct blk_request* req) {
+  struct ide_channel* channel= hd->my_channel;
 
-    /* 3 执行的命令写入reg_cmd寄存器 */
-    cmd_out (hd->my_channel, CMD_READ_SECTOR); // 准备开始读数据
+  /* 1 设置prd表地址和传输方向,清除上次的中断和出错位 */
+  uint8_t bm_cmd= req->write ? 0 : BIT_BM_READ;
+  outl (reg_bm_prdt (channel), channel->prdt_phy);
+  outb (reg_bm_cmd (channel), bm_cmd);
+  outb (reg_bm_status (channel),
+        inb (reg_bm_status (channel)) | BIT_BM_ERR | BIT_BM_INTR);
+
+  /* 2 向硬盘发出dma读写命令后启动dma引擎 */
+  select_sector (hd, req->lba, req->sec_cnt);
+  cmd_out (channel, rw_cmd (hd, true, req->write));
+  outb (reg_bm_cmd (channel), bm_cmd | BIT_BM_START);
+
+  /* 3 阻塞到传输完成,中断处理程序已停止dma引擎 */
+  semaphore_down (&channel->disk_done);
+  return !(channel->irq_bm_status & BIT_BM_ERR)
+         && !(channel->irq_status & BIT_STAT_ERR);
+}
 
-    /*********************   阻塞自己的时机  ***********************
-       在硬盘已经开始工作(开始在内部读数据或写数据)后才能阻塞自己,现在硬盘已经开始忙了,
-       将自己阻塞,等待硬盘完成读操作后通过中断处理程序唤醒自己*/
-    semaphore_down (&hd->my_channel->disk_done);
-    /*************************************************************/
+/* pio传输时在请求各bio的缓冲区上移动的游标 */
+struct bio_cursor {
+  struct list_elem* elem; // 当前的bio
+  uint32_t          sec;  // 在当前bio中已传输的扇区数
+};
 
-    /* 4 检测硬盘状态是否可读 */
-    /* 醒来后开始执行下面代码*/
-    if (!busy_wait (hd)) { // 若失败
-      char error[64];
-      sprintf (error, "%s read sector %d failed!!!!!!\n", hd->name, lba);
-      PANIC (error);
+/* 在游标处的缓冲区与数据端口间传输sec_cnt个扇区,可跨越多个bio */
+static void
+pio_move (struct disk* hd, struct bio_cursor* cur, uint32_t sec_cnt,
+          bool write) {
+  while (sec_cnt > 0) {
+    struct bio* bio = elem2entry (struct bio, tag, cur->elem);
+    uint32_t    secs= bio->sec_cnt - cur->sec;
+    if (secs > sec_cnt) {
+      secs= sec_cnt;
+    }
+    void* addr= (void*) ((uint32_t) bio->buf + cur->sec * 512);
+    if (write) {
+      write2sector (hd, addr, secs);
+    }
+    else {
+      read_from_sector (hd, addr, secs);
+    }
+    cur->sec+= secs;
+    sec_cnt-= secs;
+    if (cur->sec == bio->sec_cnt) {
+      cur->elem= cur->elem->next;
+      cur->sec = 0;
     }
-
-    /* 5 把数据从硬盘的缓冲区中读出 */
-    read_from_sector (hd, (void*) ((uint32_t) buf + secs_done * 512), secs_op);
-    secs_done+= secs_op;
   }
-  lock_release (&hd->my_channel->lock);
 }
 
-/* 将buf中sec_cnt扇区数据写入硬盘 */
-void
-ide_write (struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt) {
-  ASSERT (lba <= max_lba);
-  ASSERT (sec_cnt > 0);
-  lock_acquire (&hd->my_channel->lock);
+/**
+ * 用pio完成请求req. 硬盘设置了多扇区模式时每个drq块有multi_secs个扇区,
+ * 否则只有1个,每个块都要等一次中断和drq. 调用时须持有通道锁,出错返回false.
+ */
+static bool
+pio_transfer (struct disk* hd, struct blk_request* req) {
+  struct ide_channel* channel= hd->my_channel;
+  uint32_t            block  = hd->multi_secs != 0 ? hd->multi_secs : 1;
+  struct bio_cursor   cur    = {req->bios.head.next, 0};
 
-  /* 1 先选择操作的硬盘 */
-  select_disk (hd);
+  /* 1 写入扇区数和起始扇区号,再把命令写入reg_cmd寄存器 */
+  select_sector (hd, req->lba, req->sec_cnt);
+  cmd_out (channel, rw_cmd (hd, false, req->write));
 
-  uint32_t secs_op;      // 每次操作的扇区数
+  uint32_t secs_op;      // 本块的扇区数
   uint32_t secs_done= 0; // 已完成的扇区数
-  while (secs_done < sec_cnt) {
-    if ((secs_done + 256) <= sec_cnt) {
-      secs_op= 256;
+  while (secs_done < req->sec_cnt) {
+    secs_op= req->sec_cnt - secs_done;
+    if (secs_op > block) {
+      secs_op= block;
+    }
+    if (req->write) {
+      /* 2 写命令的每块先等drq再写入数据,硬盘收完一块后发中断 */
+      if (!busy_wait (hd)) {
+        return false;
+      }
+      channel->expecting_intr= true;
+      pio_move (hd, &cur, secs_op, true);
+      semaphore_down (&channel->disk_done);
     }
     else {
-      secs_op= sec_cnt - secs_done;
+      /* 2 读命令的每块先阻塞到硬盘备好数据发来中断,
+       * 下一块的中断要等本块数据取走后才会发出,所以在取数据前置期待标记 */
+      semaphore_down (&channel->disk_done);
+      if (!busy_wait (hd)) {
+        return false;
+      }
+      channel->expecting_intr= secs_done + secs_op < req->sec_cnt;
+      pio_move (hd, &cur, secs_op, false);
     }
+    secs_done+= secs_op;
+  }
+  return !(channel->irq_status & BIT_STAT_ERR);
+}
 
-    /* 2 写入待写入的扇区数和起始扇区号 */
-    select_sector (
-        hd, lba + secs_done,
-        secs_op); // 先将待读的块号lba地址和待读入的扇区数写入lba寄存器
-
-    /* 3 执行的命令写入reg_cmd寄存器 */
-    cmd_out (hd->my_channel, CMD_WRITE_SECTOR); // 准备开始写数据
-
-    /* 4 检测硬盘状态是否可读 */
-    if (!busy_wait (hd)) { // 若失败
-      char error[64];
-      sprintf (error, "%s write sector %d failed!!!!!!\n", hd->name, lba);
-      PANIC (error);
-    }
+/* 块层派发来的请求,在派发线程中同步做完 */
+static void
+ide_request (struct blk_queue* q, struct blk_request* req) {
+  struct disk* hd= q->queuedata;
+  lock_acquire (&hd->my_channel->lock);
+  /* 同一通道上的两块硬盘共用通道锁,等锁的时间算作排队时长 */
+  req->start_ns= ktime_get_ns ();
 
-    /* 5 将数据写入硬盘 */
-    write2sector (hd, (void*) ((uint32_t) buf + secs_done * 512), secs_op);
+  /* 1 先选择操作的硬盘 */
+  select_disk (hd);
 
-    /* 在硬盘响应期间阻塞自己 */
-    semaphore_down (&hd->my_channel->disk_done);
-    secs_done+= secs_op;
+  /* 2 能用dma时用dma,否则用pio */
+  bool ok;
+  if (hd->dma && prdt_build (hd->my_channel, req)) {
+    ok= dma_transfer (hd, req);
+  }
+  else {
+    ok= pio_transfer (hd, req);
   }
-  /* 醒来后开始释放锁*/
   lock_release (&hd->my_channel->lock);
+  blk_request_end (req, ok);
+}
+
+/* 块设备的flush操作,让硬盘把写缓存落盘,等它完成 */
+static bool
+ide_flush (struct block_device* bdev) {
+  struct disk*        hd     = bdev->private_data;
+  struct ide_channel* channel= hd->my_channel;
+  lock_acquire (&channel->lock);
+  select_disk (hd);
+  cmd_out (channel, hd->lba48 ? CMD_FLUSH_CACHE_EXT : CMD_FLUSH_CACHE);
+  semaphore_down (&channel->disk_done);
+  bool ok= !(channel->irq_status & BIT_STAT_ERR);
+  lock_release (&channel->lock);
+  return ok;
 }
 
+/* ide硬盘的请求经请求队列排序合并后再交给ide_request */
+static const struct block_device_ops ide_bdev_ops= {blk_queue_submit,
+                                                    ide_flush};
+
 /* 将dst中len个相邻字节交换位置后存入buf */
 static void
 swap_pairs_bytes (const char* dst, char* buf, uint32_t len) {
@@ -265,8 +393,19 @@ swap_pairs_bytes (const char* dst, char* buf, uint32_t len) {
   buf[idx]= '\0';
 }
 
-/* 获得硬盘参数信息 */
-static void
+/* 设置多扇区读写每块的扇区数,硬盘不接受时返回false */
+static bool
+set_multiple (struct disk* hd, uint8_t secs) {
+  struct ide_channel* channel= hd->my_channel;
+  select_disk (hd);
+  outb (reg_sect_cnt (channel), secs);
+  cmd_out (channel, CMD_SET_MULTIPLE);
+  semaphore_down (&channel->disk_done);
+  return !(channel->irq_status & BIT_STAT_ERR);
+}
+
+/* 获得硬盘参数信息,返回扇区总数 */
+static uint32_t
 identify_disk (struct disk* hd) {
   char id_info[512];
   select_disk (hd);
@@ -278,7 +417,7 @@ identify_disk (struct disk* hd) {
   /* 醒来后开始执行下面代码*/
   if (!busy_wait (hd)) { //  若失败
     char error[64];
-    sprintf (error, "%s identify failed!!!!!!\n", hd->name);
+    sprintf (error, "%s identify failed!!!!!!\n", hd->bdev.name);
     PANIC (error);
   }
   read_from_sector (hd, id_info, 1);
@@ -286,76 +425,53 @@ identify_disk (struct disk* hd) {
   char    buf[64];
   uint8_t sn_start= 10 * 2, sn_len= 20, md_start= 27 * 2, md_len= 40;
   swap_pairs_bytes (&id_info[sn_start], buf, sn_len);
-  printk ("   disk %s info:\n      SN: %s\n", hd->name, buf);
+  printk ("   disk %s info:\n      SN: %s\n", hd->bdev.name, buf);
   memset (buf, 0, sizeof (buf));
   swap_pairs_bytes (&id_info[md_start], buf, md_len);
   printk ("      MODULE: %s\n", buf);
-  uint32_t sectors= *(uint32_t*) &id_info[60 * 2];
-  printk ("      SECTORS: %d\n", sectors);
-  printk ("      CAPACITY: %dMB\n", sectors * 512 / 1024 / 1024);
-}
 
-/* 扫描硬盘hd中地址为ext_lba的扇区中的所有分区 */
-static void
-partition_scan (struct disk* hd, uint32_t ext_lba) {
-  struct boot_sector* bs= sys_malloc (sizeof (struct boot_sector));
-  ide_read (hd, ext_lba, bs, 1);
-  uint8_t                       part_idx= 0;
-  struct partition_table_entry* p       = bs->partition_table;
-
-  /* 遍历分区表4个分区表项 */
-  while (part_idx++ < 4) {
-    if (p->fs_type == 0x5) { // 若为扩展分区
-      if (ext_lba_base != 0) {
-        /* 子扩展分区的start_lba是相对于主引导扇区中的总扩展分区地址 */
-        partition_scan (hd, p->start_lba + ext_lba_base);
-      }
-      else { // ext_lba_base为0表示是第一次读取引导块,也就是主引导记录所在的扇区
-        /* 记录下扩展分区的起始lba地址,后面所有的扩展分区地址都相对于此 */
-        ext_lba_base= p->start_lba;
-        partition_scan (hd, p->start_lba);
-      }
-    }
-    else if (p->fs_type != 0) { // 若是有效的分区类型
-      if (ext_lba == 0) {       // 此时全是主分区
-        hd->prim_parts[p_no].start_lba= ext_lba + p->start_lba;
-        hd->prim_parts[p_no].sec_cnt  = p->sec_cnt;
-        hd->prim_parts[p_no].my_disk  = hd;
-        list_append (&partition_list, &hd->prim_parts[p_no].part_tag);
-        sprintf (hd->prim_parts[p_no].name, "%s%d", hd->name, p_no + 1);
-        p_no++;
-        ASSERT (p_no < 4); // 0,1,2,3
-      }
-      else {
-        hd->logic_parts[l_no].start_lba= ext_lba + p->start_lba;
-        hd->logic_parts[l_no].sec_cnt  = p->sec_cnt;
-        hd->logic_parts[l_no].my_disk  = hd;
-        list_append (&partition_list, &hd->logic_parts[l_no].part_tag);
-        sprintf (hd->logic_parts[l_no].name, "%s%d", hd->name,
-                 l_no + 5); // 逻辑分区数字是从5开始,主分区是1～4.
-        l_no++;
-        if (l_no >= 8) // 只支持8个逻辑分区,避免数组越界
-          return;
-      }
-    }
-    p++;
+  /* 第83个字的第10位表示支持lba48,此时扇区数在第100~103个字,
+   * 否则在第60~61个字. lba只用32位,更大的硬盘只用前2TB */
+  uint32_t sectors;
+  hd->lba48= (id_info[83 * 2 + 1] & 0x4) != 0;
+  if (hd->lba48) {
+    uint32_t high= *(uint32_t*) &id_info[102 * 2];
+    sectors      = high != 0 ? 0xffffffff : *(uint32_t*) &id_info[100 * 2];
+    hd->max_secs = 65536;
   }
-  sys_free (bs);
+  else {
+    sectors     = *(uint32_t*) &id_info[60 * 2];
+    hd->max_secs= 256;
+  }
+  printk ("      SECTORS: %d, LBA48: %s\n", sectors, hd->lba48 ? "yes" : "no");
+  printk ("      CAPACITY: %dMB\n", sectors / 2048);
+
+  /* 第49个字的第8位表示支持dma */
+  hd->dma= hd->my_channel->bmide_base != 0 && (id_info[49 * 2 + 1] & 0x1);
+  printk ("      DMA: %s\n", hd->dma ? "yes" : "no");
+
+  /* 第47个字的低8位是多扇区读写每块最多的扇区数 */
+  uint8_t max_multi= id_info[47 * 2];
+  hd->multi_secs   = 0;
+  if (max_multi != 0 && set_multiple (hd, max_multi)) {
+    hd->multi_secs= max_multi;
+  }
+  /* 第48个字的第0位表示支持双字传输,pci上的ide控制器也都支持 */
+  hd->io32= hd->my_channel->bmide_base != 0 || (id_info[48 * 2] & 0x1);
+  printk ("      MULTIPLE: %d, IO32: %s\n", hd->multi_secs,
+          hd->io32 ? "yes" : "no");
+  return sectors;
 }
 
-/* 打印分区信息 */
-static bool
-partition_info (struct list_elem* pelem, int arg) {
-  struct partition* part= elem2entry (struct partition, part_tag, pelem);
-  printk ("   %s start_lba:0x%x, sec_cnt:0x%x\n", part->name, part->start_lba,
-          part->sec_cnt);
-
-  /* 在此处return false与函数本身功能无关,
-   * 只是为了让主调函数list_traversal继续向下遍历元素 */
-  return false;
+/* 硬盘中断的下半部,报告出错的命令 */
+static void
+ide_error_report (void* arg) {
+  struct ide_channel* channel= arg;
+  printk ("%s: command error, status 0x%x, error 0x%x\n", channel->name,
+          channel->irq_status, channel->irq_error);
 }
 
-/* 硬盘中断处理程序 */
+/* 硬盘中断处理程序,只做应答和唤醒,其余工作交给下半部 */
 void
 intr_hd_handler (uint8_t irq_no) {
   ASSERT (irq_no == 0x2e || irq_no == 0x2f);
@@ -366,11 +482,21 @@ intr_hd_handler (uint8_t irq_no) {
    * 每次读写硬盘时会申请锁,从而保证了同步一致性 */
   if (channel->expecting_intr) {
     channel->expecting_intr= false;
-    semaphore_up (&channel->disk_done);
 
     /* 读取状态寄存器使硬盘控制器认为此次的中断已被处理,
      * 从而硬盘可以继续执行新的读写 */
-    inb (reg_status (channel));
+    if (channel->bmide_base != 0) {
+      /* 停止dma引擎,清除总线主控的中断和出错位 */
+      channel->irq_bm_status= inb (reg_bm_status (channel));
+      outb (reg_bm_cmd (channel), 0);
+      outb (reg_bm_status (channel), channel->irq_bm_status);
+    }
+    channel->irq_status= inb (reg_status (channel));
+    if (channel->irq_status & BIT_STAT_ERR) {
+      channel->irq_error= inb (reg_error (channel));
+      schedule_work (&channel->error_work);
+    }
+    semaphore_up (&channel->disk_done);
   }
 }
 
@@ -380,12 +506,22 @@ ide_init () {
   printk ("ide_init start\n");
   uint8_t hd_cnt= *((uint8_t*) (0x475)); // 获取硬盘的数量
   ASSERT (hd_cnt > 0);
-  list_init (&partition_list);
   channel_cnt= DIV_ROUND_UP (
       hd_cnt, 2); // 一个ide通道上有两个硬盘,根据硬盘数量反推有几个ide通道
   struct ide_channel* channel;
   uint8_t             channel_no= 0, dev_no= 0;
 
+  /* 找pci上的ide控制器,bar4为两个通道总线主控寄存器的基址,各占8个端口 */
+  uint16_t        bm_base= 0;
+  struct pci_dev* pdev   = pci_find_class (PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE,
+                                           NULL);
+  if (pdev != NULL && (pdev->prog_if & 0x80) && (pdev->bar[4] & PCI_BAR_IO)) {
+    bm_base= pdev->bar[4] & 0xfffc;
+    if (bm_base != 0) {
+      pci_enable_master (pdev);
+    }
+  }
+
   /* 处理每个通道上的硬盘 */
   while (channel_no < channel_cnt) {
     channel= &channels[channel_no];
@@ -409,10 +545,22 @@ ide_init () {
 
     channel->expecting_intr= false; // 未向硬盘写入指令时不期待硬盘的中断
     lock_init (&channel->lock);
+    lock_stat_register (&channel->lock, channel->name);
 
     /* 初始化为0,目的是向硬盘控制器请求数据后,硬盘驱动semaphore_down此信号量会阻塞线程,
     直到硬盘完成后通过发中断,由中断处理程序将此信号量semaphore_up,唤醒线程. */
     semaphore_init (&channel->disk_done, 0);
+    channel->disk_done.waiters.reason= BLOCK_IO;
+    work_init (&channel->error_work, ide_error_report, channel);
+
+    channel->bmide_base= 0;
+    if (bm_base != 0) {
+      channel->prdt= get_kernel_pages (1);
+      if (channel->prdt != NULL) {
+        channel->prdt_phy  = addr_v2p ((uint32_t) channel->prdt);
+        channel->bmide_base= bm_base + channel_no * 8;
+      }
+    }
 
     register_handler (channel->irq_no, intr_hd_handler);
 
@@ -421,20 +569,19 @@ ide_init () {
       struct disk* hd= &channel->devices[dev_no];
       hd->my_channel = channel;
       hd->dev_no     = dev_no;
-      sprintf (hd->name, "sd%c", 'a' + channel_no * 2 + dev_no);
-      identify_disk (hd);       // 获取硬盘参数
-      if (dev_no != 0) {        // 内核本身的裸硬盘(hd60M.img)不处理
-        partition_scan (hd, 0); // 扫描该硬盘上的分区
+      sprintf (hd->bdev.name, "sd%c", 'a' + channel_no * 2 + dev_no);
+      uint32_t sectors= identify_disk (hd); // 获取硬盘参数
+      blk_queue_init (&hd->queue, hd->bdev.name, ide_request, hd, IDE_REQ_SECS,
+                      1);
+      bdev_register (&hd->bdev, &ide_bdev_ops, sectors, IDE_REQ_SECS,
+                     &hd->queue, hd);
+      if (dev_no != 0) {            // 内核本身的裸硬盘(hd60M.img)不处理
+        partition_scan (&hd->bdev); // 扫描该硬盘上的分区
       }
-      p_no= 0, l_no= 0;
       dev_no++;
     }
     dev_no= 0; // 将硬盘驱动器号置0,为下一个channel的两个硬盘初始化。
     channel_no++; // 下一个channel
   }
-
-  printk ("\n   all partition info\n");
-  /* 打印所有分区信息 */
-  list_traversal (&partition_list, partition_info, (int) NULL);
   printk ("ide_init done\n");
 }
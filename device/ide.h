@@ -1,31 +1,29 @@
 #ifndef __DEVICE_IDE_H
 #define __DEVICE_IDE_H
-#include "bitmap.h"
+#include "blk.h"
 #include "list.h"
 #include "stdint.h"
 #include "sync.h"
+#include "workqueue.h"
 
-/* 分区结构 */
-struct partition {
-  uint32_t            start_lba;    // 起始扇区
-  uint32_t            sec_cnt;      // 扇区数
-  struct disk*        my_disk;      // 分区所属的硬盘
-  struct list_elem    part_tag;     // 用于队列中的标记
-  char                name[8];      // 分区名称
-  struct super_block* sb;           // 本分区的超级块
-  struct bitmap       block_bitmap; // 块位图
-  struct bitmap       inode_bitmap; // i结点位图
-  struct list         open_inodes;  // 本分区打开的i结点队列
+/* ide硬盘结构,其中的bdev接入块设备层,名称如sda等,扇区总数来自identify */
+struct disk {
+  struct block_device bdev;
+  struct ide_channel* my_channel; // 此块硬盘归属于哪个ide通道
+  uint8_t             dev_no;     // 本硬盘是主0还是从1
+  bool                lba48;      // 是否用48位lba寻址
+  uint32_t            max_secs;   // 一条命令最多读写的扇区数
+  struct blk_queue    queue;      // 请求队列
+  bool                dma;        // 能否用总线主控dma传输
+  uint8_t             multi_secs; // 多扇区读写每块的扇区数,0表示未启用
+  bool                io32;       // 数据端口能否按双字读写
 };
 
-/* 硬盘结构 */
-struct disk {
-  char                name[8];       // 本硬盘的名称，如sda等
-  struct ide_channel* my_channel;    // 此块硬盘归属于哪个ide通道
-  uint8_t             dev_no;        // 本硬盘是主0还是从1
-  struct partition    prim_parts[4]; // 主分区顶多是4个
-  struct partition
-      logic_parts[8]; // 逻辑分区数量无限,但总得有个支持的上限,那就支持8个
+/* 总线主控dma的prd表项,描述一段物理地址连续的缓冲区 */
+struct prd {
+  uint32_t phy_addr; // 缓冲区的物理地址
+  uint16_t byte_cnt; // 字节数,0表示64KB
+  uint16_t flags;    // 最高位为1表示是表中最后一项
 };
 
 /* ata通道结构 */
@@ -39,13 +37,17 @@ struct ide_channel {
   struct semaphore
       disk_done; // 硬盘处理完成.线程用这个信号量来阻塞自己，由硬盘完成后产生的中断将线程唤醒
   struct disk devices[2]; // 一个通道上连接两个硬盘，一主一从
+  uint8_t     irq_status; // 中断上半部读到的状态寄存器
+  uint8_t     irq_error;  // 出错时中断上半部读到的错误寄存器
+  struct work_struct error_work; // 在下半部报告出错的命令
+  uint16_t    bmide_base;    // 总线主控寄存器的起始端口号,0表示不支持dma
+  struct prd* prdt;          // 本通道的prd表,占一页
+  uint32_t    prdt_phy;      // prd表的物理地址
+  uint8_t     irq_bm_status; // 中断上半部读到的总线主控状态
 };
 
 void                      intr_hd_handler (uint8_t irq_no);
 void                      ide_init (void);
 extern uint8_t            channel_cnt;
 extern struct ide_channel channels[];
-extern struct list        partition_list;
-void ide_read (struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt);
-void ide_write (struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt);
 #endif
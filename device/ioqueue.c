@@ -5,9 +5,11 @@
 
 void
 ioqueue_init (struct ioqueue* queue) {
-  lock_init (&queue->lock);
+  wait_queue_init (&queue->not_full);
+  wait_queue_init (&queue->not_empty);
+  queue->not_full.reason = BLOCK_IO;
+  queue->not_empty.reason= BLOCK_IO;
   queue->head= queue->tail= 0;
-  queue->producer= queue->tail= NULL;
 }
 
 static int32_t
@@ -25,18 +27,6 @@ is_queue_empty (struct ioqueue* queue) {
   return queue->head == queue->tail;
 }
 
-static void
-queue_wait (struct task_struct** waiter) {
-  *waiter= running_thread ();
-  thread_block (TASK_BLOCKED);
-}
-
-static void
-wakeup (struct task_struct** waiter) {
-  thread_unblock (*waiter);
-  *waiter= NULL;
-}
-
 /**
  * 从给定的队列中获取一个字符，如果队列为空，那么等待.
  */
@@ -44,38 +34,31 @@ char
 queue_getchar (struct ioqueue* queue) {
   ASSERT (intr_get_status () == INTR_OFF);
 
+  /* 多个消费者都以独占方式等待,每来一个字符只唤醒其中一个 */
   while (is_queue_empty (queue)) {
-    lock_acquire (&queue->lock);
-    // 这里同时会把ioqueue的consumer置为当前线程
-    queue_wait (&queue->consumer);
-    lock_release (&queue->lock);
+    wait_queue_wait (&queue->not_empty, true, 0);
   }
 
   char byte  = queue->buf[queue->tail];
   queue->tail= next_pos (queue->tail);
 
-  if (queue->producer != NULL) {
-    // 在无锁的情况下调用解除阻塞操作，因为bochs是单核CPU且屏蔽了中断，所以是安全的
-    wakeup (&queue->producer);
-  }
-
+  wait_queue_wake (&queue->not_full, 1);
   return byte;
 }
 
-char
+/**
+ * 向给定的队列中放入一个字符，如果队列已满，那么等待.
+ */
+void
 queue_putchar (struct ioqueue* queue, char byte) {
   ASSERT (intr_get_status () == INTR_OFF);
 
   while (is_queue_full (queue)) {
-    lock_acquire (&queue->lock);
-    queue_wait (&queue->producer);
-    lock_release (&queue->lock);
+    wait_queue_wait (&queue->not_full, true, 0);
   }
 
   queue->buf[queue->head]= byte;
   queue->head            = next_pos (queue->head);
 
-  if (queue->consumer != NULL) {
-    wakeup (&queue->consumer);
-  }
+  wait_queue_wake (&queue->not_empty, 1);
 }
@@ -7,19 +7,21 @@
 
 #define buf_size 64
 
+/**
+ * 环形缓冲区,生产者和消费者都可以有多个,缓冲区满或空时在各自的等待队列上等待.
+ */
 struct ioqueue {
-  struct lock*        lock;
-  struct task_struct* producer;
-  struct task_struct* consumer;
-  char                buf[buf_size];
-  int32_t             head;
-  int32_t             tail;
+  struct wait_queue not_full;  // 等待缓冲区有空位的生产者
+  struct wait_queue not_empty; // 等待缓冲区有数据的消费者
+  char              buf[buf_size];
+  int32_t           head;
+  int32_t           tail;
 };
 
 int  is_queue_full (struct ioqueue* queue);
 void ioqueue_init (struct ioqueue* queue);
 int  is_queue_empty (struct ioqueue* queue);
 char queue_getchar (struct ioqueue* queue);
-char queue_putchar (struct ioqueue* queue, char byte);
+void queue_putchar (struct ioqueue* queue, char byte);
 
 #endif
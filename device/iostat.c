@@ -0,0 +1,159 @@
+#include "iostat.h"
+#include "blk.h"
+#include "clocksource.h"
+#include "interrupt.h"
+#include "partition.h"
+#include "string.h"
+
+/* 时长所在的直方图桶,即其微秒数以2为底的对数 */
+static uint32_t
+usec_bucket (uint64_t ns) {
+  uint32_t rem;
+  uint64_t usec= div_u64_rem (ns, 1000, &rem);
+  if ((uint32_t) (usec >> 32) != 0) {
+    return IOSTAT_HIST_BUCKETS - 1;
+  }
+  uint32_t low= (uint32_t) usec;
+  uint32_t bit;
+  if (low == 0) {
+    return 0;
+  }
+  asm ("bsr %1, %0" : "=r"(bit) : "rm"(low));
+  return bit < IOSTAT_HIST_BUCKETS ? bit : IOSTAT_HIST_BUCKETS - 1;
+}
+
+/* bio所在的分区,不在任何分区中时返回NULL */
+static struct partition*
+bio_part (struct bio* bio) {
+  struct list_elem* elem= partition_list.head.next;
+  while (elem != &partition_list.tail) {
+    struct partition* part= elem2entry (struct partition, part_tag, elem);
+    if (part->bdev == bio->bdev && bio->lba >= part->start_lba
+        && bio->lba < part->start_lba + part->sec_cnt) {
+      return part;
+    }
+    elem= elem->next;
+  }
+  return NULL;
+}
+
+/* 在途bio数加1,从0变为1时开始计忙碌时长 */
+static void
+iostat_inc (struct io_stat* st, uint64_t now) {
+  if (st->in_flight++ == 0) {
+    st->busy_start= now;
+  }
+}
+
+/* 记下一个完成的bio,在途数减为0时累计这段忙碌时长 */
+static void
+iostat_account (struct io_stat* st, struct bio* bio, bool ok, uint64_t now) {
+  uint64_t queue_ns = bio->start_ns - bio->submit_ns;
+  uint64_t device_ns= now - bio->start_ns;
+  if (bio->write) {
+    st->writes++;
+    st->write_secs+= bio->sec_cnt;
+  }
+  else {
+    st->reads++;
+    st->read_secs+= bio->sec_cnt;
+  }
+  if (!ok) {
+    st->errors++;
+  }
+  st->queue_ns+= queue_ns;
+  st->device_ns+= device_ns;
+  st->queue_hist[usec_bucket (queue_ns)]++;
+  st->device_hist[usec_bucket (device_ns)]++;
+  if (--st->in_flight == 0) {
+    st->busy_ns+= now - st->busy_start;
+  }
+}
+
+/* 清零统计并记下名称 */
+void
+iostat_init (struct io_stat* st, const char* name) {
+  memset (st, 0, sizeof (struct io_stat));
+  strcpy (st->name, name);
+}
+
+/**
+ * 由submit_bio在把bio交给驱动前调用,记下提交时刻.
+ * 驱动开始处理的时刻先取提交时刻,经请求队列的bio由blk_request_end改写.
+ * 调用时须关中断.
+ */
+void
+iostat_submit (struct bio* bio) {
+  uint64_t          now = ktime_get_ns ();
+  struct partition* part= bio_part (bio);
+  bio->submit_ns        = now;
+  bio->start_ns         = now;
+  iostat_inc (&bio->bdev->stat, now);
+  if (part != NULL) {
+    iostat_inc (&part->stat, now);
+  }
+}
+
+/* bio并入队列中已有的请求时调用,调用时须关中断 */
+void
+iostat_merge (struct bio* bio) {
+  struct partition* part= bio_part (bio);
+  bio->bdev->stat.merges++;
+  if (part != NULL) {
+    part->stat.merges++;
+  }
+}
+
+/* 由bio_endio调用,记下完成的bio,调用时须关中断 */
+void
+iostat_done (struct bio* bio, bool ok) {
+  uint64_t          now = ktime_get_ns ();
+  struct partition* part= bio_part (bio);
+  iostat_account (&bio->bdev->stat, bio, ok, now);
+  if (part != NULL) {
+    iostat_account (&part->stat, bio, ok, now);
+  }
+}
+
+/**
+ * 把第idx个统计复制到st,编号先是block_devices中的各块设备,
+ * 接着是partition_list中的各分区,依次取到返回-1为止即可列出全部.
+ * 复制出的busy_ns包括正在进行的忙碌时长.
+ */
+int32_t
+sys_iostat (uint32_t idx, struct io_stat* st) {
+  if (st == NULL) {
+    return -1;
+  }
+  struct io_stat*   src = NULL;
+  struct list_elem* elem= block_devices.head.next;
+  while (elem != &block_devices.tail && idx > 0) {
+    elem= elem->next;
+    idx--;
+  }
+  if (elem != &block_devices.tail) {
+    struct block_device* bdev=
+        elem2entry (struct block_device, bdev_tag, elem);
+    src= &bdev->stat;
+  }
+  else {
+    elem= partition_list.head.next;
+    while (elem != &partition_list.tail && idx > 0) {
+      elem= elem->next;
+      idx--;
+    }
+    if (elem == &partition_list.tail) {
+      return -1;
+    }
+    struct partition* part= elem2entry (struct partition, part_tag, elem);
+    src                   = &part->stat;
+  }
+
+  enum intr_status old_status= intr_disable ();
+  *st                        = *src;
+  if (st->in_flight > 0) {
+    st->busy_ns+= ktime_get_ns () - st->busy_start;
+  }
+  intr_set_status (old_status);
+  return 0;
+}
@@ -0,0 +1,38 @@
+#ifndef __DEVICE_IOSTAT_H
+#define __DEVICE_IOSTAT_H
+#include "global.h"
+#include "stdint.h"
+
+#define IOSTAT_HIST_BUCKETS 24 // 延迟直方图的桶数
+
+struct bio;
+
+/**
+ * 一个块设备或分区的读写统计,以bio为单位计数,时长单位为纳秒.
+ * 排队时长从提交到驱动开始处理,包括在请求队列中和在ide通道锁上的等待;
+ * 设备时长从驱动开始处理到完成. 直方图按微秒分桶,hist[i]为时长落在
+ * [2^i, 2^(i+1))微秒中的次数,不足1微秒的算在hist[0],最后一个桶包含更长的.
+ */
+struct io_stat {
+  char     name[8];
+  uint32_t reads;      // 完成的读bio数
+  uint32_t writes;     // 完成的写bio数
+  uint32_t read_secs;  // 读的扇区数
+  uint32_t write_secs; // 写的扇区数
+  uint32_t merges;     // 并入队列中已有请求的bio数
+  uint32_t errors;     // 出错的bio数
+  uint32_t in_flight;  // 已提交未完成的bio数
+  uint64_t busy_ns;    // 有bio在途的总时长
+  uint64_t busy_start; // 本次有bio在途的开始时刻
+  uint64_t queue_ns;   // 排队总时长
+  uint64_t device_ns;  // 设备处理总时长
+  uint32_t queue_hist[IOSTAT_HIST_BUCKETS];
+  uint32_t device_hist[IOSTAT_HIST_BUCKETS];
+};
+
+void    iostat_init (struct io_stat* st, const char* name);
+void    iostat_submit (struct bio* bio);
+void    iostat_merge (struct bio* bio);
+void    iostat_done (struct bio* bio, bool ok);
+int32_t sys_iostat (uint32_t idx, struct io_stat* st);
+#endif
@@ -4,8 +4,10 @@
 #include "io.h"
 #include "ioqueue.h"
 #include "kernel/print.h"
+#include "workqueue.h"
 
 #define KEYBOARD_BUF_PORT 0x60
+#define SCANCODE_BUF_SIZE 64 // 上半部暂存扫描码的缓冲区大小
 
 /**
  * 用转义字符定义的控制字符.
@@ -48,6 +50,11 @@ static int ctrl_status, shift_status, alt_status, caps_lock_status,
     ext_scan_code;
 static struct ioqueue keyboard_buffer;
 
+/* 中断上半部收到的扫描码,由keyboard_work在进程上下文中译码 */
+static uint8_t            scancode_buf[SCANCODE_BUF_SIZE];
+static uint32_t           scancode_head, scancode_tail;
+static struct work_struct keyboard_work;
+
 /**
  * 以通码为索引的显示字符数组，零号元素为shift没有按下时的展示，1反之.
  */
@@ -111,10 +118,9 @@ static char keymap[][2]= {{0, 0},
                           {' ', ' '},
                           {caps_lock_char, caps_lock_char}};
 
+/* 译码一个扫描码,更新控制键状态并把字符放入键盘缓冲区 */
 static void
-init_keyboard_handler (void) {
-  uint16_t code= inb (KEYBOARD_BUF_PORT);
-
+keyboard_decode (uint16_t code) {
   if (code == 0xe0) {
     // 扩展字符，等待第二个扫描码
     ext_scan_code= 1;
@@ -176,9 +182,13 @@ init_keyboard_handler (void) {
 
   char cur_char= keymap[index][shift];
 
-  if (cur_char && !is_queue_full (&keyboard_buffer)) {
-    put_char (cur_char);
-    queue_putchar (&keyboard_buffer, cur_char);
+  if (cur_char) {
+    enum intr_status old_status= intr_disable ();
+    if (!is_queue_full (&keyboard_buffer)) {
+      put_char (cur_char);
+      queue_putchar (&keyboard_buffer, cur_char);
+    }
+    intr_set_status (old_status);
     return;
   }
 
@@ -196,10 +206,36 @@ init_keyboard_handler (void) {
   }
 }
 
+/* 键盘中断的下半部,译码上半部收到的全部扫描码 */
+static void
+keyboard_work_func (void* arg UNUSED) {
+  while (1) {
+    enum intr_status old_status= intr_disable ();
+    if (scancode_tail == scancode_head) {
+      intr_set_status (old_status);
+      break;
+    }
+    uint8_t scancode= scancode_buf[scancode_tail++ % SCANCODE_BUF_SIZE];
+    intr_set_status (old_status);
+    keyboard_decode (scancode);
+  }
+}
+
+/* 键盘中断的上半部,只取出扫描码,缓冲区满时丢弃 */
+static void
+init_keyboard_handler (void) {
+  uint8_t scancode= inb (KEYBOARD_BUF_PORT);
+  if (scancode_head - scancode_tail < SCANCODE_BUF_SIZE) {
+    scancode_buf[scancode_head++ % SCANCODE_BUF_SIZE]= scancode;
+  }
+  schedule_work (&keyboard_work);
+}
+
 void
 keyboard_init (void) {
   put_str ("Keyboard init start...\n");
   ioqueue_init (&keyboard_buffer);
+  work_init (&keyboard_work, keyboard_work_func, NULL);
   register_handler (0x21, init_keyboard_handler);
   put_str ("Keyboard init done.\n");
 }
@@ -0,0 +1,130 @@
+#include "partition.h"
+#include "memory.h"
+#include "stdio-kernel.h"
+#include "stdio.h"
+#include "string.h"
+
+#define MAX_PRIM_PARTS 4  // 主分区顶多是4个
+#define MAX_LOGIC_PARTS 8 // 逻辑分区数量无限,但总得有个支持的上限,那就支持8个
+
+struct list partition_list; // 分区队列
+
+/* 构建一个16字节大小的结构体,用来存分区表项 */
+struct partition_table_entry {
+  uint8_t bootable;         // 是否可引导
+  uint8_t start_head;       // 起始磁头号
+  uint8_t start_sec;        // 起始扇区号
+  uint8_t start_chs;        // 起始柱面号
+  uint8_t fs_type;          // 分区类型
+  uint8_t end_head;         // 结束磁头号
+  uint8_t end_sec;          // 结束扇区号
+  uint8_t end_chs;          // 结束柱面号
+                            /* 更需要关注的是下面这两项 */
+  uint32_t start_lba;       // 本分区起始扇区的lba地址
+  uint32_t sec_cnt;         // 本分区的扇区数目
+} __attribute__ ((packed)); // 保证此结构是16字节大小
+
+/* 引导扇区,mbr或ebr所在的扇区 */
+struct boot_sector {
+  uint8_t other[446];                              // 引导代码
+  struct partition_table_entry partition_table[4]; // 分区表中有4项,共64字节
+  uint16_t signature; // 启动扇区的结束标志是0x55,0xaa,
+} __attribute__ ((packed));
+
+/* 扫描一个块设备时的状态 */
+struct part_scan {
+  struct block_device* bdev;
+  uint32_t ext_lba_base; // 总扩展分区的起始lba,为0表示还没读到扩展分区
+  uint8_t  p_no;         // 已找到的主分区数
+  uint8_t  l_no;         // 已找到的逻辑分区数
+};
+
+/**
+ * 在bdev上新建从start_lba起的sec_cnt个扇区的分区并加入partition_list,
+ * no为分区名中的编号. 没有分区表的设备如内存盘直接调用.
+ */
+void
+partition_add (struct block_device* bdev, uint32_t start_lba, uint32_t sec_cnt,
+               uint8_t no) {
+  struct partition* part= sys_malloc (sizeof (struct partition));
+  if (part == NULL) {
+    printk ("%s: alloc partition failed\n", bdev->name);
+    return;
+  }
+  memset (part, 0, sizeof (struct partition));
+  part->start_lba= start_lba;
+  part->sec_cnt  = sec_cnt;
+  part->bdev     = bdev;
+  sprintf (part->name, "%s%d", bdev->name, no);
+  iostat_init (&part->stat, part->name);
+  list_append (&partition_list, &part->part_tag);
+}
+
+/* 扫描地址为ext_lba的扇区中的所有分区 */
+static void
+partition_scan_sector (struct part_scan* scan, uint32_t ext_lba) {
+  struct boot_sector* bs= sys_malloc (sizeof (struct boot_sector));
+  if (bs == NULL) {
+    return;
+  }
+  bdev_read (scan->bdev, ext_lba, bs, 1);
+  uint8_t                       part_idx= 0;
+  struct partition_table_entry* p       = bs->partition_table;
+
+  /* 遍历分区表4个分区表项 */
+  while (part_idx++ < 4) {
+    if (p->fs_type == 0x5) { // 若为扩展分区
+      if (scan->ext_lba_base != 0) {
+        /* 子扩展分区的start_lba是相对于主引导扇区中的总扩展分区地址 */
+        partition_scan_sector (scan, p->start_lba + scan->ext_lba_base);
+      }
+      else { // ext_lba_base为0表示是第一次读取引导块,也就是主引导记录所在的扇区
+        /* 记录下扩展分区的起始lba地址,后面所有的扩展分区地址都相对于此 */
+        scan->ext_lba_base= p->start_lba;
+        partition_scan_sector (scan, p->start_lba);
+      }
+    }
+    else if (p->fs_type != 0) { // 若是有效的分区类型
+      if (ext_lba == 0) {       // 此时全是主分区
+        if (scan->p_no < MAX_PRIM_PARTS) {
+          partition_add (scan->bdev, p->start_lba, p->sec_cnt, scan->p_no + 1);
+          scan->p_no++;
+        }
+      }
+      else if (scan->l_no < MAX_LOGIC_PARTS) {
+        /* 逻辑分区数字是从5开始,主分区是1～4. */
+        partition_add (scan->bdev, ext_lba + p->start_lba, p->sec_cnt,
+                       scan->l_no + 5);
+        scan->l_no++;
+      }
+    }
+    p++;
+  }
+  sys_free (bs);
+}
+
+/* 扫描块设备bdev上的所有分区并加入partition_list,由各驱动在接入硬盘后调用 */
+void
+partition_scan (struct block_device* bdev) {
+  struct part_scan scan= {bdev, 0, 0, 0};
+  partition_scan_sector (&scan, 0);
+}
+
+/* 打印分区信息 */
+static bool
+partition_info (struct list_elem* pelem, int arg) {
+  struct partition* part= elem2entry (struct partition, part_tag, pelem);
+  printk ("   %s start_lba:0x%x, sec_cnt:0x%x\n", part->name, part->start_lba,
+          part->sec_cnt);
+
+  /* 在此处return false与函数本身功能无关,
+   * 只是为了让主调函数list_traversal继续向下遍历元素 */
+  return false;
+}
+
+/* 打印所有分区信息 */
+void
+partition_show (void) {
+  printk ("\n   all partition info\n");
+  list_traversal (&partition_list, partition_info, (int) NULL);
+}
@@ -0,0 +1,31 @@
+#ifndef __DEVICE_PARTITION_H
+#define __DEVICE_PARTITION_H
+#include "bitmap.h"
+#include "blk.h"
+#include "iostat.h"
+#include "list.h"
+#include "stdint.h"
+#include "sync.h"
+
+/* 分区结构,建在任意块设备之上,其中的lba都是在整个块设备上的地址 */
+struct partition {
+  uint32_t             start_lba;    // 起始扇区
+  uint32_t             sec_cnt;      // 扇区数
+  struct block_device* bdev;         // 分区所在的块设备
+  struct list_elem     part_tag;     // 用于队列中的标记
+  char                 name[8];      // 分区名称
+  struct super_block*  sb;           // 本分区的超级块
+  struct bitmap        block_bitmap; // 块位图
+  struct bitmap        inode_bitmap; // i结点位图
+  struct list          open_inodes;  // 本分区打开的i结点队列
+  struct rwlock        dir_lock;     // 目录树的读写锁,路径查找持读锁
+  struct rwlock        inode_lock;   // open_inodes的读写锁
+  struct io_stat       stat;         // 本分区上的读写统计
+};
+
+extern struct list partition_list;
+void               partition_add (struct block_device* bdev, uint32_t start_lba,
+                                  uint32_t sec_cnt, uint8_t no);
+void               partition_scan (struct block_device* bdev);
+void               partition_show (void);
+#endif
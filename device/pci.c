@@ -0,0 +1,209 @@
+#include "pci.h"
+#include "interrupt.h"
+#include "io.h"
+#include "print.h"
+
+/* 配置空间的访问端口,即配置机制#1 */
+#define PCI_CONFIG_ADDRESS 0xcf8
+#define PCI_CONFIG_DATA 0xcfc
+
+#define PCI_BUS_CNT 256
+#define PCI_DEV_CNT 32
+#define PCI_FUNC_CNT 8
+
+static struct pci_dev pci_devs[PCI_MAX_DEVS]; // 枚举到的设备
+static uint32_t       pci_dev_cnt;
+
+/* 挂在某个中断向量上的一个处理程序 */
+struct pci_irq_action {
+  uint8_t          irq_no;
+  pci_irq_handler* handler;
+};
+static struct pci_irq_action pci_irq_actions[PCI_MAX_IRQ_ACTIONS];
+static uint32_t              pci_irq_cnt;
+
+/* 按总线号,设备号,功能号和偏移读配置空间,偏移须4字节对齐 */
+static uint32_t
+pci_config_read (uint8_t bus, uint8_t dev, uint8_t func, uint8_t offset) {
+  outl (PCI_CONFIG_ADDRESS, 0x80000000 | bus << 16 | dev << 11 | func << 8
+                                | (offset & 0xfc));
+  return inl (PCI_CONFIG_DATA);
+}
+
+static void
+pci_config_write (uint8_t bus, uint8_t dev, uint8_t func, uint8_t offset,
+                  uint32_t value) {
+  outl (PCI_CONFIG_ADDRESS, 0x80000000 | bus << 16 | dev << 11 | func << 8
+                                | (offset & 0xfc));
+  outl (PCI_CONFIG_DATA, value);
+}
+
+uint32_t
+pci_read_config (struct pci_dev* pdev, uint8_t offset) {
+  return pci_config_read (pdev->bus, pdev->dev, pdev->func, offset);
+}
+
+void
+pci_write_config (struct pci_dev* pdev, uint8_t offset, uint32_t value) {
+  pci_config_write (pdev->bus, pdev->dev, pdev->func, offset, value);
+}
+
+/* 记下bus:dev.func上的设备 */
+static void
+pci_add_device (uint8_t bus, uint8_t dev, uint8_t func, uint32_t id) {
+  if (pci_dev_cnt == PCI_MAX_DEVS) {
+    return;
+  }
+  struct pci_dev* pdev= &pci_devs[pci_dev_cnt++];
+  pdev->bus           = bus;
+  pdev->dev           = dev;
+  pdev->func          = func;
+  pdev->vendor_id     = id & 0xffff;
+  pdev->device_id     = id >> 16;
+
+  uint32_t class_rev= pci_config_read (bus, dev, func, PCI_CLASS_REV);
+  pdev->class_code  = class_rev >> 24;
+  pdev->subclass    = class_rev >> 16;
+  pdev->prog_if     = class_rev >> 8;
+  pdev->irq_line    = pci_config_read (bus, dev, func, PCI_INTERRUPT_LINE);
+
+  uint8_t idx= 0;
+  while (idx < 6) {
+    pdev->bar[idx]= pci_config_read (bus, dev, func, PCI_BAR0 + idx * 4);
+    idx++;
+  }
+
+  put_str ("   pci ");
+  put_int (bus);
+  put_char (':');
+  put_int (dev);
+  put_char ('.');
+  put_int (func);
+  put_str (" id ");
+  put_int (pdev->vendor_id);
+  put_char (':');
+  put_int (pdev->device_id);
+  put_str (" class ");
+  put_int (pdev->class_code);
+  put_char (':');
+  put_int (pdev->subclass);
+  put_char ('\n');
+}
+
+/* 从from之后(from为NULL时从头)找类别为class_code:subclass的设备 */
+struct pci_dev*
+pci_find_class (uint8_t class_code, uint8_t subclass, struct pci_dev* from) {
+  uint32_t idx= from == NULL ? 0 : from - pci_devs + 1;
+  while (idx < pci_dev_cnt) {
+    if (pci_devs[idx].class_code == class_code
+        && pci_devs[idx].subclass == subclass) {
+      return &pci_devs[idx];
+    }
+    idx++;
+  }
+  return NULL;
+}
+
+/* 从from之后(from为NULL时从头)找厂商号和设备号匹配的设备 */
+struct pci_dev*
+pci_find_device (uint16_t vendor_id, uint16_t device_id, struct pci_dev* from) {
+  uint32_t idx= from == NULL ? 0 : from - pci_devs + 1;
+  while (idx < pci_dev_cnt) {
+    if (pci_devs[idx].vendor_id == vendor_id
+        && pci_devs[idx].device_id == device_id) {
+      return &pci_devs[idx];
+    }
+    idx++;
+  }
+  return NULL;
+}
+
+/* 允许设备响应i/o和内存访问并做总线主控 */
+void
+pci_enable_master (struct pci_dev* pdev) {
+  uint32_t cmd= pci_read_config (pdev, PCI_COMMAND);
+  cmd|= PCI_CMD_IO | PCI_CMD_MEMORY | PCI_CMD_MASTER;
+  pci_write_config (pdev, PCI_COMMAND, cmd & 0xffff); // 高16位是status,写1会清位
+}
+
+/**
+ * pci设备中断的总入口,依次调用挂在这个向量上的所有处理程序.
+ * 各处理程序要先读自己设备的中断状态,不是自己的设备发的就直接返回
+ */
+static void
+pci_intr_dispatch (uint8_t irq_no) {
+  uint32_t idx= 0;
+  while (idx < pci_irq_cnt) {
+    if (pci_irq_actions[idx].irq_no == irq_no) {
+      pci_irq_actions[idx].handler (irq_no);
+    }
+    idx++;
+  }
+}
+
+/**
+ * 把handler挂到pdev的中断引脚上并打开引脚,成功返回true.
+ * intx引脚常由几个设备共用,如qemu中的virtio-blk和ahci,
+ * 直接register_handler会顶掉先注册的驱动,因此都经pci_intr_dispatch分发.
+ * 同一驱动的几个设备在同一引脚上时只挂一次
+ */
+bool
+pci_request_irq (struct pci_dev* pdev, pci_irq_handler* handler) {
+  if (pdev->irq_line == 0 || pdev->irq_line >= 16) {
+    return false;
+  }
+  uint8_t          irq_no    = 0x20 + pdev->irq_line;
+  enum intr_status old_status= intr_disable ();
+  uint32_t         idx       = 0;
+  while (idx < pci_irq_cnt && (pci_irq_actions[idx].irq_no != irq_no
+                               || pci_irq_actions[idx].handler != handler)) {
+    idx++;
+  }
+  if (idx == pci_irq_cnt) {
+    if (pci_irq_cnt == PCI_MAX_IRQ_ACTIONS) {
+      intr_set_status (old_status);
+      return false;
+    }
+    pci_irq_actions[idx].irq_no = irq_no;
+    pci_irq_actions[idx].handler= handler;
+    pci_irq_cnt++;
+  }
+  register_handler (irq_no, pci_intr_dispatch);
+  pic_enable_irq (pdev->irq_line);
+  intr_set_status (old_status);
+  return true;
+}
+
+/* 枚举所有总线上的设备 */
+void
+pci_init (void) {
+  put_str ("pci_init start\n");
+  uint32_t bus= 0;
+  while (bus < PCI_BUS_CNT) {
+    uint8_t dev= 0;
+    while (dev < PCI_DEV_CNT) {
+      uint8_t func= 0;
+      while (func < PCI_FUNC_CNT) {
+        uint32_t id= pci_config_read (bus, dev, func, PCI_VENDOR_ID);
+        if ((id & 0xffff) == 0xffff) { // 不存在
+          if (func == 0) {
+            break;
+          }
+          func++;
+          continue;
+        }
+        pci_add_device (bus, dev, func, id);
+        /* header type的第7位为0表示单功能设备 */
+        if (func == 0
+            && !(pci_config_read (bus, dev, 0, PCI_HEADER_TYPE)
+                 & 0x800000)) {
+          break;
+        }
+        func++;
+      }
+      dev++;
+    }
+    bus++;
+  }
+  put_str ("pci_init done\n");
+}
@@ -0,0 +1,56 @@
+#ifndef __DEVICE_PCI_H
+#define __DEVICE_PCI_H
+#include "global.h"
+#include "stdint.h"
+
+#define PCI_MAX_DEVS 32        // 记录的pci设备数上限
+#define PCI_MAX_IRQ_ACTIONS 8  // 挂在pci中断引脚上的处理程序数上限
+
+/* 配置空间中的一些寄存器偏移 */
+#define PCI_VENDOR_ID 0x00
+#define PCI_COMMAND 0x04
+#define PCI_CLASS_REV 0x08
+#define PCI_HEADER_TYPE 0x0e
+#define PCI_BAR0 0x10
+#define PCI_INTERRUPT_LINE 0x3c
+
+/* command寄存器的一些关键位 */
+#define PCI_CMD_IO 0x1      // 响应i/o空间访问
+#define PCI_CMD_MEMORY 0x2  // 响应内存空间访问
+#define PCI_CMD_MASTER 0x4  // 允许设备做总线主控,即dma
+
+#define PCI_BAR_IO 0x1 // bar的第0位为1表示i/o端口,否则为内存地址
+
+/* 设备类别 */
+#define PCI_CLASS_STORAGE 0x01
+#define PCI_SUBCLASS_IDE 0x01
+#define PCI_SUBCLASS_SATA 0x06
+#define PCI_PROG_IF_AHCI 0x01 // sata控制器工作在ahci模式
+
+/* 枚举时记下的pci设备 */
+struct pci_dev {
+  uint8_t  bus;
+  uint8_t  dev;
+  uint8_t  func;
+  uint16_t vendor_id;
+  uint16_t device_id;
+  uint8_t  class_code;
+  uint8_t  subclass;
+  uint8_t  prog_if;
+  uint8_t  irq_line; // bios分配的中断引脚,对应8259A上的irq号
+  uint32_t bar[6];
+};
+
+/* pci设备的中断处理程序,irq_no为中断向量号 */
+typedef void pci_irq_handler (uint8_t irq_no);
+
+void     pci_init (void);
+uint32_t pci_read_config (struct pci_dev* pdev, uint8_t offset);
+void     pci_write_config (struct pci_dev* pdev, uint8_t offset, uint32_t value);
+struct pci_dev* pci_find_class (uint8_t class_code, uint8_t subclass,
+                                struct pci_dev* from);
+struct pci_dev* pci_find_device (uint16_t vendor_id, uint16_t device_id,
+                                 struct pci_dev* from);
+void            pci_enable_master (struct pci_dev* pdev);
+bool            pci_request_irq (struct pci_dev* pdev, pci_irq_handler* handler);
+#endif
@@ -0,0 +1,61 @@
+#include "ramdisk.h"
+#include "global.h"
+#include "memory.h"
+#include "partition.h"
+#include "stdio-kernel.h"
+#include "string.h"
+
+#define RAMDISK_REQ_SECS 128 // 一个bio最多的扇区数,只影响bdev_rw的拆分
+
+static struct ramdisk ram;
+
+/* 块设备的submit操作,同步拷贝后即完成bio */
+static void
+ramdisk_submit (struct block_device* bdev, struct bio* bio) {
+  struct ramdisk* rd  = bdev->private_data;
+  uint8_t*        addr= rd->data + bio->lba * bdev->sector_size;
+  uint32_t        size= bio->sec_cnt * bdev->sector_size;
+  if (bio->write) {
+    memcpy (addr, bio->buf, size);
+  }
+  else {
+    memcpy (bio->buf, addr, size);
+  }
+  bio_endio (bio, true);
+}
+
+/* 没有写缓存,不需要flush */
+static const struct block_device_ops ramdisk_ops= {ramdisk_submit, NULL};
+
+/**
+ * 启动时按物理内存大小建内存盘: 取总内存的1/8,不超过RAMDISK_MAX_MB,
+ * 申请不到时减半重试. 整个盘作为一个分区ram1,由filesys_init格式化.
+ */
+void
+ramdisk_init (void) {
+  uint32_t total_mb= (*(uint32_t*) (0xb00)) / (1024 * 1024);
+  uint32_t mb      = total_mb / 8;
+  if (mb > RAMDISK_MAX_MB) {
+    mb= RAMDISK_MAX_MB;
+  }
+  while (mb >= RAMDISK_MIN_MB) {
+    ram.data= get_kernel_pages (mb * 1024 * 1024 / PG_SIZE);
+    if (ram.data != NULL) {
+      break;
+    }
+    mb/= 2;
+  }
+  if (ram.data == NULL) {
+    printk ("   ramdisk: not enough memory\n");
+    return;
+  }
+
+  uint32_t sectors= mb * 1024 * 1024 / 512;
+  strcpy (ram.bdev.name, "ram");
+  bdev_register (&ram.bdev, &ramdisk_ops, sectors, RAMDISK_REQ_SECS, NULL,
+                 &ram);
+  printk ("   disk %s info:\n      RAMDISK SECTORS: %d, CAPACITY: %dMB\n",
+          ram.bdev.name, sectors, mb);
+  /* 内存盘上没有分区表,整个盘就是一个分区 */
+  partition_add (&ram.bdev, 0, sectors, 1);
+}
@@ -0,0 +1,20 @@
+#ifndef __DEVICE_RAMDISK_H
+#define __DEVICE_RAMDISK_H
+#include "blk.h"
+#include "stdint.h"
+
+#define RAMDISK_MAX_MB 16 // 内存盘大小的上限
+#define RAMDISK_MIN_MB 1  // 内存不够这么大时不建内存盘
+
+/**
+ * 用内核内存模拟的块设备,读写就是memcpy,不经请求队列,
+ * 用来在没有硬盘延迟的情况下测文件系统本身的开销,也可存放临时文件.
+ * 内容在关机后丢失.
+ */
+struct ramdisk {
+  struct block_device bdev;
+  uint8_t*            data; // 整个盘在内核中的虚拟地址
+};
+
+void ramdisk_init (void);
+#endif
@@ -4,20 +4,43 @@
 #include "io.h"
 #include "print.h"
 #include "thread.h"
+#include "vdso.h"
 
-#define IRQ0_FREQUENCY 100
-#define INPUT_FREQUENCY 1193180
-#define COUNTER0_VALUE INPUT_FREQUENCY / IRQ0_FREQUENCY
 #define CONTRER0_PORT 0x40
 #define COUNTER0_NO 0
-#define COUNTER_MODE 2
+#define COUNTER_MODE 2         // 方式2,比率发生器,用于周期模式
+#define COUNTER_MODE_ONESHOT 0 // 方式0,计数结束中断,用于单次触发模式
 #define READ_WRITE_LATCH 3
+#define COUNTER_LATCH 0 // 锁存命令,用于读出当前计数值
 #define PIT_CONTROL_PORT 0x43
 
-#define mil_seconds_per_intr (1000 / IRQ0_FREQUENCY)
+/* 单次触发的计数上限,为计数到0后的回绕留出余量,以便区分是否已经到期 */
+#define PIT_MAX_DELTA 0xf000
+#define PIT_MIN_DELTA 100
+
+/* ticks的计数周期固定为10ms,与实际的中断频率无关 */
+#define JIFFY_CLOCK (INPUT_FREQUENCY / TICK_HZ_DEFAULT)
+
+/* 微秒转换为计数值时所用的乘数,结果需右移30位 */
+#define US2CLOCK_MULT ((uint32_t) (((uint64_t) INPUT_FREQUENCY << 30) / 1000000))
+
+/* 时钟事件设备当前所处的模式 */
+enum clock_mode { CLOCK_MODE_PERIODIC, CLOCK_MODE_ONESHOT };
 
 uint32_t ticks; // ticks是内核自中断开启以来总共的嘀嗒数
 
+static struct clock_event_device* clock_evt;  // 当前使用的时钟事件设备
+static enum clock_mode            clock_mode; // 周期模式或单次触发模式
+static uint32_t                   clock_period; // 周期模式下的中断周期(计数)
+static uint64_t clock_base; // 本次编程时刻距开机时的计数,中断时向前推进
+static uint64_t jiffy_clock; // 上一次ticks加1时的时刻
+static uint32_t tick_hz, tick_hz_busy, tick_hz_cur; // 空闲/繁忙/当前的中断频率
+static bool     need_resched; // 定时器唤醒了任务,需要尽快调度
+static struct list timer_list; // 按到期时刻升序排列的内核定时器
+
+static uint32_t pit_programmed; // 最近一次写入计数器0的初值
+static bool     pit_oneshot;    // 计数器0是否工作在方式0
+
 /* 把操作的计数器counter_no、读写锁属性rwl、计数器模式counter_mode写入模式控制寄存器并赋予初始值counter_value
  */
 static void
@@ -29,7 +52,146 @@ frequency_set (uint8_t counter_port, uint8_t counter_no, uint8_t rwl,
   /* 先写入counter_value的低8位 */
   outb (counter_port, (uint8_t) counter_value);
   /* 再写入counter_value的高8位 */
-  outb (counter_port, (uint8_t) counter_value >> 8);
+  outb (counter_port, (uint8_t) (counter_value >> 8));
+}
+
+/* 8253以方式2周期性地产生中断 */
+static void
+pit_set_periodic (uint32_t period) {
+  pit_programmed= period;
+  pit_oneshot   = false;
+  frequency_set (CONTRER0_PORT, COUNTER0_NO, READ_WRITE_LATCH, COUNTER_MODE,
+                 period);
+}
+
+/* 8253以方式0在delta个计数后产生一次中断 */
+static void
+pit_set_next_event (uint32_t delta) {
+  pit_programmed= delta;
+  pit_oneshot   = true;
+  frequency_set (CONTRER0_PORT, COUNTER0_NO, READ_WRITE_LATCH,
+                 COUNTER_MODE_ONESHOT, delta);
+}
+
+/* 锁存并读出计数器0,返回本次编程以来经过的计数 */
+static uint32_t
+pit_read_elapsed (void) {
+  outb (PIT_CONTROL_PORT, (uint8_t) (COUNTER0_NO << 6 | COUNTER_LATCH << 4));
+  uint32_t count= inb (CONTRER0_PORT);
+  count|= (uint32_t) inb (CONTRER0_PORT) << 8;
+
+  /* 方式0计数到0后会回绕到0xffff继续减,此时已经到期 */
+  if (count > pit_programmed) {
+    return pit_programmed;
+  }
+  return pit_programmed - count;
+}
+
+static struct clock_event_device pit_clock_event= {
+    .name          = "pit",
+    .features      = CLOCK_EVT_FEAT_PERIODIC | CLOCK_EVT_FEAT_ONESHOT,
+    .freq          = INPUT_FREQUENCY,
+    .min_delta     = PIT_MIN_DELTA,
+    .max_delta     = PIT_MAX_DELTA,
+    .set_periodic  = pit_set_periodic,
+    .set_next_event= pit_set_next_event,
+    .read_elapsed  = pit_read_elapsed};
+
+/* 以新的周期重新编程周期模式,当前周期中已经过去的部分计入clock_base */
+static void
+clock_set_period (uint32_t period) {
+  clock_base+= clock_evt->read_elapsed ();
+  clock_period= period;
+  clock_evt->set_periodic (period);
+}
+
+/* 从单次触发模式回到周期模式,elapsed为单次触发期间经过的计数 */
+static void
+clock_leave_oneshot (uint32_t elapsed) {
+  clock_base+= elapsed;
+  clock_mode= CLOCK_MODE_PERIODIC;
+  clock_evt->set_periodic (clock_period);
+}
+
+/* 返回开机以来经过的计数,单位是时钟事件设备的输入时钟 */
+uint64_t
+timer_clock_now (void) {
+  enum intr_status old_status= intr_disable ();
+  uint64_t         now       = clock_base + clock_evt->read_elapsed ();
+  intr_set_status (old_status);
+  return now;
+}
+
+/* 将微秒数转换为计数值 */
+uint64_t
+timer_us2clock (uint32_t u_seconds) {
+  return ((uint64_t) u_seconds * US2CLOCK_MULT) >> 30;
+}
+
+/* 将定时器timer按到期时刻expires插入定时器队列 */
+void
+ktimer_add (struct ktimer* timer, uint64_t expires) {
+  enum intr_status old_status= intr_disable ();
+  timer->expires             = expires;
+
+  struct list_elem* elem= timer_list.head.next;
+  while (elem != &timer_list.tail) {
+    struct ktimer* next= elem2entry (struct ktimer, timer_tag, elem);
+    if (next->expires > expires) {
+      break;
+    }
+    elem= elem->next;
+  }
+  list_insert_before (elem, &timer->timer_tag);
+  intr_set_status (old_status);
+}
+
+/* 取消尚未到期的定时器,若定时器已到期或未添加则返回false */
+bool
+ktimer_del (struct ktimer* timer) {
+  enum intr_status old_status= intr_disable ();
+  bool             pending   = timer->timer_tag.next != NULL;
+  if (pending) {
+    list_remove (&timer->timer_tag);
+    timer->timer_tag.prev= timer->timer_tag.next= NULL;
+  }
+  intr_set_status (old_status);
+  return pending;
+}
+
+/* 在中断上下文中执行所有已到期的定时器 */
+static void
+ktimer_run (void) {
+  while (!list_empty (&timer_list)) {
+    struct ktimer* timer=
+        elem2entry (struct ktimer, timer_tag, timer_list.head.next);
+    if (timer->expires > clock_base) {
+      break;
+    }
+    list_remove (&timer->timer_tag);
+    timer->timer_tag.prev= timer->timer_tag.next= NULL;
+    timer->func (timer->arg);
+  }
+}
+
+/* 按经过的时间推进ticks,并相应扣减当前任务的时间片 */
+static void
+jiffies_update (struct task_struct* cur_thread) {
+  while (clock_base - jiffy_clock >= JIFFY_CLOCK) {
+    jiffy_clock+= JIFFY_CLOCK;
+    cur_thread->elapsed_ticks++; // 记录此线程占用的cpu时间嘀
+    ticks++; // 从内核第一次处理时间中断后开始至今的滴哒数,内核态和用户态总共的嘀哒数
+    if (cur_thread->ticks > 0) {
+      cur_thread->ticks--;
+    }
+
+    /* 有任务在就绪队列中等待时使用繁忙频率,以获得更细的定时精度 */
+    uint32_t hz= list_empty (&thread_ready_list) ? tick_hz : tick_hz_busy;
+    if (hz != tick_hz_cur) {
+      tick_hz_cur= hz;
+      clock_set_period (INPUT_FREQUENCY / hz);
+    }
+  }
 }
 
 /* 时钟的中断处理函数 */
@@ -39,43 +201,132 @@ intr_timer_handler (void) {
 
   ASSERT (cur_thread->stack_magic == 0x19870916); // 检查栈是否溢出
 
-  cur_thread->elapsed_ticks++; // 记录此线程占用的cpu时间嘀
-  ticks++; // 从内核第一次处理时间中断后开始至今的滴哒数,内核态和用户态总共的嘀哒数
+  if (clock_mode == CLOCK_MODE_ONESHOT) { // idle期间编程的单次中断到期
+    clock_leave_oneshot (pit_programmed);
+  }
+  else {
+    clock_base+= clock_period;
+  }
+
+  ktimer_run ();
+  jiffies_update (cur_thread);
+  vdso_update (cur_thread);
 
-  if (cur_thread->ticks == 0) { // 若进程时间片用完就开始调度新的进程上cpu
+  /* 若进程时间片用完或有任务被定时器唤醒就开始调度新的进程上cpu */
+  if (cur_thread->ticks == 0 || need_resched) {
+    need_resched= false;
     schedule ();
   }
-  else { // 将当前进程的时间片-1
-    cur_thread->ticks--;
-  }
 }
 
-/* 以tick为单位的sleep,任何时间形式的sleep会转换此ticks形式 */
+/* 定时器回调唤醒了任务,请求在本次时钟中断返回前重新调度 */
+void
+timer_resched (void) {
+  need_resched= true;
+}
+
+/* 睡眠定时器到期,唤醒睡眠的任务 */
 static void
-ticks_to_sleep (uint32_t sleep_ticks) {
-  uint32_t start_tick= ticks;
+sleep_timeout (void* arg) {
+  thread_unblock ((struct task_struct*) arg);
+  timer_resched ();
+}
 
-  /* 若间隔的ticks数不够便让出cpu */
-  while (ticks - start_tick < sleep_ticks) {
-    thread_yield ();
-  }
+/* 阻塞当前任务delta个计数,任何时间形式的sleep会转换成此形式 */
+static void
+clock_sleep (uint64_t delta) {
+  struct ktimer timer;
+  timer.func= sleep_timeout;
+  timer.arg = running_thread ();
+
+  enum intr_status old_status= intr_disable ();
+  ktimer_add (&timer, timer_clock_now () + delta);
+  thread_block_reason (TASK_BLOCKED, BLOCK_SLEEP);
+  intr_set_status (old_status);
 }
 
 /* 以毫秒为单位的sleep   1秒= 1000毫秒 */
 void
 mtime_sleep (uint32_t m_seconds) {
-  uint32_t sleep_ticks= DIV_ROUND_UP (m_seconds, mil_seconds_per_intr);
-  ASSERT (sleep_ticks > 0);
-  ticks_to_sleep (sleep_ticks);
+  ASSERT (m_seconds > 0);
+  clock_sleep (timer_us2clock (1000) * m_seconds);
+}
+
+/* 以微秒为单位的sleep,精度取决于当前的中断频率,idle时可精确到单次触发 */
+void
+utime_sleep (uint32_t u_seconds) {
+  ASSERT (u_seconds > 0);
+  clock_sleep (timer_us2clock (u_seconds));
+}
+
+/* 设置空闲时和繁忙(就绪队列非空)时的时钟中断频率 */
+void
+timer_set_frequency (uint32_t hz, uint32_t busy_hz) {
+  hz     = hz < TICK_HZ_MIN ? TICK_HZ_MIN : (hz > TICK_HZ_MAX ? TICK_HZ_MAX : hz);
+  busy_hz= busy_hz < hz ? hz : (busy_hz > TICK_HZ_MAX ? TICK_HZ_MAX : busy_hz);
+
+  enum intr_status old_status= intr_disable ();
+  tick_hz                    = hz;
+  tick_hz_busy               = busy_hz;
+  tick_hz_cur                = hz;
+  if (clock_mode == CLOCK_MODE_PERIODIC) {
+    clock_set_period (INPUT_FREQUENCY / hz);
+  }
+  else { // 单次触发结束后再以新周期恢复周期模式
+    clock_period= INPUT_FREQUENCY / hz;
+  }
+  intr_set_status (old_status);
+}
+
+/* idle即将停机:若没有马上到期的定时器,停掉周期时钟,
+ * 按最近的定时器到期时刻编程一次单次中断 */
+void
+timer_idle_enter (void) {
+  ASSERT (intr_get_status () == INTR_OFF);
+  if (!(clock_evt->features & CLOCK_EVT_FEAT_ONESHOT) ||
+      clock_mode == CLOCK_MODE_ONESHOT) {
+    return;
+  }
+
+  uint64_t now  = clock_base + clock_evt->read_elapsed ();
+  uint64_t delta= clock_evt->max_delta;
+  if (!list_empty (&timer_list)) {
+    struct ktimer* first=
+        elem2entry (struct ktimer, timer_tag, timer_list.head.next);
+    if (first->expires <= now + clock_evt->min_delta) {
+      return; // 即将到期,保持周期模式即可
+    }
+    if (first->expires - now < delta) {
+      delta= first->expires - now;
+    }
+  }
+
+  clock_base= now;
+  clock_mode= CLOCK_MODE_ONESHOT;
+  clock_evt->set_next_event ((uint32_t) delta);
+}
+
+/* idle被时钟以外的中断唤醒,恢复周期时钟 */
+void
+timer_idle_exit (void) {
+  ASSERT (intr_get_status () == INTR_OFF);
+  if (clock_mode == CLOCK_MODE_ONESHOT) {
+    clock_leave_oneshot (clock_evt->read_elapsed ());
+  }
 }
 
 /* 初始化PIT8253 */
 void
 timer_init () {
   put_str ("timer_init start\n");
+  list_init (&timer_list);
+  clock_evt   = &pit_clock_event;
+  clock_mode  = CLOCK_MODE_PERIODIC;
+  clock_period= INPUT_FREQUENCY / TICK_HZ_DEFAULT;
+  tick_hz= tick_hz_busy= tick_hz_cur= TICK_HZ_DEFAULT;
+
   /* 设置8253的定时周期,也就是发中断的周期 */
-  frequency_set (CONTRER0_PORT, COUNTER0_NO, READ_WRITE_LATCH, COUNTER_MODE,
-                 COUNTER0_VALUE);
+  clock_evt->set_periodic (clock_period);
   register_handler (0x20, intr_timer_handler);
   put_str ("timer_init done\n");
 }
@@ -1,7 +1,50 @@
 
 #ifndef __DEVICE_TIME_H
 #define __DEVICE_TIME_H
+#include "global.h"
+#include "list.h"
 #include "stdint.h"
-void timer_init (void);
-void mtime_sleep (uint32_t m_seconds);
+
+#define INPUT_FREQUENCY 1193180 // 8253计数器的输入时钟频率
+#define TICK_HZ_DEFAULT 100     // 默认的时钟中断频率,也是ticks的计数频率
+#define TICK_HZ_MIN 19          // 8253计数器为16位,周期模式下频率不能再低
+#define TICK_HZ_MAX 1000        // 可配置的最高时钟中断频率
+
+/* 时钟事件设备的特性 */
+#define CLOCK_EVT_FEAT_PERIODIC 0x1 // 支持周期模式
+#define CLOCK_EVT_FEAT_ONESHOT 0x2  // 支持单次触发模式
+
+/* 时钟事件设备,负责在指定的计数之后产生时钟中断 */
+struct clock_event_device {
+  const char* name;
+  uint32_t    features;
+  uint32_t    freq;      // 计数器的输入频率(Hz)
+  uint32_t    min_delta; // 单次触发模式可编程的最小计数值
+  uint32_t    max_delta; // 单次触发模式可编程的最大计数值
+  void (*set_periodic) (uint32_t period);  // 每period个计数产生一次中断
+  void (*set_next_event) (uint32_t delta); // delta个计数后产生一次中断
+  uint32_t (*read_elapsed) (void);         // 本次编程以来已经过去的计数值
+};
+
+/* 内核定时器,到期后在时钟中断上下文中调用func(arg) */
+struct ktimer {
+  struct list_elem timer_tag;
+  uint64_t         expires; // 到期时刻,单位是时钟事件设备的计数
+  void (*func) (void* arg);
+  void* arg;
+};
+
+extern uint32_t ticks;
+
+void     timer_init (void);
+void     mtime_sleep (uint32_t m_seconds);
+void     utime_sleep (uint32_t u_seconds);
+void     timer_set_frequency (uint32_t hz, uint32_t busy_hz);
+uint64_t timer_clock_now (void);
+uint64_t timer_us2clock (uint32_t u_seconds);
+void     ktimer_add (struct ktimer* timer, uint64_t expires);
+bool     ktimer_del (struct ktimer* timer);
+void     timer_idle_enter (void);
+void     timer_idle_exit (void);
+void     timer_resched (void);
 #endif
@@ -0,0 +1,396 @@
+#include "virtio_blk.h"
+#include "blk.h"
+#include "debug.h"
+#include "interrupt.h"
+#include "io.h"
+#include "memory.h"
+#include "partition.h"
+#include "pci.h"
+#include "stdio-kernel.h"
+#include "stdio.h"
+#include "string.h"
+#include "sync.h"
+#include "thread.h"
+
+#define VIRTIO_VENDOR_ID 0x1af4
+#define VIRTIO_BLK_DEVICE_ID 0x1001 // 传统接口的virtio-blk
+
+/* 传统接口bar0中各寄存器的偏移 */
+#define VIRTIO_REG_DEVICE_FEATURES 0x00
+#define VIRTIO_REG_GUEST_FEATURES 0x04
+#define VIRTIO_REG_QUEUE_PFN 0x08 // 队列的物理页号
+#define VIRTIO_REG_QUEUE_SIZE 0x0c
+#define VIRTIO_REG_QUEUE_SELECT 0x0e
+#define VIRTIO_REG_QUEUE_NOTIFY 0x10
+#define VIRTIO_REG_STATUS 0x12
+#define VIRTIO_REG_ISR 0x13    // 读出后清0,第0位表示队列有完成
+#define VIRTIO_REG_CONFIG 0x14 // 设备的配置,未启用msi-x时从此开始
+
+/* virtio-blk配置中的偏移 */
+#define VIRTIO_BLK_CFG_CAPACITY 0x00 // 64位的扇区数
+#define VIRTIO_BLK_CFG_SEG_MAX 0x0c  // 一个请求最多的数据段数
+
+/* status寄存器的位 */
+#define VIRTIO_STATUS_ACK 0x1       // 认出了设备
+#define VIRTIO_STATUS_DRIVER 0x2    // 有驱动
+#define VIRTIO_STATUS_DRIVER_OK 0x4 // 驱动已就绪
+#define VIRTIO_STATUS_FAILED 0x80
+
+#define VIRTIO_BLK_F_SEG_MAX (1 << 2) // 配置中的seg_max有效
+#define VIRTIO_BLK_F_FLUSH (1 << 9)   // 支持flush命令
+
+#define VRING_DESC_F_NEXT 0x1  // 链中还有下一项
+#define VRING_DESC_F_WRITE 0x2 // 由设备写入的缓冲区
+
+#define VIRTIO_BLK_T_IN 0  // 读
+#define VIRTIO_BLK_T_OUT 1 // 写
+#define VIRTIO_BLK_T_FLUSH 4
+#define VIRTIO_BLK_S_OK 0
+
+#define VIRTIO_BLK_REQ_SECS 128 // 一个请求最多的扇区数
+#define VIRTIO_BLK_DEPTH 16     // 同时交给设备的请求数
+
+/* 阻止编译器把对共享环的读写挪过此处,x86上写与写,读与读不会乱序 */
+#define barrier() asm volatile ("" : : : "memory")
+
+static struct virtio_blk vblks[VIRTIO_BLK_MAX_DEVS];
+static uint32_t          vblk_cnt;
+
+/**
+ * 队列大小为qsize时已用环在vring中的偏移. vring依次为描述符表,
+ * 可用环和已用环,已用环从页边界开始.
+ */
+static uint32_t
+vring_used_off (uint16_t qsize) {
+  uint32_t avail_end= qsize * sizeof (struct vring_desc)
+                      + sizeof (uint16_t) * (3 + qsize);
+  return DIV_ROUND_UP (avail_end, PG_SIZE) * PG_SIZE;
+}
+
+/* 队列大小为qsize时vring的字节数 */
+static uint32_t
+vring_size (uint16_t qsize) {
+  return vring_used_off (qsize) + sizeof (uint16_t) * 3
+         + qsize * sizeof (struct vring_used_elem);
+}
+
+/**
+ * 申请pg_cnt个物理地址连续的内核页. 设备按物理地址访问整个vring,
+ * 内核池的物理页按位图顺序分配,启动时一般是连续的,不连续时返回NULL.
+ */
+static void*
+vring_alloc (uint32_t pg_cnt) {
+  void* vaddr= get_kernel_pages (pg_cnt);
+  if (vaddr == NULL) {
+    return NULL;
+  }
+  uint32_t phy= addr_v2p ((uint32_t) vaddr);
+  uint32_t idx= 1;
+  while (idx < pg_cnt) {
+    if (addr_v2p ((uint32_t) vaddr + idx * PG_SIZE) != phy + idx * PG_SIZE) {
+      mfree_kernel_pages (vaddr, pg_cnt);
+      return NULL;
+    }
+    idx++;
+  }
+  return vaddr;
+}
+
+/* 请求中各bio的缓冲区按物理页拆开后的段数 */
+static uint32_t
+req_segs (struct blk_request* req) {
+  uint32_t          cnt = 0;
+  struct list_elem* elem= req->bios.head.next;
+  while (elem != &req->bios.tail) {
+    struct bio* bio  = elem2entry (struct bio, tag, elem);
+    uint32_t    start= (uint32_t) bio->buf;
+    uint32_t    end  = start + bio->sec_cnt * 512 - 1;
+    cnt+= end / PG_SIZE - start / PG_SIZE + 1;
+    elem= elem->next;
+  }
+  return cnt;
+}
+
+/**
+ * 取一个空闲描述符,填入物理地址phy处len字节的缓冲区,
+ * prev不为qsize时接在描述符prev之后. 返回其下标,调用时须关中断.
+ */
+static uint16_t
+desc_add (struct virtio_blk* vblk, uint16_t prev, uint32_t phy, uint32_t len,
+          uint16_t flags) {
+  ASSERT (vblk->free_cnt > 0);
+  uint16_t idx   = vblk->free_head;
+  vblk->free_head= vblk->desc[idx].next;
+  vblk->free_cnt--;
+
+  vblk->desc[idx].addr = phy;
+  vblk->desc[idx].len  = len;
+  vblk->desc[idx].flags= flags;
+  if (prev != vblk->qsize) {
+    vblk->desc[prev].flags|= VRING_DESC_F_NEXT;
+    vblk->desc[prev].next = idx;
+  }
+  return idx;
+}
+
+/* 把以head开头的描述符链放回空闲链,调用时须关中断 */
+static void
+desc_free (struct virtio_blk* vblk, uint16_t head) {
+  uint16_t idx= head;
+  while (1) {
+    vblk->free_cnt++;
+    if (!(vblk->desc[idx].flags & VRING_DESC_F_NEXT)) {
+      break;
+    }
+    idx= vblk->desc[idx].next;
+  }
+  vblk->desc[idx].next= vblk->free_head;
+  vblk->free_head     = head;
+}
+
+/* 把以head开头的描述符链放入可用环,先写表项再增加idx,最后通知设备 */
+static void
+vring_kick (struct virtio_blk* vblk, uint16_t head) {
+  vblk->avail->ring[vblk->avail->idx % vblk->qsize]= head;
+  barrier ();
+  vblk->avail->idx++;
+  barrier ();
+  outw (vblk->io_base + VIRTIO_REG_QUEUE_NOTIFY, 0);
+}
+
+/**
+ * 块层派发来的请求. 组成请求头,数据段和状态字节的描述符链,
+ * 放入可用环并通知设备后即返回,完成在中断处理程序中报告.
+ */
+static void
+virtio_blk_request (struct blk_queue* q, struct blk_request* req) {
+  struct virtio_blk* vblk  = q->queuedata;
+  uint32_t           needed= req_segs (req) + 2;
+  ASSERT (needed <= vblk->qsize);
+
+  enum intr_status old_status= intr_disable ();
+  while (vblk->free_cnt < needed) {
+    wait_queue_wait (&vblk->desc_wait, true, 0);
+  }
+
+  /* 1 请求头,设备只读 */
+  uint16_t                   head= vblk->free_head;
+  struct virtio_blk_req_hdr* hdr = &vblk->hdrs[head];
+
+  hdr->type    = req->write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+  hdr->reserved= 0;
+  hdr->sector  = req->lba;
+  uint16_t last= desc_add (vblk, vblk->qsize, addr_v2p ((uint32_t) hdr),
+                           sizeof (*hdr), 0);
+
+  /**
+   * 2 数据段,每段不跨页,读请求的数据段由设备写入.
+   * buf可能在提交者的用户空间,派发线程已换到其页目录,addr_v2p才查得对.
+   * 请求完成前提交者在等bio,这些物理页不会被释放
+   */
+  ASSERT (running_thread ()->borrowed_pgdir == req->pgdir);
+  uint16_t          flags= req->write ? 0 : VRING_DESC_F_WRITE;
+  struct list_elem* elem = req->bios.head.next;
+  while (elem != &req->bios.tail) {
+    struct bio* bio  = elem2entry (struct bio, tag, elem);
+    uint32_t    vaddr= (uint32_t) bio->buf;
+    uint32_t    size = bio->sec_cnt * 512;
+    while (size > 0) {
+      uint32_t len= PG_SIZE - (vaddr & (PG_SIZE - 1));
+      if (len > size) {
+        len= size;
+      }
+      last= desc_add (vblk, last, addr_v2p (vaddr), len, flags);
+      vaddr+= len;
+      size-= len;
+    }
+    elem= elem->next;
+  }
+
+  /* 3 状态字节,由设备写入 */
+  vblk->status[head]= 0xff;
+  desc_add (vblk, last, addr_v2p ((uint32_t) &vblk->status[head]), 1,
+            VRING_DESC_F_WRITE);
+  vblk->reqs[head]= req;
+
+  /* 4 链头放入可用环并通知设备 */
+  vring_kick (vblk, head);
+  intr_set_status (old_status);
+}
+
+/* 块设备的flush操作,发出只有请求头和状态字节的flush命令并等它完成 */
+static bool
+virtio_blk_flush (struct block_device* bdev) {
+  struct virtio_blk* vblk= bdev->private_data;
+  lock_acquire (&vblk->flush_lock);
+  enum intr_status old_status= intr_disable ();
+  while (vblk->free_cnt < 2) {
+    wait_queue_wait (&vblk->desc_wait, true, 0);
+  }
+  uint16_t                   head= vblk->free_head;
+  struct virtio_blk_req_hdr* hdr = &vblk->hdrs[head];
+
+  hdr->type    = VIRTIO_BLK_T_FLUSH;
+  hdr->reserved= 0;
+  hdr->sector  = 0;
+  uint16_t last= desc_add (vblk, vblk->qsize, addr_v2p ((uint32_t) hdr),
+                           sizeof (*hdr), 0);
+  vblk->status[head]= 0xff;
+  desc_add (vblk, last, addr_v2p ((uint32_t) &vblk->status[head]), 1,
+            VRING_DESC_F_WRITE);
+  vblk->reqs[head]= NULL;
+  vring_kick (vblk, head);
+  intr_set_status (old_status);
+
+  semaphore_down (&vblk->flush_done);
+  bool ok= vblk->flush_ok;
+  lock_release (&vblk->flush_lock);
+  return ok;
+}
+
+/* 设备有写缓存时才有flush操作 */
+static const struct block_device_ops virtio_blk_ops= {blk_queue_submit, NULL};
+static const struct block_device_ops virtio_blk_flush_ops= {blk_queue_submit,
+                                                            virtio_blk_flush};
+
+/* virtio-blk的中断处理程序,结束已用环中新完成的请求 */
+static void
+intr_virtio_blk_handler (uint8_t irq_no) {
+  uint32_t dev_idx= 0;
+  while (dev_idx < vblk_cnt) {
+    struct virtio_blk* vblk= &vblks[dev_idx++];
+    /* 同一引脚可能由几个设备共用,isr为0的不是这个设备发的 */
+    if (vblk->irq_no != irq_no
+        || !(inb (vblk->io_base + VIRTIO_REG_ISR) & 0x1)) {
+      continue;
+    }
+    while (vblk->last_used != *(volatile uint16_t*) &vblk->used->idx) {
+      barrier ();
+      struct vring_used_elem* ue=
+          &vblk->used->ring[vblk->last_used % vblk->qsize];
+      uint16_t            head= ue->id;
+      struct blk_request* req = vblk->reqs[head];
+      bool                ok  = vblk->status[head] == VIRTIO_BLK_S_OK;
+      vblk->reqs[head]        = NULL;
+      desc_free (vblk, head);
+      vblk->last_used++;
+      if (req != NULL) {
+        blk_request_end (req, ok);
+      }
+      else {
+        vblk->flush_ok= ok;
+        semaphore_up (&vblk->flush_done);
+      }
+    }
+    wait_queue_wake (&vblk->desc_wait, 1);
+  }
+}
+
+/* 设置pci设备pdev并把它作为一块硬盘接入,失败时置failed位 */
+static void
+virtio_blk_probe (struct pci_dev* pdev) {
+  if (vblk_cnt == VIRTIO_BLK_MAX_DEVS || !(pdev->bar[0] & PCI_BAR_IO)
+      || pdev->irq_line == 0 || pdev->irq_line >= 16) {
+    return;
+  }
+  struct virtio_blk* vblk= &vblks[vblk_cnt];
+  uint16_t           base= pdev->bar[0] & 0xfffc;
+  vblk->io_base          = base;
+  sprintf (vblk->bdev.name, "vd%c", 'a' + vblk_cnt);
+  pci_enable_master (pdev);
+
+  /* 1 复位后依次置ack和driver位 */
+  outb (base + VIRTIO_REG_STATUS, 0);
+  outb (base + VIRTIO_REG_STATUS, VIRTIO_STATUS_ACK);
+  outb (base + VIRTIO_REG_STATUS, VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER);
+
+  /* 2 只协商seg_max和flush,其余特性都不用 */
+  uint32_t features= inl (base + VIRTIO_REG_DEVICE_FEATURES)
+                     & (VIRTIO_BLK_F_SEG_MAX | VIRTIO_BLK_F_FLUSH);
+  outl (base + VIRTIO_REG_GUEST_FEATURES, features);
+
+  /* 3 为0号队列分配vring和以链头为索引的数组 */
+  outw (base + VIRTIO_REG_QUEUE_SELECT, 0);
+  vblk->qsize     = inw (base + VIRTIO_REG_QUEUE_SIZE);
+  uint32_t pg_cnt = DIV_ROUND_UP (vring_size (vblk->qsize), PG_SIZE);
+  uint32_t hdr_pgs= DIV_ROUND_UP (vblk->qsize * sizeof (*vblk->hdrs), PG_SIZE);
+  void*    ring   = vblk->qsize < 4 ? NULL : vring_alloc (pg_cnt);
+  vblk->hdrs      = get_kernel_pages (hdr_pgs); // 请求头不能跨页,按页申请
+  vblk->status    = sys_malloc (vblk->qsize);
+  vblk->reqs      = sys_malloc (vblk->qsize * sizeof (*vblk->reqs));
+  if (ring == NULL || vblk->hdrs == NULL || vblk->status == NULL
+      || vblk->reqs == NULL) {
+    printk ("   %s: queue setup failed\n", vblk->bdev.name);
+    outb (base + VIRTIO_REG_STATUS, VIRTIO_STATUS_FAILED);
+    return;
+  }
+  vblk->desc = ring;
+  vblk->avail= (struct vring_avail*) ((uint32_t) ring
+                                      + vblk->qsize * sizeof (*vblk->desc));
+  vblk->used = (struct vring_used*) ((uint32_t) ring
+                                     + vring_used_off (vblk->qsize));
+  uint16_t idx= 0;
+  while (idx < vblk->qsize) {
+    vblk->desc[idx].next= idx + 1;
+    idx++;
+  }
+  vblk->free_head= 0;
+  vblk->free_cnt = vblk->qsize;
+  vblk->last_used= 0;
+  wait_queue_init (&vblk->desc_wait);
+  vblk->desc_wait.reason= BLOCK_IO;
+  lock_init (&vblk->flush_lock);
+  semaphore_init (&vblk->flush_done, 0);
+  vblk->flush_done.waiters.reason= BLOCK_IO;
+  outl (base + VIRTIO_REG_QUEUE_PFN, addr_v2p ((uint32_t) ring) / PG_SIZE);
+
+  /* 4 读出容量,按段数上限定出一个请求最多的扇区数.
+   * 每个bio的段数不超过其扇区数加1,所以请求的段数不超过扇区数的两倍 */
+  uint16_t cfg     = base + VIRTIO_REG_CONFIG;
+  uint32_t cap_low = inl (cfg + VIRTIO_BLK_CFG_CAPACITY);
+  uint32_t cap_high= inl (cfg + VIRTIO_BLK_CFG_CAPACITY + 4);
+  uint32_t seg_max = vblk->qsize - 2;
+  if (features & VIRTIO_BLK_F_SEG_MAX) {
+    uint32_t dev_max= inl (cfg + VIRTIO_BLK_CFG_SEG_MAX);
+    if (dev_max != 0 && dev_max < seg_max) {
+      seg_max= dev_max;
+    }
+  }
+  uint32_t sectors = cap_high != 0 ? 0xffffffff : cap_low;
+  uint32_t max_secs= seg_max / 2 < VIRTIO_BLK_REQ_SECS ? seg_max / 2
+                                                       : VIRTIO_BLK_REQ_SECS;
+
+  /* 5 注册中断并打开引脚,置driver_ok后设备开始处理队列.
+   * 引脚可能与其它pci设备共用,经pci_request_irq挂上 */
+  vblk->irq_no= 0x20 + pdev->irq_line;
+  if (!pci_request_irq (pdev, intr_virtio_blk_handler)) {
+    printk ("   %s: request irq failed\n", vblk->bdev.name);
+    outb (base + VIRTIO_REG_STATUS, VIRTIO_STATUS_FAILED);
+    return;
+  }
+  outb (base + VIRTIO_REG_STATUS, VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER
+                                      | VIRTIO_STATUS_DRIVER_OK);
+  vblk_cnt++;
+
+  printk ("   disk %s info:\n      VIRTIO-BLK io 0x%x irq %d queue %d\n",
+          vblk->bdev.name, base, pdev->irq_line, vblk->qsize);
+  printk ("      SECTORS: %d, CAPACITY: %dMB, FLUSH: %s\n", sectors,
+          sectors / 2048, features & VIRTIO_BLK_F_FLUSH ? "yes" : "no");
+  blk_queue_init (&vblk->queue, vblk->bdev.name, virtio_blk_request, vblk,
+                  max_secs, VIRTIO_BLK_DEPTH);
+  bdev_register (&vblk->bdev,
+                 features & VIRTIO_BLK_F_FLUSH ? &virtio_blk_flush_ops
+                                               : &virtio_blk_ops,
+                 sectors, max_secs, &vblk->queue, vblk);
+  partition_scan (&vblk->bdev);
+}
+
+/* 找出pci上所有virtio-blk设备并接入 */
+void
+virtio_blk_init (void) {
+  struct pci_dev* pdev= NULL;
+  while ((pdev= pci_find_device (VIRTIO_VENDOR_ID, VIRTIO_BLK_DEVICE_ID, pdev))
+         != NULL) {
+    virtio_blk_probe (pdev);
+  }
+}
@@ -0,0 +1,71 @@
+#ifndef __DEVICE_VIRTIO_BLK_H
+#define __DEVICE_VIRTIO_BLK_H
+#include "blk.h"
+#include "global.h"
+#include "stdint.h"
+#include "sync.h"
+
+#define VIRTIO_BLK_MAX_DEVS 4 // 支持的virtio-blk设备数上限
+
+/* 描述符表项,描述一段物理地址连续的缓冲区 */
+struct vring_desc {
+  uint64_t addr; // 缓冲区的物理地址
+  uint32_t len;
+  uint16_t flags; // VRING_DESC_F_*
+  uint16_t next;  // 有VRING_DESC_F_NEXT时链中下一项的下标
+};
+
+/* 驱动交给设备的可用环 */
+struct vring_avail {
+  uint16_t flags;
+  uint16_t idx;    // 下一个要填的位置,只增不减
+  uint16_t ring[]; // 描述符链头的下标
+};
+
+struct vring_used_elem {
+  uint32_t id;  // 描述符链头的下标
+  uint32_t len; // 设备写入的字节数
+};
+
+/* 设备处理完后交回的已用环 */
+struct vring_used {
+  uint16_t               flags;
+  uint16_t               idx; // 设备下一个要填的位置
+  struct vring_used_elem ring[];
+};
+
+/* 每个请求的第一段,告诉设备读写方向和起始扇区 */
+struct virtio_blk_req_hdr {
+  uint32_t type; // VIRTIO_BLK_T_IN或VIRTIO_BLK_T_OUT
+  uint32_t reserved;
+  uint64_t sector;
+};
+
+/**
+ * 一个传统(legacy)pci接口的virtio-blk设备,只用0号队列.
+ * 其中的bdev接入块设备层,请求经queue排序合并后交给设备.
+ */
+struct virtio_blk {
+  struct block_device bdev;
+  struct blk_queue    queue;
+  uint16_t            io_base; // bar0的i/o端口基址
+  uint8_t             irq_no;  // 中断向量号
+  uint16_t            qsize;   // 队列的描述符数,由设备决定
+  struct vring_desc*  desc;
+  struct vring_avail* avail;
+  struct vring_used*  used;
+  uint16_t            free_head;  // 空闲描述符链的头
+  uint16_t            free_cnt;   // 空闲描述符数
+  uint16_t            last_used;  // 已处理到的used->idx
+  struct wait_queue   desc_wait;  // 在此等待空闲描述符
+  struct lock         flush_lock; // 同时只有一个flush命令
+  struct semaphore    flush_done; // flush命令完成后由中断处理程序up
+  bool                flush_ok;
+  /* 以下三个数组都以请求所占描述符链头的下标为索引 */
+  struct virtio_blk_req_hdr* hdrs;
+  uint8_t*                   status; // 设备写回的完成状态
+  struct blk_request**       reqs;   // 交给设备未完成的请求,flush时为NULL
+};
+
+void virtio_blk_init (void);
+#endif
@@ -51,7 +51,7 @@ search_dir_entry (struct partition* part, struct dir* pdir, const char* name,
   block_idx= 0;
 
   if (pdir->inode->i_sectors[12] != 0) { // 若含有一级间接块表
-    ide_read (part->my_disk, pdir->inode->i_sectors[12], all_blocks + 12, 1);
+    bdev_read (part->bdev, pdir->inode->i_sectors[12], all_blocks + 12, 1);
   }
   /* 至此,all_blocks存储的是该文件或目录的所有扇区地址 */
 
@@ -71,7 +71,7 @@ search_dir_entry (struct partition* part, struct dir* pdir, const char* name,
       block_idx++;
       continue;
     }
-    ide_read (part->my_disk, all_blocks[block_idx], buf, 1);
+    bdev_read (part->bdev, all_blocks[block_idx], buf, 1);
 
     uint32_t dir_entry_idx= 0;
     /* 遍历扇区中所有目录项 */
@@ -194,33 +194,33 @@ sync_dir_entry (struct dir* parent_dir, struct dir_entry* p_de, void* io_buf) {
 
         all_blocks[12]= block_lba;
         /* 把新分配的第0个间接块地址写入一级间接块表 */
-        ide_write (cur_part->my_disk, dir_inode->i_sectors[12], all_blocks + 12,
-                   1);
+        bdev_write (cur_part->bdev, dir_inode->i_sectors[12], all_blocks + 12,
+                    1);
       }
       else { // 若是间接块未分配
         all_blocks[block_idx]= block_lba;
         /* 把新分配的第(block_idx-12)个间接块地址写入一级间接块表 */
-        ide_write (cur_part->my_disk, dir_inode->i_sectors[12], all_blocks + 12,
-                   1);
+        bdev_write (cur_part->bdev, dir_inode->i_sectors[12], all_blocks + 12,
+                    1);
       }
 
       /* 再将新目录项p_de写入新分配的间接块 */
       memset (io_buf, 0, 512);
       memcpy (io_buf, p_de, dir_entry_size);
-      ide_write (cur_part->my_disk, all_blocks[block_idx], io_buf, 1);
+      bdev_write (cur_part->bdev, all_blocks[block_idx], io_buf, 1);
       dir_inode->i_size+= dir_entry_size;
       return true;
     }
 
     /* 若第block_idx块已存在,将其读进内存,然后在该块中查找空目录项 */
-    ide_read (cur_part->my_disk, all_blocks[block_idx], io_buf, 1);
+    bdev_read (cur_part->bdev, all_blocks[block_idx], io_buf, 1);
     /* 在扇区内查找空目录项 */
     uint8_t dir_entry_idx= 0;
     while (dir_entry_idx < dir_entrys_per_sec) {
       if ((dir_e + dir_entry_idx)->f_type ==
           FT_UNKNOWN) { // FT_UNKNOWN为0,无论是初始化或是删除文件后,都会将f_type置为FT_UNKNOWN.
         memcpy (dir_e + dir_entry_idx, p_de, dir_entry_size);
-        ide_write (cur_part->my_disk, all_blocks[block_idx], io_buf, 1);
+        bdev_write (cur_part->bdev, all_blocks[block_idx], io_buf, 1);
 
         dir_inode->i_size+= dir_entry_size;
         return true;
@@ -245,7 +245,7 @@ delete_dir_entry (struct partition* part, struct dir* pdir, uint32_t inode_no,
     block_idx++;
   }
   if (dir_inode->i_sectors[12]) {
-    ide_read (part->my_disk, dir_inode->i_sectors[12], all_blocks + 12, 1);
+    bdev_read (part->bdev, dir_inode->i_sectors[12], all_blocks + 12, 1);
   }
 
   /* 目录项在存储时保证不会跨扇区 */
@@ -268,7 +268,7 @@ delete_dir_entry (struct partition* part, struct dir* pdir, uint32_t inode_no,
     dir_entry_idx= dir_entry_cnt= 0;
     memset (io_buf, 0, SECTOR_SIZE);
     /* 读取扇区,获得目录项 */
-    ide_read (part->my_disk, all_blocks[block_idx], io_buf, 1);
+    bdev_read (part->bdev, all_blocks[block_idx], io_buf, 1);
 
     /* 遍历所有的目录项,统计该扇区的目录项数量及是否有待删除的目录项 */
     while (dir_entry_idx < dir_entrys_per_sec) {
@@ -328,8 +328,7 @@ delete_dir_entry (struct partition* part, struct dir* pdir, uint32_t inode_no,
         if (indirect_blocks >
             1) { // 间接索引表中还包括其它间接块,仅在索引表中擦除当前这个间接块地址
           all_blocks[block_idx]= 0;
-          ide_write (part->my_disk, dir_inode->i_sectors[12], all_blocks + 12,
-                     1);
+          bdev_write (part->bdev, dir_inode->i_sectors[12], all_blocks + 12, 1);
         }
         else { // 间接索引表中就当前这1个间接块,直接把间接索引表所在的块回收,然后擦除间接索引表块地址
           /* 回收间接索引表所在的块 */
@@ -344,7 +343,7 @@ delete_dir_entry (struct partition* part, struct dir* pdir, uint32_t inode_no,
     }
     else { // 仅将该目录项清空
       memset (dir_entry_found, 0, dir_entry_size);
-      ide_write (part->my_disk, all_blocks[block_idx], io_buf, 1);
+      bdev_write (part->bdev, all_blocks[block_idx], io_buf, 1);
     }
 
     /* 更新i结点信息并同步到硬盘 */
@@ -371,7 +370,7 @@ dir_read (struct dir* dir) {
     block_idx++;
   }
   if (dir_inode->i_sectors[12] != 0) { // 若含有一级间接块表
-    ide_read (cur_part->my_disk, dir_inode->i_sectors[12], all_blocks + 12, 1);
+    bdev_read (cur_part->bdev, dir_inode->i_sectors[12], all_blocks + 12, 1);
     block_cnt= 140;
   }
   block_idx= 0;
@@ -391,7 +390,7 @@ dir_read (struct dir* dir) {
       continue;
     }
     memset (dir_e, 0, SECTOR_SIZE);
-    ide_read (cur_part->my_disk, all_blocks[block_idx], dir_e, 1);
+    bdev_read (cur_part->bdev, all_blocks[block_idx], dir_e, 1);
     dir_entry_idx= 0;
     /* 遍历扇区内所有目录项 */
     while (dir_entry_idx < dir_entrys_per_sec) {
@@ -2,8 +2,8 @@
 #define __FS_DIR_H
 #include "fs.h"
 #include "global.h"
-#include "ide.h"
 #include "inode.h"
+#include "partition.h"
 #include "stdint.h"
 
 #define MAX_FILE_NAME_LEN 16 // 最大文件名长度
@@ -11,10 +11,13 @@
 #include "thread.h"
 
 #define DEFAULT_SECS 1
+#define COPY_SECS 16 // file_copy每次搬运的最多扇区数
 
 /* 文件表 */
 extern struct file file_table[MAX_FILE_OPEN];
 
+struct wait_queue file_idle_wait; // 在此等待文件的fd_users降为0
+
 /* 从文件表file_table中获取一个空闲位,成功返回下标,失败返回-1 */
 int32_t
 get_free_slot_in_global (void) {
@@ -33,11 +36,13 @@ get_free_slot_in_global (void) {
 }
 
 /* 将全局描述符下标安装到进程或线程自己的文件描述符数组fd_table中,
- * 成功返回下标,失败返回-1 */
+ * 成功返回下标,失败返回-1. uring的worker也会往进程的fd_table中安装,
+ * 找空位和占位须在关中断下一起完成 */
 int32_t
 pcb_fd_install (int32_t globa_fd_idx) {
   struct task_struct* cur         = running_thread ();
   uint8_t             local_fd_idx= 3; // 跨过stdin,stdout,stderr
+  enum intr_status    old_status  = intr_disable ();
   while (local_fd_idx < MAX_FILES_OPEN_PER_PROC) {
     if (cur->fd_table[local_fd_idx] == -1) { // -1表示free_slot,可用
       cur->fd_table[local_fd_idx]= globa_fd_idx;
@@ -45,6 +50,7 @@ pcb_fd_install (int32_t globa_fd_idx) {
     }
     local_fd_idx++;
   }
+  intr_set_status (old_status);
   if (local_fd_idx == MAX_FILES_OPEN_PER_PROC) {
     printk ("exceed max open files_per_proc\n");
     return -1;
@@ -95,7 +101,7 @@ bitmap_sync (struct partition* part, uint32_t bit_idx, uint8_t btmp_type) {
     bitmap_off= part->block_bitmap.bits + off_size;
     break;
   }
-  ide_write (part->my_disk, sec_lba, bitmap_off, 1);
+  bdev_write (part->bdev, sec_lba, bitmap_off, 1);
 }
 
 /* 创建文件,若成功则返回文件描述符,否则返回-1 */
@@ -169,8 +175,10 @@ file_create (struct dir* parent_dir, char* filename, uint8_t flag) {
   bitmap_sync (cur_part, inode_no, INODE_BITMAP);
 
   /* e 将创建的文件i结点添加到open_inodes链表 */
+  rwlock_write_acquire (&cur_part->inode_lock);
   list_push (&cur_part->open_inodes, &new_file_inode->inode_tag);
   new_file_inode->i_open_cnts= 1;
+  rwlock_write_release (&cur_part->inode_lock);
 
   sys_free (io_buf);
   return pcb_fd_install (fd_idx);
@@ -224,60 +232,184 @@ file_open (uint32_t inode_no, uint8_t flag) {
   return pcb_fd_install (fd_idx);
 }
 
-/* 关闭文件 */
+/* 关闭文件,uring的worker还在使用时等它用完 */
 int32_t
 file_close (struct file* file) {
   if (file == NULL) {
     return -1;
   }
+  enum intr_status old_status= intr_disable ();
+  while (file->fd_users > 0) {
+    wait_queue_wait (&file_idle_wait, false, 0);
+  }
+  intr_set_status (old_status);
   file->fd_inode->write_deny= false;
   inode_close (file->fd_inode);
   file->fd_inode= NULL; // 使文件结构可用
   return 0;
 }
 
-/* 把buf中的count个字节写入file,成功则返回写入的字节数,失败则返回-1 */
+/**
+ * uring的worker借用进程的描述符读写期间,进程可能同时关闭它.
+ * 使用前file_pin,用完file_unpin,file_close等到没有使用者时才释放inode
+ */
+void
+file_pin (struct file* file) {
+  enum intr_status old_status= intr_disable ();
+  file->fd_users++;
+  intr_set_status (old_status);
+}
+
+void
+file_unpin (struct file* file) {
+  enum intr_status old_status= intr_disable ();
+  ASSERT (file->fd_users > 0);
+  if (--file->fd_users == 0) {
+    wait_queue_wake_all (&file_idle_wait);
+  }
+  intr_set_status (old_status);
+}
+
+/* 在iovec数组中顺序存取数据的游标 */
+struct iov_iter {
+  const struct iovec* iov;
+  uint32_t            idx; // 当前所在的段
+  uint32_t            off; // 段内偏移
+};
+
+/* 返回iov中iovcnt段的总字节数,超出32位时返回-1 */
 int32_t
-file_write (struct file* file, const void* buf, uint32_t count) {
-  if ((file->fd_inode->i_size + count) >
-      (BLOCK_SIZE * 140)) { // 文件目前最大只支持512*140=71680字节
-    printk ("exceed max file_size 71680 bytes, write file failed\n");
-    return -1;
+iov_length (const struct iovec* iov, uint32_t iovcnt) {
+  uint32_t total= 0;
+  uint32_t idx  = 0;
+  while (idx < iovcnt) {
+    if (total + iov[idx].iov_len < total ||
+        total + iov[idx].iov_len > 0x7fffffff) {
+      return -1;
+    }
+    total+= iov[idx].iov_len;
+    idx++;
   }
-  uint8_t* io_buf= sys_malloc (BLOCK_SIZE);
-  if (io_buf == NULL) {
-    printk ("file_write: sys_malloc for io_buf failed\n");
-    return -1;
+  return total;
+}
+
+/* 从iter处取出len字节到dst,并推进iter */
+static void
+iov_gather (struct iov_iter* iter, uint8_t* dst, uint32_t len) {
+  while (len > 0) {
+    const struct iovec* seg= &iter->iov[iter->idx];
+    if (iter->off == seg->iov_len) { // 跳过取完的段
+      iter->idx++;
+      iter->off= 0;
+      continue;
+    }
+    uint32_t n= seg->iov_len - iter->off < len ? seg->iov_len - iter->off : len;
+    memcpy (dst, (uint8_t*) seg->iov_base + iter->off, n);
+    dst+= n;
+    iter->off+= n;
+    len-= n;
   }
-  uint32_t* all_blocks=
-      (uint32_t*) sys_malloc (BLOCK_SIZE + 48); // 用来记录文件所有的块地址
-  if (all_blocks == NULL) {
-    printk ("file_write: sys_malloc for all_blocks failed\n");
+}
+
+/* 把src中的len字节依次放到iter处,并推进iter */
+static void
+iov_scatter (struct iov_iter* iter, const uint8_t* src, uint32_t len) {
+  while (len > 0) {
+    const struct iovec* seg= &iter->iov[iter->idx];
+    if (iter->off == seg->iov_len) { // 跳过放满的段
+      iter->idx++;
+      iter->off= 0;
+      continue;
+    }
+    uint32_t n= seg->iov_len - iter->off < len ? seg->iov_len - iter->off : len;
+    memcpy ((uint8_t*) seg->iov_base + iter->off, src, n);
+    src+= n;
+    iter->off+= n;
+    len-= n;
+  }
+}
+
+/* 把inode第start_idx到end_idx块的扇区地址收集到all_blocks的对应下标处 */
+static void
+file_blocks_collect (struct inode* inode, uint32_t start_idx, uint32_t end_idx,
+                     uint32_t* all_blocks) {
+  ASSERT (start_idx <= end_idx && end_idx < 140);
+  uint32_t block_idx= start_idx;
+  while (block_idx <= end_idx && block_idx < 12) { // 直接块
+    all_blocks[block_idx]= inode->i_sectors[block_idx];
+    block_idx++;
+  }
+  if (end_idx >= 12) { // 用到了一级间接块表,将表读进来写入到第13个块的位置之后
+    ASSERT (inode->i_sectors[12] != 0);
+    bdev_read (cur_part->bdev, inode->i_sectors[12], all_blocks + 12, 1);
+  }
+}
+
+/* 用iter处起的count个字节覆盖inode中pos开始的已有数据,不改变文件大小.
+ * 块地址只收集一次,不满一个扇区的部分先读出再写回 */
+static int32_t
+file_overwrite (struct inode* inode, uint32_t pos, struct iov_iter* iter,
+                uint32_t count) {
+  ASSERT (pos + count <= inode->i_size);
+  uint8_t*  io_buf    = sys_malloc (BLOCK_SIZE);
+  uint32_t* all_blocks= (uint32_t*) sys_malloc (BLOCK_SIZE + 48);
+  if (io_buf == NULL || all_blocks == NULL) {
+    printk ("file_overwrite: sys_malloc failed\n");
+    if (io_buf != NULL) {
+      sys_free (io_buf);
+    }
+    if (all_blocks != NULL) {
+      sys_free (all_blocks);
+    }
     return -1;
   }
+  file_blocks_collect (inode, pos / BLOCK_SIZE, (pos + count - 1) / BLOCK_SIZE,
+                       all_blocks);
+
+  uint32_t bytes_written= 0;
+  while (bytes_written < count) {
+    uint32_t sec_lba       = all_blocks[pos / BLOCK_SIZE];
+    uint32_t sec_off_bytes = pos % BLOCK_SIZE;
+    uint32_t sec_left_bytes= BLOCK_SIZE - sec_off_bytes;
+    uint32_t size_left     = count - bytes_written;
+    uint32_t chunk_size=
+        size_left < sec_left_bytes ? size_left : sec_left_bytes;
+
+    if (chunk_size < BLOCK_SIZE) {
+      bdev_read (cur_part->bdev, sec_lba, io_buf, 1);
+    }
+    iov_gather (iter, io_buf + sec_off_bytes, chunk_size);
+    bdev_write (cur_part->bdev, sec_lba, io_buf, 1);
+
+    pos+= chunk_size;
+    bytes_written+= chunk_size;
+  }
+  sys_free (all_blocks);
+  sys_free (io_buf);
+  return bytes_written;
+}
 
-  const uint8_t* src          = buf;   // 用src指向buf中待写入的数据
-  uint32_t       bytes_written= 0;     // 用来记录已写入数据大小
-  uint32_t       size_left    = count; // 用来记录未写入数据大小
-  int32_t        block_lba    = -1;    // 块地址
-  uint32_t       block_bitmap_idx=
+/**
+ * 为在inode末尾追加count个字节分配好所需的块,
+ * 并把从最后一个已用块起要写的块地址收集到all_blocks的对应下标处.
+ * 成功返回0,失败返回-1.
+ */
+static int32_t
+file_blocks_extend (struct inode* inode, uint32_t count, uint32_t* all_blocks) {
+  int32_t  block_lba= -1; // 块地址
+  uint32_t block_bitmap_idx=
       0; // 用来记录block对应于block_bitmap中的索引,做为参数传给bitmap_sync
-  uint32_t sec_idx;              // 用来索引扇区
-  uint32_t sec_lba;              // 扇区地址
-  uint32_t sec_off_bytes;        // 扇区内字节偏移量
-  uint32_t sec_left_bytes;       // 扇区内剩余字节量
-  uint32_t chunk_size;           // 每次写入硬盘的数据块大小
   int32_t  indirect_block_table; // 用来获取一级间接表地址
   uint32_t block_idx;            // 块索引
 
   /* 判断文件是否是第一次写,如果是,先为其分配一个块 */
-  if (file->fd_inode->i_sectors[0] == 0) {
+  if (inode->i_sectors[0] == 0) {
     block_lba= block_bitmap_alloc (cur_part);
     if (block_lba == -1) {
-      printk ("file_write: block_bitmap_alloc failed\n");
+      printk ("file_blocks_extend: block_bitmap_alloc failed\n");
       return -1;
     }
-    file->fd_inode->i_sectors[0]= block_lba;
+    inode->i_sectors[0]= block_lba;
 
     /* 每分配一个块就将位图同步到硬盘 */
     block_bitmap_idx= block_lba - cur_part->sb->data_start_lba;
@@ -286,11 +418,11 @@ file_write (struct file* file, const void* buf, uint32_t count) {
   }
 
   /* 写入count个字节前,该文件已经占用的块数 */
-  uint32_t file_has_used_blocks= file->fd_inode->i_size / BLOCK_SIZE + 1;
+  uint32_t file_has_used_blocks= inode->i_size / BLOCK_SIZE + 1;
 
   /* 存储count字节后该文件将占用的块数 */
   uint32_t file_will_use_blocks=
-      (file->fd_inode->i_size + count) / BLOCK_SIZE + 1;
+      (inode->i_size + count) / BLOCK_SIZE + 1;
   ASSERT (file_will_use_blocks <= 140);
 
   /* 通过此增量判断是否需要分配扇区,如增量为0,表示原扇区够用 */
@@ -302,13 +434,13 @@ file_write (struct file* file, const void* buf, uint32_t count) {
     /* 在同一扇区内写入数据,不涉及到分配新扇区 */
     if (file_has_used_blocks <= 12) {      // 文件数据量将在12块之内
       block_idx= file_has_used_blocks - 1; // 指向最后一个已有数据的扇区
-      all_blocks[block_idx]= file->fd_inode->i_sectors[block_idx];
+      all_blocks[block_idx]= inode->i_sectors[block_idx];
     }
     else {
       /* 未写入新数据之前已经占用了间接块,需要将间接块地址读进来 */
-      ASSERT (file->fd_inode->i_sectors[12] != 0);
-      indirect_block_table= file->fd_inode->i_sectors[12];
-      ide_read (cur_part->my_disk, indirect_block_table, all_blocks + 12, 1);
+      ASSERT (inode->i_sectors[12] != 0);
+      indirect_block_table= inode->i_sectors[12];
+      bdev_read (cur_part->bdev, indirect_block_table, all_blocks + 12, 1);
     }
   }
   else {
@@ -317,23 +449,23 @@ file_write (struct file* file, const void* buf, uint32_t count) {
     if (file_will_use_blocks <= 12) {
       /* 先将有剩余空间的可继续用的扇区地址写入all_blocks */
       block_idx= file_has_used_blocks - 1;
-      ASSERT (file->fd_inode->i_sectors[block_idx] != 0);
-      all_blocks[block_idx]= file->fd_inode->i_sectors[block_idx];
+      ASSERT (inode->i_sectors[block_idx] != 0);
+      all_blocks[block_idx]= inode->i_sectors[block_idx];
 
       /* 再将未来要用的扇区分配好后写入all_blocks */
       block_idx= file_has_used_blocks; // 指向第一个要分配的新扇区
       while (block_idx < file_will_use_blocks) {
         block_lba= block_bitmap_alloc (cur_part);
         if (block_lba == -1) {
-          printk ("file_write: block_bitmap_alloc for situation 1 failed\n");
+          printk ("file_blocks_extend: block_bitmap_alloc for situation 1 failed\n");
           return -1;
         }
 
         /* 写文件时,不应该存在块未使用但已经分配扇区的情况,当文件删除时,就会把块地址清0
          */
-        ASSERT (file->fd_inode->i_sectors[block_idx] ==
+        ASSERT (inode->i_sectors[block_idx] ==
                 0); // 确保尚未分配扇区地址
-        file->fd_inode->i_sectors[block_idx]= all_blocks[block_idx]= block_lba;
+        inode->i_sectors[block_idx]= all_blocks[block_idx]= block_lba;
 
         /* 每分配一个块就将位图同步到硬盘 */
         block_bitmap_idx= block_lba - cur_part->sb->data_start_lba;
@@ -347,32 +479,32 @@ file_write (struct file* file, const void* buf, uint32_t count) {
 
       /* 先将有剩余空间的可继续用的扇区地址收集到all_blocks */
       block_idx= file_has_used_blocks - 1; // 指向旧数据所在的最后一个扇区
-      all_blocks[block_idx]= file->fd_inode->i_sectors[block_idx];
+      all_blocks[block_idx]= inode->i_sectors[block_idx];
 
       /* 创建一级间接块表 */
       block_lba= block_bitmap_alloc (cur_part);
       if (block_lba == -1) {
-        printk ("file_write: block_bitmap_alloc for situation 2 failed\n");
+        printk ("file_blocks_extend: block_bitmap_alloc for situation 2 failed\n");
         return -1;
       }
 
-      ASSERT (file->fd_inode->i_sectors[12] == 0); // 确保一级间接块表未分配
+      ASSERT (inode->i_sectors[12] == 0); // 确保一级间接块表未分配
       /* 分配一级间接块索引表 */
-      indirect_block_table= file->fd_inode->i_sectors[12]= block_lba;
+      indirect_block_table= inode->i_sectors[12]= block_lba;
 
       block_idx=
           file_has_used_blocks; // 第一个未使用的块,即本文件最后一个已经使用的直接块的下一块
       while (block_idx < file_will_use_blocks) {
         block_lba= block_bitmap_alloc (cur_part);
         if (block_lba == -1) {
-          printk ("file_write: block_bitmap_alloc for situation 2 failed\n");
+          printk ("file_blocks_extend: block_bitmap_alloc for situation 2 failed\n");
           return -1;
         }
 
         if (block_idx < 12) { // 新创建的0~11块直接存入all_blocks数组
-          ASSERT (file->fd_inode->i_sectors[block_idx] ==
+          ASSERT (inode->i_sectors[block_idx] ==
                   0); // 确保尚未分配扇区地址
-          file->fd_inode->i_sectors[block_idx]= all_blocks[block_idx]=
+          inode->i_sectors[block_idx]= all_blocks[block_idx]=
               block_lba;
         }
         else { // 间接块只写入到all_block数组中,待全部分配完成后一次性同步到硬盘
@@ -385,24 +517,24 @@ file_write (struct file* file, const void* buf, uint32_t count) {
 
         block_idx++; // 下一个新扇区
       }
-      ide_write (cur_part->my_disk, indirect_block_table, all_blocks + 12,
-                 1); // 同步一级间接块表到硬盘
+      bdev_write (cur_part->bdev, indirect_block_table, all_blocks + 12,
+                  1); // 同步一级间接块表到硬盘
     }
     else if (file_has_used_blocks > 12) {
       /* 第三种情况:新数据占据间接块*/
-      ASSERT (file->fd_inode->i_sectors[12] != 0); // 已经具备了一级间接块表
-      indirect_block_table= file->fd_inode->i_sectors[12]; // 获取一级间接表地址
+      ASSERT (inode->i_sectors[12] != 0); // 已经具备了一级间接块表
+      indirect_block_table= inode->i_sectors[12]; // 获取一级间接表地址
 
       /* 已使用的间接块也将被读入all_blocks,无须单独收录 */
-      ide_read (cur_part->my_disk, indirect_block_table, all_blocks + 12,
-                1); // 获取所有间接块地址
+      bdev_read (cur_part->bdev, indirect_block_table, all_blocks + 12,
+                 1); // 获取所有间接块地址
 
       block_idx=
           file_has_used_blocks; // 第一个未使用的间接块,即已经使用的间接块的下一块
       while (block_idx < file_will_use_blocks) {
         block_lba= block_bitmap_alloc (cur_part);
         if (block_lba == -1) {
-          printk ("file_write: block_bitmap_alloc for situation 3 failed\n");
+          printk ("file_blocks_extend: block_bitmap_alloc for situation 3 failed\n");
           return -1;
         }
         all_blocks[block_idx++]= block_lba;
@@ -411,147 +543,336 @@ file_write (struct file* file, const void* buf, uint32_t count) {
         block_bitmap_idx= block_lba - cur_part->sb->data_start_lba;
         bitmap_sync (cur_part, block_bitmap_idx, BLOCK_BITMAP);
       }
-      ide_write (cur_part->my_disk, indirect_block_table, all_blocks + 12,
-                 1); // 同步一级间接块表到硬盘
+      bdev_write (cur_part->bdev, indirect_block_table, all_blocks + 12,
+                  1); // 同步一级间接块表到硬盘
     }
   }
 
-  /* 用到的块地址已经收集到all_blocks中,下面开始写数据 */
+  return 0;
+}
+
+/* 把iter处起的count个字节追加到inode末尾,成功则返回写入的字节数,失败则返回-1.
+ * 追加所需的块一次分配好,再逐个扇区写入 */
+static int32_t
+file_append (struct inode* inode, struct iov_iter* iter, uint32_t count) {
+  if ((inode->i_size + count) >
+      (BLOCK_SIZE * 140)) { // 文件目前最大只支持512*140=71680字节
+    printk ("exceed max file_size 71680 bytes, write file failed\n");
+    return -1;
+  }
+  uint8_t* io_buf= sys_malloc (BLOCK_SIZE);
+  if (io_buf == NULL) {
+    printk ("file_write: sys_malloc for io_buf failed\n");
+    return -1;
+  }
+  uint32_t* all_blocks=
+      (uint32_t*) sys_malloc (BLOCK_SIZE + 48); // 用来记录文件所有的块地址
+  if (all_blocks == NULL) {
+    printk ("file_write: sys_malloc for all_blocks failed\n");
+    sys_free (io_buf);
+    return -1;
+  }
+  if (file_blocks_extend (inode, count, all_blocks) == -1) {
+    sys_free (all_blocks);
+    sys_free (io_buf);
+    return -1;
+  }
+
+  uint32_t bytes_written= 0;     // 用来记录已写入数据大小
+  uint32_t size_left    = count; // 用来记录未写入数据大小
+  uint32_t sec_idx;              // 用来索引扇区
+  uint32_t sec_lba;              // 扇区地址
+  uint32_t sec_off_bytes;        // 扇区内字节偏移量
+  uint32_t sec_left_bytes;       // 扇区内剩余字节量
+  uint32_t chunk_size;           // 每次写入硬盘的数据块大小
+
+  /* 用到的块地址已经收集到all_blocks中,下面开始写数据,每个扇区只写一次 */
   bool first_write_block= true; // 含有剩余空间的扇区标识
-  file->fd_pos=
-      file->fd_inode->i_size - 1; // 置fd_pos为文件大小-1,下面在写数据时随时更新
   while (bytes_written < count) { // 直到写完所有数据
     memset (io_buf, 0, BLOCK_SIZE);
-    sec_idx       = file->fd_inode->i_size / BLOCK_SIZE;
+    sec_idx       = inode->i_size / BLOCK_SIZE;
     sec_lba       = all_blocks[sec_idx];
-    sec_off_bytes = file->fd_inode->i_size % BLOCK_SIZE;
+    sec_off_bytes = inode->i_size % BLOCK_SIZE;
     sec_left_bytes= BLOCK_SIZE - sec_off_bytes;
 
     /* 判断此次写入硬盘的数据大小 */
     chunk_size= size_left < sec_left_bytes ? size_left : sec_left_bytes;
     if (first_write_block) {
-      ide_read (cur_part->my_disk, sec_lba, io_buf, 1);
+      bdev_read (cur_part->bdev, sec_lba, io_buf, 1);
       first_write_block= false;
     }
-    memcpy (io_buf + sec_off_bytes, src, chunk_size);
-    ide_write (cur_part->my_disk, sec_lba, io_buf, 1);
+    iov_gather (iter, io_buf + sec_off_bytes, chunk_size);
+    bdev_write (cur_part->bdev, sec_lba, io_buf, 1);
 
-    src+= chunk_size;                    // 将指针推移到下个新数据
-    file->fd_inode->i_size+= chunk_size; // 更新文件大小
-    file->fd_pos+= chunk_size;
+    inode->i_size+= chunk_size; // 更新文件大小
     bytes_written+= chunk_size;
     size_left-= chunk_size;
   }
-  inode_sync (cur_part, file->fd_inode, io_buf);
+  inode_sync (cur_part, inode, io_buf);
   sys_free (all_blocks);
   sys_free (io_buf);
   return bytes_written;
 }
 
-/* 从文件file中读取count个字节写入buf, 返回读出的字节数,若到文件尾则返回-1 */
+/* 把buf中的count个字节写入file,成功则返回写入的字节数,失败则返回-1 */
 int32_t
-file_read (struct file* file, void* buf, uint32_t count) {
-  uint8_t* buf_dst= (uint8_t*) buf;
-  uint32_t size= count, size_left= size;
-
-  /* 若要读取的字节数超过了文件可读的剩余量, 就用剩余量做为待读取的字节数 */
-  if ((file->fd_pos + count) > file->fd_inode->i_size) {
-    size     = file->fd_inode->i_size - file->fd_pos;
-    size_left= size;
-    if (size == 0) { // 若到文件尾则返回-1
-      return -1;
-    }
+file_write (struct file* file, const void* buf, uint32_t count) {
+  struct iovec iov= {(void*) buf, count};
+  return file_writev (file, &iov, 1);
+}
+
+/* 把iov中iovcnt段数据依次追加到file末尾,成功则返回写入的字节数,失败则返回-1 */
+int32_t
+file_writev (struct file* file, const struct iovec* iov, uint32_t iovcnt) {
+  int32_t count= iov_length (iov, iovcnt);
+  if (count == -1) {
+    return -1;
+  }
+  struct iov_iter iter= {iov, 0, 0};
+  int32_t bytes_written= file_append (file->fd_inode, &iter, count);
+  if (bytes_written != -1) {
+    file->fd_pos= file->fd_inode->i_size - 1; // 写完后fd_pos指向最后一个字节
+  }
+  return bytes_written;
+}
+
+/**
+ * 把iov中iovcnt段数据写到file的pos处,不移动fd_pos.
+ * 文件内的部分直接覆盖,超出文件尾的部分追加,pos不能超过文件大小.
+ * 成功则返回写入的字节数,失败则返回-1.
+ */
+int32_t
+file_pwrite (struct file* file, const struct iovec* iov, uint32_t iovcnt,
+             uint32_t pos) {
+  struct inode* inode= file->fd_inode;
+  int32_t       count= iov_length (iov, iovcnt);
+  if (count == -1) {
+    return -1;
   }
+  if (pos > inode->i_size) {
+    printk ("file_pwrite: pos exceeds file size\n");
+    return -1;
+  }
+  struct iov_iter iter= {iov, 0, 0};
+  uint32_t        overwrite= inode->i_size - pos;
+  if (overwrite > (uint32_t) count) {
+    overwrite= count;
+  }
+  if (overwrite > 0 && file_overwrite (inode, pos, &iter, overwrite) == -1) {
+    return -1;
+  }
+  if ((uint32_t) count > overwrite &&
+      file_append (inode, &iter, count - overwrite) == -1) {
+    return overwrite == 0 ? -1 : (int32_t) overwrite;
+  }
+  return count;
+}
 
+/* 从inode的pos处读count个字节放到iter处,块地址只收集一次,返回读出的字节数 */
+static int32_t
+file_read_at (struct inode* inode, uint32_t pos, struct iov_iter* iter,
+              uint32_t count) {
   uint8_t* io_buf= sys_malloc (BLOCK_SIZE);
   if (io_buf == NULL) {
     printk ("file_read: sys_malloc for io_buf failed\n");
+    return -1;
   }
   uint32_t* all_blocks=
       (uint32_t*) sys_malloc (BLOCK_SIZE + 48); // 用来记录文件所有的块地址
   if (all_blocks == NULL) {
     printk ("file_read: sys_malloc for all_blocks failed\n");
+    sys_free (io_buf);
     return -1;
   }
+  file_blocks_collect (inode, pos / BLOCK_SIZE, (pos + count - 1) / BLOCK_SIZE,
+                       all_blocks);
+
+  /* 用到的块地址已经收集到all_blocks中,下面开始读数据,每个扇区只读一次 */
+  uint32_t sec_lba, sec_off_bytes, sec_left_bytes, chunk_size;
+  uint32_t bytes_read= 0, size_left= count;
+  while (bytes_read < count) { // 直到读完为止
+    sec_lba       = all_blocks[pos / BLOCK_SIZE];
+    sec_off_bytes = pos % BLOCK_SIZE;
+    sec_left_bytes= BLOCK_SIZE - sec_off_bytes;
+    chunk_size    = size_left < sec_left_bytes ? size_left
+                                               : sec_left_bytes; // 待读入的数据大小
 
-  uint32_t block_read_start_idx=
-      file->fd_pos / BLOCK_SIZE; // 数据所在块的起始地址
-  uint32_t block_read_end_idx=
-      (file->fd_pos + size) / BLOCK_SIZE; // 数据所在块的终止地址
-  uint32_t read_blocks=
-      block_read_start_idx - block_read_end_idx; // 如增量为0,表示数据在同一扇区
-  ASSERT (block_read_start_idx < 139 && block_read_end_idx < 139);
+    bdev_read (cur_part->bdev, sec_lba, io_buf, 1);
+    iov_scatter (iter, io_buf + sec_off_bytes, chunk_size);
 
-  int32_t  indirect_block_table; // 用来获取一级间接表地址
-  uint32_t block_idx;            // 获取待读的块地址
+    pos+= chunk_size;
+    bytes_read+= chunk_size;
+    size_left-= chunk_size;
+  }
+  sys_free (all_blocks);
+  sys_free (io_buf);
+  return bytes_read;
+}
 
-  /* 以下开始构建all_blocks块地址数组,专门存储用到的块地址(本程序中块大小同扇区大小)
-   */
-  if (read_blocks == 0) { // 在同一扇区内读数据,不涉及到跨扇区读取
-    ASSERT (block_read_end_idx == block_read_start_idx);
-    if (block_read_end_idx < 12) { // 待读的数据在12个直接块之内
-      block_idx            = block_read_end_idx;
-      all_blocks[block_idx]= file->fd_inode->i_sectors[block_idx];
-    }
-    else { // 若用到了一级间接块表,需要将表中间接块读进来
-      indirect_block_table= file->fd_inode->i_sectors[12];
-      ide_read (cur_part->my_disk, indirect_block_table, all_blocks + 12, 1);
-    }
+/**
+ * 从文件file的pos处读出数据依次放入iov的iovcnt段中,不移动fd_pos.
+ * 返回读出的字节数,若pos已到文件尾则返回-1.
+ */
+int32_t
+file_pread (struct file* file, const struct iovec* iov, uint32_t iovcnt,
+            uint32_t pos) {
+  int32_t count= iov_length (iov, iovcnt);
+  if (count == -1) {
+    return -1;
+  }
+  if (pos >= file->fd_inode->i_size) { // 若到文件尾则返回-1
+    return -1;
+  }
+  /* 若要读取的字节数超过了文件可读的剩余量, 就用剩余量做为待读取的字节数.
+   * 不用pos + count比较,pos来自用户,相加可能溢出 */
+  uint32_t size= file->fd_inode->i_size - pos;
+  if ((uint32_t) count < size) {
+    size= count;
+  }
+  if (size == 0) {
+    return 0;
+  }
+  struct iov_iter iter= {iov, 0, 0};
+  return file_read_at (file->fd_inode, pos, &iter, size);
+}
+
+/* 从文件file中读出数据依次放入iov的iovcnt段中,返回读出的字节数,若到文件尾则返回-1 */
+int32_t
+file_readv (struct file* file, const struct iovec* iov, uint32_t iovcnt) {
+  int32_t bytes_read= file_pread (file, iov, iovcnt, file->fd_pos);
+  if (bytes_read > 0) {
+    file->fd_pos+= bytes_read;
   }
-  else { // 若要读多个块
-         /* 第一种情况: 起始块和终止块属于直接块*/
-    if (block_read_end_idx < 12) { // 数据结束所在的块属于直接块
-      block_idx= block_read_start_idx;
-      while (block_idx <= block_read_end_idx) {
-        all_blocks[block_idx]= file->fd_inode->i_sectors[block_idx];
-        block_idx++;
+  return bytes_read;
+}
+
+/* 从文件file中读取count个字节写入buf, 返回读出的字节数,若到文件尾则返回-1 */
+int32_t
+file_read (struct file* file, void* buf, uint32_t count) {
+  struct iovec iov= {buf, count};
+  return file_readv (file, &iov, 1);
+}
+
+/* all_blocks中从idx起LBA连续的扇区数,最多max个 */
+static uint32_t
+blocks_run (uint32_t* all_blocks, uint32_t idx, uint32_t max) {
+  uint32_t cnt= 1;
+  while (cnt < max && all_blocks[idx + cnt] == all_blocks[idx] + cnt) {
+    cnt++;
+  }
+  return cnt;
+}
+
+/**
+ * 把in从fd_pos起的len个字节追加到out末尾,数据不经过用户空间.
+ * 两边的块地址都只收集一次,按LBA连续的扇区段成批读写,
+ * 写目标是异步的,与下一段源数据的读重叠.
+ * 返回复制的字节数,in已到文件尾则返回-1.
+ */
+int32_t
+file_copy (struct file* in, struct file* out, uint32_t len) {
+  struct inode* src= in->fd_inode;
+  struct inode* dst= out->fd_inode;
+  if (src == dst) { // 追加到自身会边读边改变源文件
+    printk ("file_copy: in and out are the same file\n");
+    return -1;
+  }
+  if (in->fd_pos >= src->i_size) { // 若到文件尾则返回-1
+    return -1;
+  }
+  if (len > src->i_size - in->fd_pos) {
+    len= src->i_size - in->fd_pos;
+  }
+  if (len == 0) {
+    return 0;
+  }
+  if (dst->i_size + len > BLOCK_SIZE * 140) {
+    printk ("exceed max file_size 71680 bytes, copy file failed\n");
+    return -1;
+  }
+
+  /* 源数据可能不与扇区对齐,源缓冲区比目标缓冲区多一个扇区 */
+  uint8_t*  src_buf   = sys_malloc ((COPY_SECS + 1) * BLOCK_SIZE);
+  uint8_t*  dst_buf   = sys_malloc (COPY_SECS * BLOCK_SIZE);
+  uint32_t* src_blocks= sys_malloc (BLOCK_SIZE + 48);
+  uint32_t* dst_blocks= sys_malloc (BLOCK_SIZE + 48);
+  int32_t   ret       = -1;
+  if (src_buf == NULL || dst_buf == NULL || src_blocks == NULL ||
+      dst_blocks == NULL) {
+    printk ("file_copy: sys_malloc failed\n");
+  }
+  else if (file_blocks_extend (dst, len, dst_blocks) != -1) {
+    uint32_t   src_pos= in->fd_pos;
+    uint32_t   copied = 0;
+    bool       writing= false; // wbio是否已提交未等待
+    struct bio wbio;
+    file_blocks_collect (src, src_pos / BLOCK_SIZE,
+                         (src_pos + len - 1) / BLOCK_SIZE, src_blocks);
+
+    while (copied < len) {
+      /* 目标从文件尾所在的扇区起,取一段LBA连续的扇区 */
+      uint32_t dst_idx = dst->i_size / BLOCK_SIZE;
+      uint32_t dst_off = dst->i_size % BLOCK_SIZE;
+      uint32_t dst_secs= DIV_ROUND_UP (dst_off + (len - copied), BLOCK_SIZE);
+      if (dst_secs > COPY_SECS) {
+        dst_secs= COPY_SECS;
       }
-    }
-    else if (block_read_start_idx < 12 && block_read_end_idx >= 12) {
-      /* 第二种情况: 待读入的数据跨越直接块和间接块两类*/
-      /* 先将直接块地址写入all_blocks */
-      block_idx= block_read_start_idx;
-      while (block_idx < 12) {
-        all_blocks[block_idx]= file->fd_inode->i_sectors[block_idx];
-        block_idx++;
+      dst_secs  = blocks_run (dst_blocks, dst_idx, dst_secs);
+      uint32_t n= dst_secs * BLOCK_SIZE - dst_off;
+      if (n > len - copied) {
+        n= len - copied;
+      }
+
+      /* 读出源数据所在的扇区,同样按LBA连续的段成批读 */
+      uint32_t src_idx= src_pos / BLOCK_SIZE;
+      uint32_t src_end= (src_pos + n - 1) / BLOCK_SIZE;
+      uint32_t idx    = src_idx;
+      while (idx <= src_end) {
+        uint32_t run= blocks_run (src_blocks, idx, src_end - idx + 1);
+        bdev_read (cur_part->bdev, src_blocks[idx],
+                   src_buf + (idx - src_idx) * BLOCK_SIZE, run);
+        idx+= run;
       }
-      ASSERT (file->fd_inode->i_sectors[12] != 0); // 确保已经分配了一级间接块表
 
-      /* 再将间接块地址写入all_blocks */
-      indirect_block_table= file->fd_inode->i_sectors[12];
-      ide_read (cur_part->my_disk, indirect_block_table, all_blocks + 12,
-                1); // 将一级间接块表读进来写入到第13个块的位置之后
+      /* 上一段写完才能重新填dst_buf */
+      if (writing && !bio_wait (&wbio)) {
+        PANIC ("file_copy: write failed");
+      }
+      /* 目标首扇区中已有的数据要保留,末扇区超出文件尾的部分清0 */
+      if (dst_off != 0) {
+        bdev_read (cur_part->bdev, dst_blocks[dst_idx], dst_buf, 1);
+      }
+      memset (dst_buf + dst_off + n, 0, dst_secs * BLOCK_SIZE - dst_off - n);
+      memcpy (dst_buf + dst_off, src_buf + src_pos % BLOCK_SIZE, n);
+      bio_init (&wbio, cur_part->bdev, dst_blocks[dst_idx], dst_buf, dst_secs,
+                true);
+      submit_bio (&wbio);
+      writing= true;
+
+      dst->i_size+= n;
+      src_pos+= n;
+      copied+= n;
     }
-    else {
-      /* 第三种情况: 数据在间接块中*/
-      ASSERT (file->fd_inode->i_sectors[12] != 0); // 确保已经分配了一级间接块表
-      indirect_block_table= file->fd_inode->i_sectors[12]; // 获取一级间接表地址
-      ide_read (cur_part->my_disk, indirect_block_table, all_blocks + 12,
-                1); // 将一级间接块表读进来写入到第13个块的位置之后
+    if (writing && !bio_wait (&wbio)) {
+      PANIC ("file_copy: write failed");
     }
+    inode_sync (cur_part, dst, src_buf);
+    in->fd_pos = src_pos;
+    out->fd_pos= dst->i_size - 1; // 同file_writev,指向最后一个字节
+    ret        = copied;
   }
 
-  /* 用到的块地址已经收集到all_blocks中,下面开始读数据 */
-  uint32_t sec_idx, sec_lba, sec_off_bytes, sec_left_bytes, chunk_size;
-  uint32_t bytes_read= 0;
-  while (bytes_read < size) { // 直到读完为止
-    sec_idx       = file->fd_pos / BLOCK_SIZE;
-    sec_lba       = all_blocks[sec_idx];
-    sec_off_bytes = file->fd_pos % BLOCK_SIZE;
-    sec_left_bytes= BLOCK_SIZE - sec_off_bytes;
-    chunk_size    = size_left < sec_left_bytes ? size_left
-                                               : sec_left_bytes; // 待读入的数据大小
-
-    memset (io_buf, 0, BLOCK_SIZE);
-    ide_read (cur_part->my_disk, sec_lba, io_buf, 1);
-    memcpy (buf_dst, io_buf + sec_off_bytes, chunk_size);
-
-    buf_dst+= chunk_size;
-    file->fd_pos+= chunk_size;
-    bytes_read+= chunk_size;
-    size_left-= chunk_size;
+  if (src_buf != NULL) {
+    sys_free (src_buf);
   }
-  sys_free (all_blocks);
-  sys_free (io_buf);
-  return bytes_read;
+  if (dst_buf != NULL) {
+    sys_free (dst_buf);
+  }
+  if (src_blocks != NULL) {
+    sys_free (src_blocks);
+  }
+  if (dst_blocks != NULL) {
+    sys_free (dst_blocks);
+  }
+  return ret;
 }
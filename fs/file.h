@@ -1,15 +1,18 @@
 #ifndef __FS_FILE_H
 #define __FS_FILE_H
 #include "dir.h"
+#include "fs.h"
 #include "global.h"
-#include "ide.h"
+#include "partition.h"
 #include "stdint.h"
+#include "sync.h"
 
 /* 文件结构 */
 struct file {
   uint32_t fd_pos; // 记录当前文件操作的偏移地址,以0为起始,最大为文件大小-1
   uint32_t      fd_flag;
   struct inode* fd_inode;
+  uint32_t      fd_users; // 正在使用本文件的uring操作数,为0时才能关闭
 };
 
 /* 标准输入输出描述符 */
@@ -28,6 +31,7 @@ enum bitmap_type {
 #define MAX_FILE_OPEN 32 // 系统可打开的最大文件数
 
 struct file file_table[MAX_FILE_OPEN];
+extern struct wait_queue file_idle_wait;
 int32_t     inode_bitmap_alloc (struct partition* part);
 int32_t     block_bitmap_alloc (struct partition* part);
 int32_t     file_create (struct dir* parent_dir, char* filename, uint8_t flag);
@@ -36,6 +40,18 @@ int32_t get_free_slot_in_global (void);
 int32_t pcb_fd_install (int32_t globa_fd_idx);
 int32_t file_open (uint32_t inode_no, uint8_t flag);
 int32_t file_close (struct file* file);
+void    file_pin (struct file* file);
+void    file_unpin (struct file* file);
 int32_t file_write (struct file* file, const void* buf, uint32_t count);
 int32_t file_read (struct file* file, void* buf, uint32_t count);
+int32_t iov_length (const struct iovec* iov, uint32_t iovcnt);
+int32_t file_writev (struct file* file, const struct iovec* iov,
+                     uint32_t iovcnt);
+int32_t file_readv (struct file* file, const struct iovec* iov,
+                    uint32_t iovcnt);
+int32_t file_pwrite (struct file* file, const struct iovec* iov,
+                     uint32_t iovcnt, uint32_t pos);
+int32_t file_pread (struct file* file, const struct iovec* iov,
+                    uint32_t iovcnt, uint32_t pos);
+int32_t file_copy (struct file* in, struct file* out, uint32_t len);
 #endif
@@ -4,10 +4,11 @@
 #include "dir.h"
 #include "file.h"
 #include "global.h"
-#include "ide.h"
 #include "inode.h"
+#include "interrupt.h"
 #include "list.h"
 #include "memory.h"
+#include "partition.h"
 #include "stdint.h"
 #include "stdio-kernel.h"
 #include "string.h"
@@ -21,8 +22,8 @@ mount_partition (struct list_elem* pelem, int arg) {
   char*             part_name= (char*) arg;
   struct partition* part     = elem2entry (struct partition, part_tag, pelem);
   if (!strcmp (part->name, part_name)) {
-    cur_part       = part;
-    struct disk* hd= cur_part->my_disk;
+    cur_part                 = part;
+    struct block_device* bdev= cur_part->bdev;
 
     /* sb_buf用来存储从硬盘上读入的超级块 */
     struct super_block* sb_buf= (struct super_block*) sys_malloc (SECTOR_SIZE);
@@ -36,7 +37,7 @@ mount_partition (struct list_elem* pelem, int arg) {
 
     /* 读入超级块 */
     memset (sb_buf, 0, SECTOR_SIZE);
-    ide_read (hd, cur_part->start_lba + 1, sb_buf, 1);
+    bdev_read (bdev, cur_part->start_lba + 1, sb_buf, 1);
 
     /* 把sb_buf中超级块的信息复制到分区的超级块sb中。*/
     memcpy (cur_part->sb, sb_buf, sizeof (struct super_block));
@@ -50,8 +51,8 @@ mount_partition (struct list_elem* pelem, int arg) {
     cur_part->block_bitmap.btmp_bytes_len=
         sb_buf->block_bitmap_sects * SECTOR_SIZE;
     /* 从硬盘上读入块位图到分区的block_bitmap.bits */
-    ide_read (hd, sb_buf->block_bitmap_lba, cur_part->block_bitmap.bits,
-              sb_buf->block_bitmap_sects);
+    bdev_read (bdev, sb_buf->block_bitmap_lba, cur_part->block_bitmap.bits,
+               sb_buf->block_bitmap_sects);
     /*************************************************************/
 
     /**********     将硬盘上的inode位图读入到内存    ************/
@@ -63,11 +64,13 @@ mount_partition (struct list_elem* pelem, int arg) {
     cur_part->inode_bitmap.btmp_bytes_len=
         sb_buf->inode_bitmap_sects * SECTOR_SIZE;
     /* 从硬盘上读入inode位图到分区的inode_bitmap.bits */
-    ide_read (hd, sb_buf->inode_bitmap_lba, cur_part->inode_bitmap.bits,
-              sb_buf->inode_bitmap_sects);
+    bdev_read (bdev, sb_buf->inode_bitmap_lba, cur_part->inode_bitmap.bits,
+               sb_buf->inode_bitmap_sects);
     /*************************************************************/
 
     list_init (&cur_part->open_inodes);
+    rwlock_init (&cur_part->dir_lock);
+    rwlock_init (&cur_part->inode_lock);
     printk ("mount %s done!\n", part->name);
 
     /* 此处返回true是为了迎合主调函数list_traversal的实现,与函数本身功能无关。
@@ -131,11 +134,11 @@ partition_format (struct partition* part) {
           sb.inode_bitmap_sects, sb.inode_table_lba, sb.inode_table_sects,
           sb.data_start_lba);
 
-  struct disk* hd= part->my_disk;
+  struct block_device* bdev= part->bdev;
   /*******************************
    * 1 将超级块写入本分区的1扇区 *
    ******************************/
-  ide_write (hd, part->start_lba + 1, &sb, 1);
+  bdev_write (bdev, part->start_lba + 1, &sb, 1);
   printk ("   super_block_lba:0x%x\n", part->start_lba + 1);
 
   /* 找出数据量最大的元信息,用其尺寸做存储缓冲区*/
@@ -169,7 +172,7 @@ partition_format (struct partition* part) {
   while (bit_idx <= block_bitmap_last_bit) {
     buf[block_bitmap_last_byte]&= ~(1 << bit_idx++);
   }
-  ide_write (hd, sb.block_bitmap_lba, buf, sb.block_bitmap_sects);
+  bdev_write (bdev, sb.block_bitmap_lba, buf, sb.block_bitmap_sects);
 
   /***************************************
    * 3 将inode位图初始化并写入sb.inode_bitmap_lba *
@@ -181,7 +184,7 @@ partition_format (struct partition* part) {
    * 即inode_bitmap_sects等于1, 所以位图中的位全都代表inode_table中的inode,
    * 无须再像block_bitmap那样单独处理最后一扇区的剩余部分,
    * inode_bitmap所在的扇区中没有多余的无效位 */
-  ide_write (hd, sb.inode_bitmap_lba, buf, sb.inode_bitmap_sects);
+  bdev_write (bdev, sb.inode_bitmap_lba, buf, sb.inode_bitmap_sects);
 
   /***************************************
    * 4 将inode数组初始化并写入sb.inode_table_lba *
@@ -193,7 +196,7 @@ partition_format (struct partition* part) {
   i->i_no        = 0; // 根目录占inode数组中第0个inode
   i->i_sectors[0]=
       sb.data_start_lba; // 由于上面的memset,i_sectors数组的其它元素都初始化为0
-  ide_write (hd, sb.inode_table_lba, buf, sb.inode_table_sects);
+  bdev_write (bdev, sb.inode_table_lba, buf, sb.inode_table_sects);
 
   /***************************************
    * 5 将根目录初始化并写入sb.data_start_lba
@@ -214,7 +217,7 @@ partition_format (struct partition* part) {
   p_de->f_type= FT_DIRECTORY;
 
   /* sb.data_start_lba已经分配给了根目录,里面是根目录的目录项 */
-  ide_write (hd, sb.data_start_lba, buf, 1);
+  bdev_write (bdev, sb.data_start_lba, buf, 1);
 
   printk ("   root_dir_lba:0x%x\n", sb.data_start_lba);
   printk ("%s format done\n", part->name);
@@ -261,7 +264,8 @@ path_depth_cnt (char* pathname) {
   return depth;
 }
 
-/* 搜索文件pathname,若找到则返回其inode号,否则返回-1 */
+/* 搜索文件pathname,若找到则返回其inode号,否则返回-1.
+ * 调用者须持有cur_part->dir_lock的读锁或写锁 */
 static int
 search_file (const char* pathname, struct path_search_record* searched_record) {
   /* 如果待查找的是根目录,为避免下面无用的查找,直接返回已知根目录信息 */
@@ -334,8 +338,8 @@ search_file (const char* pathname, struct path_search_record* searched_record) {
 }
 
 /* 打开或创建文件成功后,返回文件描述符,否则返回-1 */
-int32_t
-sys_open (const char* pathname, uint8_t flags) {
+static int32_t
+open_locked (const char* pathname, uint8_t flags) {
   /* 对目录要用dir_open,这里只有open文件 */
   if (pathname[strlen (pathname) - 1] == '/') {
     printk ("can`t open a directory %s\n", pathname);
@@ -402,6 +406,23 @@ sys_open (const char* pathname, uint8_t flags) {
   return fd;
 }
 
+/* 打开或创建文件,创建时修改目录树需持写锁,只打开时持读锁即可 */
+int32_t
+sys_open (const char* pathname, uint8_t flags) {
+  int32_t fd;
+  if (flags & O_CREAT) {
+    rwlock_write_acquire (&cur_part->dir_lock);
+    fd= open_locked (pathname, flags);
+    rwlock_write_release (&cur_part->dir_lock);
+  }
+  else {
+    rwlock_read_acquire (&cur_part->dir_lock);
+    fd= open_locked (pathname, flags);
+    rwlock_read_release (&cur_part->dir_lock);
+  }
+  return fd;
+}
+
 /* 将文件描述符转化为文件表的下标 */
 static uint32_t
 fd_local2global (uint32_t local_fd) {
@@ -415,10 +436,17 @@ fd_local2global (uint32_t local_fd) {
 int32_t
 sys_close (int32_t fd) {
   int32_t ret= -1; // 返回值默认为-1,即失败
-  if (fd > 2) {
-    uint32_t _fd                   = fd_local2global (fd);
-    ret                            = file_close (&file_table[_fd]);
-    running_thread ()->fd_table[fd]= -1; // 使该文件描述符位可用
+  if (fd > 2 && fd < MAX_FILES_OPEN_PER_PROC) {
+    /* 先在关中断下摘下描述符再关闭文件,
+     * uring的worker可能同时关闭同一描述符,只有摘到的一方关闭 */
+    struct task_struct* cur       = running_thread ();
+    enum intr_status    old_status= intr_disable ();
+    int32_t             _fd       = cur->fd_table[fd];
+    cur->fd_table[fd]             = -1; // 使该文件描述符位可用
+    intr_set_status (old_status);
+    if (_fd != -1) {
+      ret= file_close (&file_table[_fd]);
+    }
   }
   return ret;
 }
@@ -462,6 +490,91 @@ sys_read (int32_t fd, void* buf, uint32_t count) {
   return file_read (&file_table[_fd], buf, count);
 }
 
+/* 取fd对应的可写文件,不可写时返回NULL */
+static struct file*
+fd_file_writable (int32_t fd) {
+  struct file* wr_file= &file_table[fd_local2global (fd)];
+  if (wr_file->fd_flag & O_WRONLY || wr_file->fd_flag & O_RDWR) {
+    return wr_file;
+  }
+  console_put_str ("not allowed to write file without flag O_RDWR "
+                   "or O_WRONLY\n");
+  return NULL;
+}
+
+/* 从fd中依次读出数据填满iov的iovcnt段,成功则返回读出的字节数,到文件尾则返回-1 */
+int32_t
+sys_readv (int32_t fd, const struct iovec* iov, uint32_t iovcnt) {
+  if (fd < 0 || fd == stdout_no || iovcnt > IOV_MAX) {
+    printk ("sys_readv: fd or iovcnt error\n");
+    return -1;
+  }
+  return file_readv (&file_table[fd_local2global (fd)], iov, iovcnt);
+}
+
+/* 把iov中iovcnt段数据依次写入fd,成功则返回写入的字节数,失败返回-1 */
+int32_t
+sys_writev (int32_t fd, const struct iovec* iov, uint32_t iovcnt) {
+  if (fd < 0 || iovcnt > IOV_MAX) {
+    printk ("sys_writev: fd or iovcnt error\n");
+    return -1;
+  }
+  if (fd == stdout_no) {
+    int32_t  bytes_written= 0;
+    uint32_t idx          = 0;
+    while (idx < iovcnt) {
+      bytes_written+= sys_write (fd, iov[idx].iov_base, iov[idx].iov_len);
+      idx++;
+    }
+    return bytes_written;
+  }
+  struct file* wr_file= fd_file_writable (fd);
+  if (wr_file == NULL) {
+    return -1;
+  }
+  return file_writev (wr_file, iov, iovcnt);
+}
+
+/* 从fd的offset处读count个字节到buf,不移动文件的读写位置,到文件尾则返回-1 */
+int32_t
+sys_pread (int32_t fd, void* buf, uint32_t count, uint32_t offset) {
+  if (fd < 0 || fd == stdout_no) {
+    printk ("sys_pread: fd error\n");
+    return -1;
+  }
+  struct iovec iov= {buf, count};
+  return file_pread (&file_table[fd_local2global (fd)], &iov, 1, offset);
+}
+
+/* 把buf中count个字节写到fd的offset处,不移动文件的读写位置,失败返回-1 */
+int32_t
+sys_pwrite (int32_t fd, const void* buf, uint32_t count, uint32_t offset) {
+  if (fd < 0 || fd == stdout_no) {
+    printk ("sys_pwrite: fd error\n");
+    return -1;
+  }
+  struct file* wr_file= fd_file_writable (fd);
+  if (wr_file == NULL) {
+    return -1;
+  }
+  struct iovec iov= {(void*) buf, count};
+  return file_pwrite (wr_file, &iov, 1, offset);
+}
+
+/* 把fd_in从当前位置起的len个字节追加到fd_out,返回复制的字节数,失败返回-1 */
+int32_t
+sys_copy_file_range (int32_t fd_in, int32_t fd_out, uint32_t len) {
+  if (fd_in <= stderr_no || fd_out <= stderr_no) { // 只支持普通文件
+    printk ("sys_copy_file_range: fd error\n");
+    return -1;
+  }
+  struct file* wr_file= fd_file_writable (fd_out);
+  if (wr_file == NULL) {
+    return -1;
+  }
+  return file_copy (&file_table[fd_local2global (fd_in)], wr_file, len);
+}
+
 /* 重置用于文件读写操作的偏移指针,成功时返回新的偏移量,出错时返回-1 */
 int32_t
 sys_lseek (int32_t fd, int32_t offset, uint8_t whence) {
@@ -497,8 +610,8 @@ sys_lseek (int32_t fd, int32_t offset, uint8_t whence) {
 }
 
 /* 删除文件(非目录),成功返回0,失败返回-1 */
-int32_t
-sys_unlink (const char* pathname) {
+static int32_t
+unlink_locked (const char* pathname) {
   ASSERT (strlen (pathname) < MAX_PATH_LEN);
 
   /* 先检查待删除的文件是否存在 */
@@ -549,9 +662,18 @@ sys_unlink (const char* pathname) {
   return 0; // 成功删除文件
 }
 
-/* 创建目录pathname,成功返回0,失败返回-1 */
+/* 删除文件要修改目录树,须持写锁 */
 int32_t
-sys_mkdir (const char* pathname) {
+sys_unlink (const char* pathname) {
+  rwlock_write_acquire (&cur_part->dir_lock);
+  int32_t ret= unlink_locked (pathname);
+  rwlock_write_release (&cur_part->dir_lock);
+  return ret;
+}
+
+/* 创建目录pathname,成功返回0,失败返回-1 */
+static int32_t
+mkdir_locked (const char* pathname) {
   uint8_t rollback_step= 0; // 用于操作失败时回滚各资源状态
   void*   io_buf       = sys_malloc (SECTOR_SIZE * 2);
   if (io_buf == NULL) {
@@ -626,7 +748,7 @@ sys_mkdir (const char* pathname) {
   memcpy (p_de->filename, "..", 2);
   p_de->i_no  = parent_dir->inode->i_no;
   p_de->f_type= FT_DIRECTORY;
-  ide_write (cur_part->my_disk, new_dir_inode.i_sectors[0], io_buf, 1);
+  bdev_write (cur_part->bdev, new_dir_inode.i_sectors[0], io_buf, 1);
 
   new_dir_inode.i_size= 2 * cur_part->sb->dir_entry_size;
 
@@ -676,6 +798,15 @@ rollback: // 因为某步骤操作失败而回滚
   return -1;
 }
 
+/* 创建目录要修改目录树,须持写锁 */
+int32_t
+sys_mkdir (const char* pathname) {
+  rwlock_write_acquire (&cur_part->dir_lock);
+  int32_t ret= mkdir_locked (pathname);
+  rwlock_write_release (&cur_part->dir_lock);
+  return ret;
+}
+
 /* 目录打开成功后返回目录指针,失败返回NULL */
 struct dir*
 sys_opendir (const char* name) {
@@ -688,6 +819,7 @@ sys_opendir (const char* name) {
   /* 先检查待打开的目录是否存在 */
   struct path_search_record searched_record;
   memset (&searched_record, 0, sizeof (struct path_search_record));
+  rwlock_read_acquire (&cur_part->dir_lock);
   int         inode_no= search_file (name, &searched_record);
   struct dir* ret     = NULL;
   if (inode_no == -1) { // 如果找不到目录,提示不存在的路径
@@ -703,6 +835,7 @@ sys_opendir (const char* name) {
     }
   }
   dir_close (searched_record.parent_dir);
+  rwlock_read_release (&cur_part->dir_lock);
   return ret;
 }
 
@@ -731,8 +864,8 @@ sys_rewinddir (struct dir* dir) {
 }
 
 /* 删除空目录,成功时返回0,失败时返回-1*/
-int32_t
-sys_rmdir (const char* pathname) {
+static int32_t
+rmdir_locked (const char* pathname) {
   /* 先检查待删除的文件是否存在 */
   struct path_search_record searched_record;
   memset (&searched_record, 0, sizeof (struct path_search_record));
@@ -766,6 +899,15 @@ sys_rmdir (const char* pathname) {
   return retval;
 }
 
+/* 删除目录要修改目录树,须持写锁 */
+int32_t
+sys_rmdir (const char* pathname) {
+  rwlock_write_acquire (&cur_part->dir_lock);
+  int32_t ret= rmdir_locked (pathname);
+  rwlock_write_release (&cur_part->dir_lock);
+  return ret;
+}
+
 /* 获得父目录的inode编号 */
 static uint32_t
 get_parent_dir_inode_nr (uint32_t child_inode_nr, void* io_buf) {
@@ -774,7 +916,7 @@ get_parent_dir_inode_nr (uint32_t child_inode_nr, void* io_buf) {
   uint32_t block_lba= child_dir_inode->i_sectors[0];
   ASSERT (block_lba >= cur_part->sb->data_start_lba);
   inode_close (child_dir_inode);
-  ide_read (cur_part->my_disk, block_lba, io_buf, 1);
+  bdev_read (cur_part->bdev, block_lba, io_buf, 1);
   struct dir_entry* dir_e= (struct dir_entry*) io_buf;
   /* 第0个目录项是".",第1个目录项是".." */
   ASSERT (dir_e[1].i_no < 4096 && dir_e[1].f_type == FT_DIRECTORY);
@@ -796,8 +938,8 @@ get_child_dir_name (uint32_t p_inode_nr, uint32_t c_inode_nr, char* path,
   }
   if (parent_dir_inode
           ->i_sectors[12]) { // 若包含了一级间接块表,将共读入all_blocks.
-    ide_read (cur_part->my_disk, parent_dir_inode->i_sectors[12],
-              all_blocks + 12, 1);
+    bdev_read (cur_part->bdev, parent_dir_inode->i_sectors[12],
+               all_blocks + 12, 1);
     block_cnt= 140;
   }
   inode_close (parent_dir_inode);
@@ -809,7 +951,7 @@ get_child_dir_name (uint32_t p_inode_nr, uint32_t c_inode_nr, char* path,
   /* 遍历所有块 */
   while (block_idx < block_cnt) {
     if (all_blocks[block_idx]) { // 如果相应块不为空则读入相应块
-      ide_read (cur_part->my_disk, all_blocks[block_idx], io_buf, 1);
+      bdev_read (cur_part->bdev, all_blocks[block_idx], io_buf, 1);
       uint8_t dir_e_idx= 0;
       /* 遍历每个目录项 */
       while (dir_e_idx < dir_entrys_per_sec) {
@@ -856,15 +998,18 @@ sys_getcwd (char* buf, uint32_t size) {
   /* 从下往上逐层找父目录,直到找到根目录为止.
    * 当child_inode_nr为根目录的inode编号(0)时停止,
    * 即已经查看完根目录中的目录项 */
+  rwlock_read_acquire (&cur_part->dir_lock);
   while ((child_inode_nr)) {
     parent_inode_nr= get_parent_dir_inode_nr (child_inode_nr, io_buf);
     if (get_child_dir_name (parent_inode_nr, child_inode_nr, full_path_reverse,
                             io_buf) == -1) { // 或未找到名字,失败退出
+      rwlock_read_release (&cur_part->dir_lock);
       sys_free (io_buf);
       return NULL;
     }
     child_inode_nr= parent_inode_nr;
   }
+  rwlock_read_release (&cur_part->dir_lock);
   ASSERT (strlen (full_path_reverse) <= size);
   /* 至此full_path_reverse中的路径是反着的,
    * 即子目录在前(左),父目录在后(右) ,
@@ -887,6 +1032,7 @@ sys_chdir (const char* path) {
   int32_t                   ret= -1;
   struct path_search_record searched_record;
   memset (&searched_record, 0, sizeof (struct path_search_record));
+  rwlock_read_acquire (&cur_part->dir_lock);
   int inode_no= search_file (path, &searched_record);
   if (inode_no != -1) {
     if (searched_record.file_type == FT_DIRECTORY) {
@@ -898,6 +1044,7 @@ sys_chdir (const char* path) {
     }
   }
   dir_close (searched_record.parent_dir);
+  rwlock_read_release (&cur_part->dir_lock);
   return ret;
 }
 
@@ -919,6 +1066,7 @@ sys_stat (const char* path, struct stat* buf) {
       &searched_record, 0,
       sizeof (struct
               path_search_record)); // 记得初始化或清0,否则栈中信息不知道是什么
+  rwlock_read_acquire (&cur_part->dir_lock);
   int inode_no= search_file (path, &searched_record);
 
   if (inode_no != -1) {
@@ -934,14 +1082,13 @@ sys_stat (const char* path, struct stat* buf) {
     printk ("sys_stat: %s not found\n", path);
   }
   dir_close (searched_record.parent_dir);
+  rwlock_read_release (&cur_part->dir_lock);
   return ret;
 }
 
 /* 在磁盘上搜索文件系统,若没有则格式化分区创建文件系统 */
 void
 filesys_init () {
-  uint8_t channel_no= 0, dev_no, part_idx= 0;
-
   /* sb_buf用来存储从硬盘上读入的超级块 */
   struct super_block* sb_buf= (struct super_block*) sys_malloc (SECTOR_SIZE);
 
@@ -949,46 +1096,26 @@ filesys_init () {
     PANIC ("alloc memory failed!");
   }
   printk ("searching filesystem......\n");
-  while (channel_no < channel_cnt) {
-    dev_no= 0;
-    while (dev_no < 2) {
-      if (dev_no == 0) { // 跨过裸盘hd60M.img
-        dev_no++;
-        continue;
-      }
-      struct disk*      hd  = &channels[channel_no].devices[dev_no];
-      struct partition* part= hd->prim_parts;
-      while (part_idx < 12) { // 4个主分区+8个逻辑
-        if (part_idx == 4) {  // 开始处理逻辑分区
-          part= hd->logic_parts;
-        }
+  /* partition_list中是各块设备上扫描到的分区,与设备的驱动无关,
+   * 裸盘hd60M.img不扫描分区,不会出现. 内存盘ram1每次启动都是空的,在此格式化 */
+  struct list_elem* elem= partition_list.head.next;
+  while (elem != &partition_list.tail) {
+    struct partition*    part= elem2entry (struct partition, part_tag, elem);
+    struct block_device* bdev= part->bdev;
+    memset (sb_buf, 0, SECTOR_SIZE);
 
-        /* channels数组是全局变量,默认值为0,disk属于其嵌套结构,
-         * partition又为disk的嵌套结构,因此partition中的成员默认也为0.
-         * 若partition未初始化,则partition中的成员仍为0.
-         * 下面处理存在的分区. */
-        if (part->sec_cnt != 0) { // 如果分区存在
-          memset (sb_buf, 0, SECTOR_SIZE);
-
-          /* 读出分区的超级块,根据魔数是否正确来判断是否存在文件系统 */
-          ide_read (hd, part->start_lba + 1, sb_buf, 1);
-
-          /* 只支持自己的文件系统.若磁盘上已经有文件系统就不再格式化了 */
-          if (sb_buf->magic == 0x19590318) {
-            printk ("%s has filesystem\n", part->name);
-          }
-          else { // 其它文件系统不支持,一律按无文件系统处理
-            printk ("formatting %s`s partition %s......\n", hd->name,
-                    part->name);
-            partition_format (part);
-          }
-        }
-        part_idx++;
-        part++; // 下一分区
-      }
-      dev_no++; // 下一磁盘
+    /* 读出分区的超级块,根据魔数是否正确来判断是否存在文件系统 */
+    bdev_read (bdev, part->start_lba + 1, sb_buf, 1);
+
+    /* 只支持自己的文件系统.若磁盘上已经有文件系统就不再格式化了 */
+    if (sb_buf->magic == 0x19590318) {
+      printk ("%s has filesystem\n", part->name);
+    }
+    else { // 其它文件系统不支持,一律按无文件系统处理
+      printk ("formatting %s`s partition %s......\n", bdev->name, part->name);
+      partition_format (part);
     }
-    channel_no++; // 下一通道
+    elem= elem->next; // 下一分区
   }
   sys_free (sb_buf);
 
@@ -1005,4 +1132,5 @@ filesys_init () {
   while (fd_idx < MAX_FILE_OPEN) {
     file_table[fd_idx++].fd_inode= NULL;
   }
+  wait_queue_init (&file_idle_wait);
 }
@@ -35,6 +35,14 @@ struct path_search_record {
       file_type; // 找到的是普通文件还是目录,找不到将为未知类型(FT_UNKNOWN)
 };
 
+#define IOV_MAX 16 // readv和writev一次最多的数据段数
+
+/* readv和writev中的一段数据 */
+struct iovec {
+  void*    iov_base;
+  uint32_t iov_len;
+};
+
 /* 文件属性结构体 */
 struct stat {
   uint32_t        st_ino;      // inode编号
@@ -49,6 +57,12 @@ int32_t           sys_open (const char* pathname, uint8_t flags);
 int32_t           sys_close (int32_t fd);
 int32_t           sys_write (int32_t fd, const void* buf, uint32_t count);
 int32_t           sys_read (int32_t fd, void* buf, uint32_t count);
+int32_t sys_readv (int32_t fd, const struct iovec* iov, uint32_t iovcnt);
+int32_t sys_writev (int32_t fd, const struct iovec* iov, uint32_t iovcnt);
+int32_t sys_pread (int32_t fd, void* buf, uint32_t count, uint32_t offset);
+int32_t sys_pwrite (int32_t fd, const void* buf, uint32_t count,
+                    uint32_t offset);
+int32_t sys_copy_file_range (int32_t fd_in, int32_t fd_out, uint32_t len);
 int32_t           sys_lseek (int32_t fd, int32_t offset, uint8_t whence);
 int32_t           sys_unlink (const char* pathname);
 int32_t           sys_mkdir (const char* pathname);
@@ -69,38 +69,66 @@ inode_sync (struct partition* part, struct inode* inode,
   if (inode_pos.two_sec) { // 若是跨了两个扇区,就要读出两个扇区再写入两个扇区
     /* 读写硬盘是以扇区为单位,若写入的数据小于一扇区,要将原硬盘上的内容先读出来再和新数据拼成一扇区后再写入
      */
-    ide_read (part->my_disk, inode_pos.sec_lba, inode_buf,
-              2); // inode在format中写入硬盘时是连续写入的,所以读入2块扇区
+    bdev_read (part->bdev, inode_pos.sec_lba, inode_buf,
+               2); // inode在format中写入硬盘时是连续写入的,所以读入2块扇区
 
     /* 开始将待写入的inode拼入到这2个扇区中的相应位置 */
     memcpy ((inode_buf + inode_pos.off_size), &pure_inode,
             sizeof (struct inode));
 
     /* 将拼接好的数据再写入磁盘 */
-    ide_write (part->my_disk, inode_pos.sec_lba, inode_buf, 2);
+    bdev_write (part->bdev, inode_pos.sec_lba, inode_buf, 2);
   }
   else { // 若只是一个扇区
-    ide_read (part->my_disk, inode_pos.sec_lba, inode_buf, 1);
+    bdev_read (part->bdev, inode_pos.sec_lba, inode_buf, 1);
     memcpy ((inode_buf + inode_pos.off_size), &pure_inode,
             sizeof (struct inode));
-    ide_write (part->my_disk, inode_pos.sec_lba, inode_buf, 1);
+    bdev_write (part->bdev, inode_pos.sec_lba, inode_buf, 1);
   }
 }
 
-/* 根据i结点号返回相应的i结点 */
-struct inode*
-inode_open (struct partition* part, uint32_t inode_no) {
-  /* 先在已打开inode链表中找inode,此链表是为提速创建的缓冲区 */
+/* 在已打开inode链表中查找inode并增加其打开数,调用者须持有part->inode_lock */
+static struct inode*
+inode_cache_get (struct partition* part, uint32_t inode_no) {
   struct list_elem* elem= part->open_inodes.head.next;
-  struct inode*     inode_found;
   while (elem != &part->open_inodes.tail) {
-    inode_found= elem2entry (struct inode, inode_tag, elem);
-    if (inode_found->i_no == inode_no) {
-      inode_found->i_open_cnts++;
-      return inode_found;
+    struct inode* inode= elem2entry (struct inode, inode_tag, elem);
+    if (inode->i_no == inode_no) {
+      /* 持读锁的任务可能同时增加打开数,关中断保证原子 */
+      enum intr_status old_status= intr_disable ();
+      inode->i_open_cnts++;
+      intr_set_status (old_status);
+      return inode;
     }
     elem= elem->next;
   }
+  return NULL;
+}
+
+/* 释放位于内核空间的inode */
+static void
+inode_free (struct inode* inode) {
+  /* inode_open时为实现inode被所有进程共享,
+   * 已经在sys_malloc为inode分配了内核空间,
+   * 释放inode时也要确保释放的是内核内存池 */
+  struct task_struct* cur            = running_thread ();
+  uint32_t*           cur_pagedir_bak= cur->pgdir;
+  cur->pgdir                         = NULL;
+  sys_free (inode);
+  cur->pgdir= cur_pagedir_bak;
+}
+
+/* 根据i结点号返回相应的i结点 */
+struct inode*
+inode_open (struct partition* part, uint32_t inode_no) {
+  /* 先在已打开inode链表中找inode,此链表是为提速创建的缓冲区.
+   * 查找只需读锁,多个任务可以同时查找 */
+  rwlock_read_acquire (&part->inode_lock);
+  struct inode* inode_found= inode_cache_get (part, inode_no);
+  rwlock_read_release (&part->inode_lock);
+  if (inode_found != NULL) {
+    return inode_found;
+  }
 
   /*由于open_inodes链表中找不到,下面从硬盘上读入此inode并加入到此链表 */
   struct inode_position inode_pos;
@@ -125,19 +153,28 @@ inode_open (struct partition* part, uint32_t inode_no) {
 
     /* i结点表是被partition_format函数连续写入扇区的,
      * 所以下面可以连续读出来 */
-    ide_read (part->my_disk, inode_pos.sec_lba, inode_buf, 2);
+    bdev_read (part->bdev, inode_pos.sec_lba, inode_buf, 2);
   }
   else { // 否则,所查找的inode未跨扇区,一个扇区大小的缓冲区足够
     inode_buf= (char*) sys_malloc (512);
-    ide_read (part->my_disk, inode_pos.sec_lba, inode_buf, 1);
+    bdev_read (part->bdev, inode_pos.sec_lba, inode_buf, 1);
   }
   memcpy (inode_found, inode_buf + inode_pos.off_size, sizeof (struct inode));
+  sys_free (inode_buf);
+
+  /* 读盘时未持锁,其它任务可能已经把此inode加入了链表,以链表中的为准 */
+  rwlock_write_acquire (&part->inode_lock);
+  struct inode* inode_cached= inode_cache_get (part, inode_no);
+  if (inode_cached != NULL) {
+    rwlock_write_release (&part->inode_lock);
+    inode_free (inode_found);
+    return inode_cached;
+  }
 
   /* 因为一会很可能要用到此inode,故将其插入到队首便于提前检索到 */
   list_push (&part->open_inodes, &inode_found->inode_tag);
   inode_found->i_open_cnts= 1;
-
-  sys_free (inode_buf);
+  rwlock_write_release (&part->inode_lock);
   return inode_found;
 }
 
@@ -145,19 +182,12 @@ inode_open (struct partition* part, uint32_t inode_no) {
 void
 inode_close (struct inode* inode) {
   /* 若没有进程再打开此文件,将此inode去掉并释放空间 */
-  enum intr_status old_status= intr_disable ();
+  rwlock_write_acquire (&cur_part->inode_lock);
   if (--inode->i_open_cnts == 0) {
     list_remove (&inode->inode_tag); // 将I结点从part->open_inodes中去掉
-    /* inode_open时为实现inode被所有进程共享,
-     * 已经在sys_malloc为inode分配了内核空间,
-     * 释放inode时也要确保释放的是内核内存池 */
-    struct task_struct* cur            = running_thread ();
-    uint32_t*           cur_pagedir_bak= cur->pgdir;
-    cur->pgdir                         = NULL;
-    sys_free (inode);
-    cur->pgdir= cur_pagedir_bak;
+    inode_free (inode);
   }
-  intr_set_status (old_status);
+  rwlock_write_release (&cur_part->inode_lock);
 }
 
 /* 将硬盘分区part上的inode清空 */
@@ -171,19 +201,19 @@ inode_delete (struct partition* part, uint32_t inode_no, void* io_buf) {
   char* inode_buf= (char*) io_buf;
   if (inode_pos.two_sec) { // inode跨扇区,读入2个扇区
     /* 将原硬盘上的内容先读出来 */
-    ide_read (part->my_disk, inode_pos.sec_lba, inode_buf, 2);
+    bdev_read (part->bdev, inode_pos.sec_lba, inode_buf, 2);
     /* 将inode_buf清0 */
     memset ((inode_buf + inode_pos.off_size), 0, sizeof (struct inode));
     /* 用清0的内存数据覆盖磁盘 */
-    ide_write (part->my_disk, inode_pos.sec_lba, inode_buf, 2);
+    bdev_write (part->bdev, inode_pos.sec_lba, inode_buf, 2);
   }
   else { // 未跨扇区,只读入1个扇区就好
     /* 将原硬盘上的内容先读出来 */
-    ide_read (part->my_disk, inode_pos.sec_lba, inode_buf, 1);
+    bdev_read (part->bdev, inode_pos.sec_lba, inode_buf, 1);
     /* 将inode_buf清0 */
     memset ((inode_buf + inode_pos.off_size), 0, sizeof (struct inode));
     /* 用清0的内存数据覆盖磁盘 */
-    ide_write (part->my_disk, inode_pos.sec_lba, inode_buf, 1);
+    bdev_write (part->bdev, inode_pos.sec_lba, inode_buf, 1);
   }
 }
 
@@ -207,7 +237,7 @@ inode_release (struct partition* part, uint32_t inode_no) {
   /* b 如果一级间接块表存在,将其128个间接块读到all_blocks[12~],
    * 并释放一级间接块表所占的扇区 */
   if (inode_to_del->i_sectors[12] != 0) {
-    ide_read (part->my_disk, inode_to_del->i_sectors[12], all_blocks + 12, 1);
+    bdev_read (part->bdev, inode_to_del->i_sectors[12], all_blocks + 12, 1);
     block_cnt= 140;
 
     /* 回收一级间接块表占用的扇区 */
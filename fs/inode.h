@@ -1,7 +1,7 @@
 #ifndef __FS_INODE_H
 #define __FS_INODE_H
-#include "ide.h"
 #include "list.h"
+#include "partition.h"
 #include "stdint.h"
 
 /* inode结构 */
@@ -0,0 +1,297 @@
+#include "uring.h"
+#include "file.h"
+#include "fs.h"
+#include "interrupt.h"
+#include "memory.h"
+#include "process.h"
+#include "string.h"
+
+/* fd是否为pthread中已打开的文件描述符 */
+static bool
+uring_fd_valid (struct task_struct* pthread, int32_t fd) {
+  return fd >= 0 && fd < MAX_FILES_OPEN_PER_PROC && pthread->fd_table[fd] != -1;
+}
+
+/* 清空worker借来的文件描述符,只留下标准输入输出 */
+static void
+uring_fd_reset (struct task_struct* worker) {
+  uint8_t fd_idx= 3;
+  while (fd_idx < MAX_FILES_OPEN_PER_PROC) {
+    worker->fd_table[fd_idx]= -1;
+    fd_idx++;
+  }
+}
+
+/* 把worker中open得到的文件描述符fd转给owner,owner已无空位时关闭文件 */
+static int32_t
+uring_fd_install (struct task_struct* owner, struct task_struct* worker,
+                  int32_t fd) {
+  enum intr_status old_status= intr_disable ();
+  int32_t          fd_idx    = 3;
+  while (fd_idx < MAX_FILES_OPEN_PER_PROC && owner->fd_table[fd_idx] != -1) {
+    fd_idx++;
+  }
+  if (fd_idx < MAX_FILES_OPEN_PER_PROC) {
+    owner->fd_table[fd_idx]= worker->fd_table[fd];
+    worker->fd_table[fd]   = -1;
+  }
+  intr_set_status (old_status);
+
+  if (fd_idx == MAX_FILES_OPEN_PER_PROC) {
+    sys_close (fd);
+    return -1;
+  }
+  return fd_idx;
+}
+
+/**
+ * 关闭前从owner中摘下描述符fd,摘到才由worker关闭. worker执行前复制的是
+ * owner的快照,期间owner可能已关闭fd并把这个位置给了新打开的文件,
+ * 所以须在关中断下确认owner的fd仍指向同一全局描述符.
+ */
+static bool
+uring_fd_claim (struct task_struct* owner, struct task_struct* worker,
+                int32_t fd) {
+  enum intr_status old_status= intr_disable ();
+  bool             claimed   = owner->fd_table[fd] == worker->fd_table[fd];
+  if (claimed) {
+    owner->fd_table[fd]= -1;
+  }
+  intr_set_status (old_status);
+  return claimed;
+}
+
+/**
+ * 读写等操作前让owner的文件在操作期间不被关闭,owner的fd仍指向worker快照中
+ * 的全局描述符时才加引用并返回true,此后owner的close会等到uring_file_put
+ */
+static bool
+uring_file_get (struct task_struct* owner, struct task_struct* worker,
+                int32_t fd) {
+  enum intr_status old_status= intr_disable ();
+  bool             same      = owner->fd_table[fd] == worker->fd_table[fd];
+  if (same) {
+    file_pin (&file_table[worker->fd_table[fd]]);
+  }
+  intr_set_status (old_status);
+  return same;
+}
+
+static void
+uring_file_put (struct task_struct* worker, int32_t fd) {
+  file_unpin (&file_table[worker->fd_table[fd]]);
+}
+
+/**
+ * 在worker中执行一个提交项,返回值同对应的同步系统调用.
+ * 执行前借用owner的文件描述符和工作目录,执行后再归还.
+ */
+static int32_t
+uring_do (struct uring* ur, struct uring_sqe* sqe) {
+  struct task_struct* worker= running_thread ();
+  struct task_struct* owner = ur->owner;
+
+  enum intr_status old_status= intr_disable ();
+  memcpy (worker->fd_table, owner->fd_table, sizeof (worker->fd_table));
+  worker->cwd_inode_nr= owner->cwd_inode_nr;
+  intr_set_status (old_status);
+
+  int32_t res= -1;
+  switch (sqe->opcode) {
+  case URING_OP_NOP:
+    res= 0;
+    break;
+  case URING_OP_OPEN:
+    res= sys_open (sqe->addr, sqe->flags);
+    if (res != -1) {
+      res= uring_fd_install (owner, worker, res);
+    }
+    break;
+  case URING_OP_CLOSE:
+    if (uring_fd_valid (worker, sqe->fd)
+        && uring_fd_claim (owner, worker, sqe->fd)) {
+      res= sys_close (sqe->fd);
+    }
+    break;
+  case URING_OP_READ:
+    if (uring_fd_valid (worker, sqe->fd)
+        && uring_file_get (owner, worker, sqe->fd)) {
+      res= sys_read (sqe->fd, sqe->addr, sqe->len);
+      uring_file_put (worker, sqe->fd);
+    }
+    break;
+  case URING_OP_WRITE:
+    if (uring_fd_valid (worker, sqe->fd)
+        && uring_file_get (owner, worker, sqe->fd)) {
+      res= sys_write (sqe->fd, sqe->addr, sqe->len);
+      uring_file_put (worker, sqe->fd);
+    }
+    break;
+  case URING_OP_LSEEK:
+    if (uring_fd_valid (worker, sqe->fd)
+        && uring_file_get (owner, worker, sqe->fd)) {
+      res= sys_lseek (sqe->fd, sqe->off, sqe->flags);
+      uring_file_put (worker, sqe->fd);
+    }
+    break;
+  case URING_OP_STAT:
+    res= sys_stat (sqe->addr, sqe->addr2);
+    break;
+  case URING_OP_UNLINK:
+    res= sys_unlink (sqe->addr);
+    break;
+  case URING_OP_MKDIR:
+    res= sys_mkdir (sqe->addr);
+    break;
+  }
+
+  uring_fd_reset (worker);
+  return res;
+}
+
+/**
+ * worker线程,依次取出提交项执行并写入完成项.
+ * 它借用owner的页目录,所以能直接访问环和用户缓冲区.
+ */
+static void
+uring_worker (void* arg) {
+  struct uring*       ur    = arg;
+  struct uring_ring*  ring  = ur->ring;
+  struct task_struct* worker= running_thread ();
+
+  worker->borrowed_pgdir= ur->owner->pgdir;
+  page_dir_activate (worker);
+
+  intr_disable ();
+  while (!ur->stopping) {
+    /* 完成队列满时先不取新的提交项,等用户消费后由sys_uring_enter唤醒 */
+    if (ring->sq_head == ring->sq_tail ||
+        ring->cq_tail - ring->cq_head >= URING_CQ_ENTRIES) {
+      wait_queue_wait (&ur->sq_wait, true, 0);
+      continue;
+    }
+    struct uring_sqe sqe= ring->sqes[ring->sq_head & (URING_SQ_ENTRIES - 1)];
+    ring->sq_head++;
+    ur->busy= true;
+
+    intr_enable ();
+    int32_t res= uring_do (ur, &sqe);
+    intr_disable ();
+
+    struct uring_cqe* cqe= &ring->cqes[ring->cq_tail & (URING_CQ_ENTRIES - 1)];
+    cqe->user_data= sqe.user_data;
+    cqe->res      = res;
+    ring->cq_tail++;
+    ur->busy= false;
+    wait_queue_wake_all (&ur->cq_wait);
+  }
+
+  /* 先换回内核页目录,此后owner就可以释放用户空间了 */
+  worker->borrowed_pgdir= NULL;
+  page_dir_activate (worker);
+  ur->worker= NULL;
+  wait_queue_wake_all (&ur->cq_wait);
+  thread_exit (0);
+}
+
+/**
+ * 为当前进程建立异步I/O环,返回用户空间中环的地址,失败返回NULL.
+ * 每个进程只有一个环,重复调用返回同一个环.
+ */
+struct uring_ring*
+sys_uring_setup (void) {
+  struct task_struct* cur= running_thread ();
+  if (cur->pgdir == NULL) { // 内核线程直接调用同步接口即可
+    return NULL;
+  }
+  if (cur->uring != NULL) {
+    return cur->uring->ring;
+  }
+
+  uint32_t pg_cnt= DIV_ROUND_UP (sizeof (struct uring_ring), PG_SIZE);
+  struct uring_ring* ring= get_user_pages (pg_cnt);
+  if (ring == NULL) {
+    return NULL;
+  }
+  struct uring* ur= get_kernel_pages (1);
+  if (ur == NULL) {
+    mfree_page (PF_USER, ring, pg_cnt);
+    return NULL;
+  }
+  ur->owner= cur;
+  ur->ring = ring;
+  wait_queue_init (&ur->sq_wait);
+  wait_queue_init (&ur->cq_wait);
+  ur->sq_wait.reason= BLOCK_IDLE;
+  ur->cq_wait.reason= BLOCK_IO;
+  cur->uring        = ur;
+
+  ur->worker= thread_start ("uring", cur->base_priority, uring_worker, ur);
+  /* worker不是用户可见的子任务,不能被wait回收,退出时交给reaper */
+  ur->worker->parent_pid= 0;
+  return ring;
+}
+
+/* 没有待执行和正在执行的提交项,或worker已因完成队列满而停下,调用时须关中断 */
+static bool
+uring_idle (struct uring* ur) {
+  struct uring_ring* ring= ur->ring;
+  if (ur->busy) {
+    return false;
+  }
+  return ring->sq_head == ring->sq_tail ||
+         ring->cq_tail - ring->cq_head >= URING_CQ_ENTRIES;
+}
+
+/**
+ * 通知内核新提交了to_submit项,并等到至少有min_complete个完成项.
+ * 没有可等的提交项时提前返回.返回当前可读的完成项个数,失败返回-1.
+ */
+int32_t
+sys_uring_enter (uint32_t to_submit, uint32_t min_complete) {
+  struct uring* ur= running_thread ()->uring;
+  if (ur == NULL) {
+    return -1;
+  }
+  struct uring_ring* ring= ur->ring;
+
+  enum intr_status old_status= intr_disable ();
+  if (ring->sq_tail - ring->sq_head > URING_SQ_ENTRIES) {
+    intr_set_status (old_status);
+    return -1;
+  }
+  /* 有新的提交项,或用户消费了完成项腾出了空间 */
+  if (to_submit != 0 || ring->cq_tail - ring->cq_head < URING_CQ_ENTRIES) {
+    wait_queue_wake (&ur->sq_wait, 1);
+  }
+  if (min_complete > URING_CQ_ENTRIES) {
+    min_complete= URING_CQ_ENTRIES;
+  }
+  while (ring->cq_tail - ring->cq_head < min_complete && !uring_idle (ur)) {
+    wait_queue_wait (&ur->cq_wait, false, 0);
+  }
+  int32_t ready= ring->cq_tail - ring->cq_head;
+  intr_set_status (old_status);
+  return ready;
+}
+
+/**
+ * 进程退出时停止worker并释放环,须在关闭文件和释放用户空间之前调用.
+ * 环所在的用户页随用户空间一起释放.
+ */
+void
+uring_exit (struct task_struct* pthread) {
+  struct uring* ur= pthread->uring;
+  if (ur == NULL) {
+    return;
+  }
+  enum intr_status old_status= intr_disable ();
+  ur->stopping= true;
+  wait_queue_wake_all (&ur->sq_wait);
+  while (ur->worker != NULL) { // 等worker执行完手上的提交项
+    wait_queue_wait (&ur->cq_wait, false, 0);
+  }
+  pthread->uring= NULL;
+  intr_set_status (old_status);
+  mfree_kernel_pages (ur, 1);
+}
@@ -0,0 +1,70 @@
+#ifndef __FS_URING_H
+#define __FS_URING_H
+#include "global.h"
+#include "stdint.h"
+#include "sync.h"
+#include "thread.h"
+
+#define URING_SQ_ENTRIES 32 // 提交队列的项数,须为2的幂
+#define URING_CQ_ENTRIES 64 // 完成队列的项数,须为2的幂
+
+/* 提交项支持的操作 */
+enum uring_op {
+  URING_OP_NOP,
+  URING_OP_OPEN,   // sys_open (addr, flags)
+  URING_OP_CLOSE,  // sys_close (fd)
+  URING_OP_READ,   // sys_read (fd, addr, len)
+  URING_OP_WRITE,  // sys_write (fd, addr, len)
+  URING_OP_LSEEK,  // sys_lseek (fd, off, flags)
+  URING_OP_STAT,   // sys_stat (addr, addr2)
+  URING_OP_UNLINK, // sys_unlink (addr)
+  URING_OP_MKDIR   // sys_mkdir (addr)
+};
+
+/* 提交项,各字段的含义随操作而定 */
+struct uring_sqe {
+  uint8_t  opcode;
+  uint8_t  flags; // open的flags或lseek的whence
+  int32_t  fd;
+  void*    addr;  // 路径或读写缓冲区
+  void*    addr2; // stat的结果缓冲区
+  uint32_t len;
+  int32_t  off;
+  uint32_t user_data; // 原样带回完成项
+};
+
+/* 完成项 */
+struct uring_cqe {
+  uint32_t user_data;
+  int32_t  res; // 对应同步系统调用的返回值
+};
+
+/**
+ * 与用户进程共享的提交队列和完成队列,位于进程的用户空间.
+ * 下标只增不减,取模后得到槽位.
+ * 用户写sq_tail和cq_head,内核写sq_head和cq_tail.
+ */
+struct uring_ring {
+  volatile uint32_t sq_head;
+  volatile uint32_t sq_tail;
+  volatile uint32_t cq_head;
+  volatile uint32_t cq_tail;
+  struct uring_sqe  sqes[URING_SQ_ENTRIES];
+  struct uring_cqe  cqes[URING_CQ_ENTRIES];
+};
+
+/* 进程的异步I/O环,内核私有 */
+struct uring {
+  struct task_struct* owner;
+  struct uring_ring*  ring;
+  struct task_struct* worker;  // 代owner执行提交项的内核线程,退出后为NULL
+  struct wait_queue   sq_wait; // worker在此等待新的提交
+  struct wait_queue   cq_wait; // owner在此等待完成
+  bool                busy;    // worker正在执行提交项
+  bool                stopping;
+};
+
+struct uring_ring* sys_uring_setup (void);
+int32_t sys_uring_enter (uint32_t to_submit, uint32_t min_complete);
+void    uring_exit (struct task_struct* pthread);
+#endif
@@ -42,9 +42,16 @@
 #define SELECTOR_U_CODE ((5 << 3) + (TI_GDT << 2) + RPL3)
 #define SELECTOR_U_DATA ((6 << 3) + (TI_GDT << 2) + RPL3)
 #define SELECTOR_U_STACK SELECTOR_U_DATA
+/* sysenter/sysexit要求内核代码段,内核数据段,用户代码段,用户数据段依次相邻,
+ * 第7至10个描述符专供它们使用 */
+#define SELECTOR_SYSENTER_CS ((7 << 3) + (TI_GDT << 2) + RPL0)
 
 #define GDT_ATTR_HIGH                                                          \
   ((DESC_G_4K << 7) + (DESC_D_32 << 6) + (DESC_L << 5) + (DESC_AVL << 4))
+#define GDT_CODE_ATTR_LOW_DPL0                                                 \
+  ((DESC_P << 7) + (DESC_DPL_0 << 5) + (DESC_S_CODE << 4) + DESC_TYPE_CODE)
+#define GDT_DATA_ATTR_LOW_DPL0                                                 \
+  ((DESC_P << 7) + (DESC_DPL_0 << 5) + (DESC_S_DATA << 4) + DESC_TYPE_DATA)
 #define GDT_CODE_ATTR_LOW_DPL3                                                 \
   ((DESC_P << 7) + (DESC_DPL_3 << 5) + (DESC_S_CODE << 4) + DESC_TYPE_CODE)
 #define GDT_DATA_ATTR_LOW_DPL3                                                 \
@@ -83,6 +90,7 @@ struct gdt_desc {
 #define bool int
 #define true 1
 #define false 0
+#define UNUSED __attribute__ ((unused)) // 标记不使用的参数
 
 #define EFLAGS_MBS (1 << 1)  // 此项必须要设置
 #define EFLAGS_IF_1 (1 << 9) // if为1,开中断
@@ -1,9 +1,18 @@
 #include "init.h"
+#include "blk.h"
+#include "clocksource.h"
 #include "console.h"
+#include "fs.h"
+#include "futex.h"
+#include "interrupt.h"
 #include "kernel/print.h"
 #include "memory.h"
+#include "pci.h"
+#include "syscall-init.h"
 #include "thread.h"
 #include "timer.h"
+#include "tss.h"
+#include "workqueue.h"
 
 void
 init_all () {
@@ -11,6 +20,15 @@ init_all () {
   idt_init ();
   mem_init ();
   thread_init ();
+  futex_init ();
+  workqueue_init ();
   timer_init ();
+  clocksource_init ();
+  pci_init ();
   console_init ();
+  tss_init ();
+  syscall_init ();
+  intr_enable (); // 后面的硬盘初始化要等硬盘中断,派发线程也要被调度
+  blk_dev_init ();
+  filesys_init ();
 }
@@ -4,7 +4,9 @@
 #include "kernel/print.h"
 #include "stdint.h"
 
-#define IDT_DESC_CNT 0x21
+#define IDT_DESC_CNT 0x81   // 最大的中断号为系统调用的0x80
+#define IDT_ENTRY_CNT 0x30  // kernel.S中intr_entry_table的项数
+#define SYSCALL_VECTOR 0x80
 #define PIC_M_CTRL 0x20
 #define PIC_M_DATA 0x21
 #define PIC_S_CTRL 0xa0
@@ -31,7 +33,8 @@ static void             make_idt_desc (struct gate_desc* p_gdesc, uint8_t attr,
 static void             init_custom_handler_name ();
 static struct gate_desc idt[IDT_DESC_CNT];
 
-extern intr_handler intr_entry_table[IDT_DESC_CNT];
+extern intr_handler intr_entry_table[IDT_ENTRY_CNT];
+extern void         syscall_handler (void);
 
 /* 初始化可编程中断控制器8259A */
 static void
@@ -203,9 +206,12 @@ make_idt_desc (struct gate_desc* p_gdesc, uint8_t attr, intr_handler function) {
 static void
 idt_desc_init (void) {
   int i;
-  for (i= 0; i < IDT_DESC_CNT; i++) {
+  for (i= 0; i < IDT_ENTRY_CNT; i++) {
     make_idt_desc (&idt[i], IDT_DESC_ATTR_DPL0, intr_entry_table[i]);
   }
+  /* 系统调用的门描述符dpl为3,用户进程才能用int 0x80进入 */
+  make_idt_desc (&idt[SYSCALL_VECTOR], IDT_DESC_ATTR_DPL3,
+                 (intr_handler) syscall_handler);
   put_str ("idt_desc_init done.\n");
 }
 
@@ -227,3 +233,16 @@ void
 register_handler (uint8_t vec_no, intr_handler handler) {
   idt_table[vec_no]= handler;
 }
+
+/* 打开8259A上irq号为irq的引脚,pci设备的中断引脚由bios分配,要在驱动中打开 */
+void
+pic_enable_irq (uint8_t irq) {
+  enum intr_status old_status= intr_disable ();
+  if (irq < 8) {
+    outb (PIC_M_DATA, inb (PIC_M_DATA) & ~(1 << irq));
+  }
+  else {
+    outb (PIC_S_DATA, inb (PIC_S_DATA) & ~(1 << (irq - 8)));
+  }
+  intr_set_status (old_status);
+}
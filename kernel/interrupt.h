@@ -17,5 +17,6 @@ enum intr_status intr_set_status (enum intr_status);
 enum intr_status intr_enable (void);
 enum intr_status intr_disable (void);
 void             register_handler (uint8_t vec_no, intr_handler handler);
+void             pic_enable_irq (uint8_t irq);
 
 #endif
\ No newline at end of file
@@ -11,6 +11,22 @@ outb (uint16_t port, uint8_t data) {
   asm volatile ("outb %b0, %w1" : : "a"(data), "Nd"(port));
 }
 
+/**
+ * 向指定的端口写入一个字的数据.
+ */
+static inline void
+outw (uint16_t port, uint16_t data) {
+  asm volatile ("outw %w0, %w1" : : "a"(data), "Nd"(port));
+}
+
+/**
+ * 向指定的端口写入一个双字的数据.
+ */
+static inline void
+outl (uint16_t port, uint32_t data) {
+  asm volatile ("outl %0, %w1" : : "a"(data), "Nd"(port));
+}
+
 /**
  * 将addr起始处的word_cnt个字节写入端口port.
  */
@@ -19,6 +35,14 @@ outsw (uint16_t port, const void* addr, uint32_t word_cnt) {
   asm volatile ("cld; rep outsw" : "+S"(addr), "+c"(word_cnt) : "d"(port));
 }
 
+/**
+ * 将addr起始处的dword_cnt个双字写入端口port.
+ */
+static inline void
+outsl (uint16_t port, const void* addr, uint32_t dword_cnt) {
+  asm volatile ("cld; rep outsl" : "+S"(addr), "+c"(dword_cnt) : "d"(port));
+}
+
 /**
  * 将从端口port读入的一个字节返回.
  */
@@ -29,6 +53,26 @@ inb (uint16_t port) {
   return data;
 }
 
+/**
+ * 将从端口port读入的一个字返回.
+ */
+static inline uint16_t
+inw (uint16_t port) {
+  uint16_t data;
+  asm volatile ("inw %w1, %w0" : "=a"(data) : "Nd"(port));
+  return data;
+}
+
+/**
+ * 将从端口port读入的一个双字返回.
+ */
+static inline uint32_t
+inl (uint16_t port) {
+  uint32_t data;
+  asm volatile ("inl %w1, %0" : "=a"(data) : "Nd"(port));
+  return data;
+}
+
 /**
  * 将从port读取的word_cnt字节写入addr.
  */
@@ -40,4 +84,15 @@ insw (uint16_t port, void* addr, uint32_t word_cnt) {
                 : "memory");
 }
 
+/**
+ * 将从port读取的dword_cnt个双字写入addr.
+ */
+static inline void
+insl (uint16_t port, void* addr, uint32_t dword_cnt) {
+  asm volatile ("cld; rep insl"
+                : "+D"(addr), "+c"(dword_cnt)
+                : "d"(port)
+                : "memory");
+}
+
 #endif
@@ -62,8 +62,6 @@ k_thread_a (void* arg) {
   sys_free (addr1);
   sys_free (addr2);
   sys_free (addr3);
-  while (1)
-    ;
 }
 
 /* 在线程中运行的函数 */
@@ -86,8 +84,6 @@ k_thread_b (void* arg) {
   sys_free (addr1);
   sys_free (addr2);
   sys_free (addr3);
-  while (1)
-    ;
 }
 
 /* 测试用户进程 */
@@ -218,6 +218,12 @@ get_a_page (enum pool_flags pf, uint32_t vaddr) {
   return (void*) vaddr;
 }
 
+/* 虚拟地址vaddr在当前页表中是否已映射 */
+bool
+addr_is_mapped (uint32_t vaddr) {
+  return (*pde_ptr (vaddr) & PG_P_1) && (*pte_ptr (vaddr) & PG_P_1);
+}
+
 /* 得到虚拟地址映射到的物理地址 */
 uint32_t
 addr_v2p (uint32_t vaddr) {
@@ -321,13 +327,42 @@ malloc_page (enum pool_flags pf, uint32_t page_count) {
  */
 void*
 get_kernel_pages (uint32_t page_count) {
+  lock_acquire (&kernel_pool.lock);
   void* vaddr= malloc_page (PF_KERNEL, page_count);
+  lock_release (&kernel_pool.lock);
   if (vaddr != NULL) {
     memset (vaddr, 0, page_count * PAGE_SIZE);
   }
   return vaddr;
 }
 
+/**
+ * 把物理地址phy_addr起size字节的设备寄存器映射到内核空间,返回对应的虚拟地址.
+ * 映射的页禁止缓存,映射后不再释放.
+ */
+void*
+ioremap (uint32_t phy_addr, uint32_t size) {
+  uint32_t offset= phy_addr & (PAGE_SIZE - 1);
+  uint32_t pg_cnt= DIV_ROUND_UP (offset + size, PAGE_SIZE);
+  uint32_t pg_phy= phy_addr - offset;
+  lock_acquire (&kernel_pool.lock);
+  void* vaddr_start= vaddr_get (PF_KERNEL, pg_cnt);
+  if (vaddr_start == NULL) {
+    lock_release (&kernel_pool.lock);
+    return NULL;
+  }
+  uint32_t vaddr= (uint32_t) vaddr_start;
+  while (pg_cnt-- > 0) {
+    page_table_add ((void*) vaddr, (void*) pg_phy);
+    *pte_ptr (vaddr)|= PG_PCD | PG_PWT;
+    asm volatile ("invlpg %0" : : "m"(*(char*) vaddr) : "memory");
+    vaddr+= PAGE_SIZE;
+    pg_phy+= PAGE_SIZE;
+  }
+  lock_release (&kernel_pool.lock);
+  return (void*) ((uint32_t) vaddr_start + offset);
+}
+
 /* 为malloc做准备 */
 void
 block_desc_init (struct mem_block_desc* desc_array) {
@@ -565,6 +600,49 @@ mfree_page (enum pool_flags pf, void* _vaddr, uint32_t pg_cnt) {
   }
 }
 
+/* 释放get_kernel_pages申请的page_count个内核页 */
+void
+mfree_kernel_pages (void* vaddr, uint32_t page_count) {
+  lock_acquire (&kernel_pool.lock);
+  mfree_page (PF_KERNEL, vaddr, page_count);
+  lock_release (&kernel_pool.lock);
+}
+
+/**
+ * 释放当前进程用户空间中所有的物理页和页表,须在该进程自己的页表下调用.
+ * 页目录和虚拟地址位图仍保留,由回收者释放.
+ */
+void
+mfree_user_space (void) {
+  ASSERT (running_thread ()->pgdir != NULL);
+  lock_acquire (&user_pool.lock);
+  lock_acquire (&kernel_pool.lock);
+
+  /* 第0x300项之后的页目录项是内核空间,各进程共享 */
+  uint32_t pde_idx= 0;
+  while (pde_idx < 0x300) {
+    uint32_t* pde= pde_ptr (pde_idx << 22);
+    if (*pde & PG_P_1) {
+      uint32_t* pte    = pte_ptr (pde_idx << 22);
+      uint32_t  pte_idx= 0;
+      while (pte_idx < 1024) {
+        if (pte[pte_idx] & PG_P_1) {
+          pfree (pte[pte_idx] & 0xfffff000);
+        }
+        pte_idx++;
+      }
+      pfree (*pde & 0xfffff000); // 页表来自内核物理内存池
+      *pde= 0;
+    }
+    pde_idx++;
+  }
+  /* 重新加载cr3,清掉用户空间的tlb */
+  asm volatile ("movl %%cr3, %%eax; movl %%eax, %%cr3" : : : "eax", "memory");
+
+  lock_release (&kernel_pool.lock);
+  lock_release (&user_pool.lock);
+}
+
 /* 回收内存ptr */
 void
 sys_free (void* ptr) {
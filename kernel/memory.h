@@ -14,6 +14,9 @@
 // 系统级
 #define PG_US_S 0
 #define PG_US_U 4
+// 写直通和禁止缓存,用于映射设备寄存器
+#define PG_PWT 8
+#define PG_PCD 16
 
 /**
  * 内存池类型标志.
@@ -52,4 +55,22 @@ void* get_kernel_pages (uint32_t page_count);
 
 void* malloc_page (enum pool_flags pf, uint32_t page_count);
 
+void* get_user_pages (uint32_t pg_cnt);
+
+void mfree_page (enum pool_flags pf, void* _vaddr, uint32_t pg_cnt);
+
+void mfree_kernel_pages (void* vaddr, uint32_t page_count);
+
+void mfree_user_space (void);
+
+void* sys_malloc (uint32_t size);
+
+void sys_free (void* ptr);
+
+bool addr_is_mapped (uint32_t vaddr);
+
+uint32_t addr_v2p (uint32_t vaddr);
+
+void* ioremap (uint32_t phy_addr, uint32_t size);
+
 #endif
@@ -16,7 +16,7 @@ bitmap_init (struct bitmap* btmap) {
 int
 bitmap_scan_test (struct bitmap* btmap, uint32_t index) {
   uint32_t byte_index= (index / 8);
-  uint32_t bit_odd   = byte_index % 8;
+  uint32_t bit_odd   = index % 8;
 
   return (btmap->bits[byte_index] & BITMAP_MASK << bit_odd);
 }
@@ -0,0 +1,17 @@
+#ifndef __LIB_TIME_H
+#define __LIB_TIME_H
+#include "stdint.h"
+
+#define NSEC_PER_USEC 1000
+#define NSEC_PER_MSEC 1000000
+#define NSEC_PER_SEC 1000000000
+
+/* clock_gettime支持的时钟 */
+#define CLOCK_REALTIME 0
+#define CLOCK_MONOTONIC 1
+
+struct timespec {
+  uint32_t tv_sec;  // 秒
+  uint32_t tv_nsec; // 不足1秒的纳秒数
+};
+#endif
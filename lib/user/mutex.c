@@ -0,0 +1,94 @@
+#include "mutex.h"
+#include "syscall.h"
+
+/* 若*ptr等于old则写入new,返回*ptr原来的值 */
+static inline uint32_t
+cmpxchg (volatile uint32_t* ptr, uint32_t old, uint32_t new) {
+  uint32_t prev;
+  asm volatile ("lock cmpxchgl %2, %1"
+                : "=a"(prev), "+m"(*ptr)
+                : "r"(new), "0"(old)
+                : "memory");
+  return prev;
+}
+
+/* 把val写入*ptr,返回*ptr原来的值 */
+static inline uint32_t
+xchg (volatile uint32_t* ptr, uint32_t val) {
+  asm volatile ("xchgl %0, %1" : "+r"(val), "+m"(*ptr) : : "memory");
+  return val;
+}
+
+/* *ptr加上val,返回*ptr原来的值 */
+static inline uint32_t
+xadd (volatile uint32_t* ptr, uint32_t val) {
+  asm volatile ("lock xaddl %0, %1" : "+r"(val), "+m"(*ptr) : : "memory");
+  return val;
+}
+
+void
+mutex_init (struct mutex* m) {
+  m->state= 0;
+}
+
+void
+mutex_lock (struct mutex* m) {
+  uint32_t c= cmpxchg (&m->state, 0, 1);
+  if (c == 0) { // 无竞争,直接获得
+    return;
+  }
+
+  /* 有竞争:把状态置为2表示有等待者,然后在futex上睡眠直到抢到锁 */
+  if (c != 2) {
+    c= xchg (&m->state, 2);
+  }
+  while (c != 0) {
+    futex ((uint32_t*) &m->state, FUTEX_WAIT, 2);
+    c= xchg (&m->state, 2);
+  }
+}
+
+bool
+mutex_trylock (struct mutex* m) {
+  return cmpxchg (&m->state, 0, 1) == 0;
+}
+
+void
+mutex_unlock (struct mutex* m) {
+  /* 原值为1说明没有等待者,不必进入内核 */
+  if (xadd (&m->state, (uint32_t) -1) != 1) {
+    m->state= 0;
+    futex ((uint32_t*) &m->state, FUTEX_WAKE, 1);
+  }
+}
+
+void
+cond_init (struct cond* c) {
+  c->seq= 0;
+}
+
+/* 释放m并等待条件,返回前重新获得m,返回后调用者须重新检查条件 */
+void
+cond_wait (struct cond* c, struct mutex* m) {
+  uint32_t seq= c->seq;
+  mutex_unlock (m);
+  /* 若释放锁后已有signal使seq改变,futex立即返回,不会丢失唤醒 */
+  futex ((uint32_t*) &c->seq, FUTEX_WAIT, seq);
+
+  /* 被唤醒者可能不止一个,以有等待者的状态重新上锁,保证解锁时唤醒其余任务 */
+  while (xchg (&m->state, 2) != 0) {
+    futex ((uint32_t*) &m->state, FUTEX_WAIT, 2);
+  }
+}
+
+void
+cond_signal (struct cond* c) {
+  xadd (&c->seq, 1);
+  futex ((uint32_t*) &c->seq, FUTEX_WAKE, 1);
+}
+
+void
+cond_broadcast (struct cond* c) {
+  xadd (&c->seq, 1);
+  futex ((uint32_t*) &c->seq, FUTEX_WAKE, 0xffffffff);
+}
@@ -0,0 +1,29 @@
+#ifndef __LIB_USER_MUTEX_H
+#define __LIB_USER_MUTEX_H
+#include "global.h"
+#include "stdint.h"
+
+/**
+ * 用户态互斥锁,无竞争时只需一条lock cmpxchg,有竞争时才通过futex进入内核.
+ * state: 0未上锁, 1已上锁且无等待者, 2已上锁且可能有等待者
+ */
+struct mutex {
+  volatile uint32_t state;
+};
+
+/**
+ * 用户态条件变量,seq每次signal/broadcast时加1.
+ */
+struct cond {
+  volatile uint32_t seq;
+};
+
+void mutex_init (struct mutex* m);
+void mutex_lock (struct mutex* m);
+bool mutex_trylock (struct mutex* m);
+void mutex_unlock (struct mutex* m);
+void cond_init (struct cond* c);
+void cond_wait (struct cond* c, struct mutex* m);
+void cond_signal (struct cond* c);
+void cond_broadcast (struct cond* c);
+#endif
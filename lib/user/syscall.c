@@ -1,15 +1,16 @@
 #include "syscall.h"
+#include "clocksource.h"
 
-/* 无参数的系统调用 */
-#define _syscall0(NUMBER)                                                      \
+/* 经int 0x80进入内核的无参数系统调用 */
+#define _int_syscall0(NUMBER)                                                  \
   ({                                                                           \
     int retval;                                                                \
     asm volatile ("int $0x80" : "=a"(retval) : "a"(NUMBER) : "memory");        \
     retval;                                                                    \
   })
 
-/* 一个参数的系统调用 */
-#define _syscall1(NUMBER, ARG1)                                                \
+/* 经int 0x80进入内核的一个参数的系统调用 */
+#define _int_syscall1(NUMBER, ARG1)                                            \
   ({                                                                           \
     int retval;                                                                \
     asm volatile ("int $0x80"                                                  \
@@ -19,8 +20,8 @@
     retval;                                                                    \
   })
 
-/* 两个参数的系统调用 */
-#define _syscall2(NUMBER, ARG1, ARG2)                                          \
+/* 经int 0x80进入内核的两个参数的系统调用 */
+#define _int_syscall2(NUMBER, ARG1, ARG2)                                      \
   ({                                                                           \
     int retval;                                                                \
     asm volatile ("int $0x80"                                                  \
@@ -30,8 +31,8 @@
     retval;                                                                    \
   })
 
-/* 三个参数的系统调用 */
-#define _syscall3(NUMBER, ARG1, ARG2, ARG3)                                    \
+/* 经int 0x80进入内核的三个参数的系统调用 */
+#define _int_syscall3(NUMBER, ARG1, ARG2, ARG3)                                \
   ({                                                                           \
     int retval;                                                                \
     asm volatile ("int $0x80"                                                  \
@@ -41,9 +42,122 @@
     retval;                                                                    \
   })
 
-/* 返回当前任务pid */
+/* 经int 0x80进入内核的四个参数的系统调用 */
+#define _int_syscall4(NUMBER, ARG1, ARG2, ARG3, ARG4)                          \
+  ({                                                                           \
+    int retval;                                                                \
+    asm volatile ("int $0x80"                                                  \
+                  : "=a"(retval)                                               \
+                  : "a"(NUMBER), "b"(ARG1), "c"(ARG2), "d"(ARG3), "S"(ARG4)    \
+                  : "memory");                                                 \
+    retval;                                                                    \
+  })
+
+/* 经sysenter进入内核的系统调用,先压入返回地址并令ebp= esp,
+ * 内核用sysexit返回到标号1处,ecx和edx会被改写,见kernel.S中的sysenter_entry */
+#define _sysenter(NUMBER, ARG1, ARG2, ARG3, ARG4)                              \
+  ({                                                                           \
+    int retval;                                                                \
+    int arg2= (int) (ARG2), arg3= (int) (ARG3);                                \
+    asm volatile ("pushl %%ebp\n\t"                                            \
+                  "pushl $1f\n\t"                                              \
+                  "movl %%esp, %%ebp\n\t"                                      \
+                  "sysenter\n"                                                 \
+                  "1:\n\t"                                                     \
+                  "popl %%ebp"                                                 \
+                  : "=a"(retval), "+c"(arg2), "+d"(arg3)                       \
+                  : "a"(NUMBER), "b"(ARG1), "S"(ARG4)                          \
+                  : "memory");                                                 \
+    retval;                                                                    \
+  })
+
+/* 在用户态且cpu支持sysenter时走快速路径,否则退回int 0x80 */
+#define _syscall0(NUMBER)                                                      \
+  (sysenter_supported () ? _sysenter (NUMBER, 0, 0, 0, 0)                      \
+                         : _int_syscall0 (NUMBER))
+#define _syscall1(NUMBER, ARG1)                                                \
+  (sysenter_supported () ? _sysenter (NUMBER, ARG1, 0, 0, 0)                   \
+                         : _int_syscall1 (NUMBER, ARG1))
+#define _syscall2(NUMBER, ARG1, ARG2)                                          \
+  (sysenter_supported () ? _sysenter (NUMBER, ARG1, ARG2, 0, 0)                \
+                         : _int_syscall2 (NUMBER, ARG1, ARG2))
+#define _syscall3(NUMBER, ARG1, ARG2, ARG3)                                    \
+  (sysenter_supported () ? _sysenter (NUMBER, ARG1, ARG2, ARG3, 0)             \
+                         : _int_syscall3 (NUMBER, ARG1, ARG2, ARG3))
+#define _syscall4(NUMBER, ARG1, ARG2, ARG3, ARG4)                              \
+  (sysenter_supported () ? _sysenter (NUMBER, ARG1, ARG2, ARG3, ARG4)          \
+                         : _int_syscall4 (NUMBER, ARG1, ARG2, ARG3, ARG4))
+
+static int32_t sysenter_ok= -1; // cpu是否支持sysenter,-1表示还未检测
+
+/* 当前是否运行在3特权级 */
+static bool
+user_mode (void) {
+  uint32_t cs;
+  asm ("movl %%cs, %0" : "=r"(cs));
+  return (cs & 3) == 3;
+}
+
+/**
+ * 能否用sysenter. 内核线程也会调用这些函数(如main中的printf),
+ * 而sysexit总是返回3特权级,sysenter的内核栈也只为用户进程设置,因此只在用户态使用.
+ * cpu的检测方法与内核相同:SEP位为1,且不是把SEP误报为1的早期Pentium Pro
+ */
+static int32_t
+sysenter_supported (void) {
+  if (!user_mode ()) {
+    return 0;
+  }
+  if (sysenter_ok == -1) {
+    uint32_t eax= 1, ebx, ecx, edx;
+    asm volatile ("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+    uint32_t family= (eax >> 8) & 0xf, model= (eax >> 4) & 0xf;
+    uint32_t stepping= eax & 0xf;
+    sysenter_ok= (edx & 0x800) != 0 &&
+                 !(family == 6 && model < 3 && stepping < 3);
+  }
+  return sysenter_ok;
+}
+
+/* 在用户态运行时返回vdso页,内核线程的页表中没有它,返回NULL */
+static const volatile struct vdso_data*
+vdso_page (void) {
+  return user_mode () ? (const volatile struct vdso_data*) VDSO_VADDR : NULL;
+}
+
+/* 从vdso页算出当前的ktime,seq为奇数或读的过程中变了就重读 */
+static uint64_t
+vdso_ktime_ns (const volatile struct vdso_data* vdso) {
+  uint32_t seq;
+  uint64_t ns;
+  do {
+    seq= vdso->seq;
+    asm volatile ("" : : : "memory");
+    if (vdso->clock_mode == VCLOCK_TSC) {
+      uint64_t tsc;
+      asm volatile ("rdtsc" : "=A"(tsc));
+      tsc-= vdso->base;
+      /* 与内核的clocksource_cyc2ns相同,拆成高低32位分别相乘 */
+      uint32_t high= (uint32_t) (tsc >> 32);
+      uint32_t low = (uint32_t) tsc;
+      ns= (((uint64_t) high * vdso->mult) << (32 - vdso->shift)) +
+          (((uint64_t) low * vdso->mult) >> vdso->shift);
+    }
+    else {
+      ns= vdso->tick_ns;
+    }
+    asm volatile ("" : : : "memory");
+  } while ((seq & 1) || seq != vdso->seq);
+  return ns;
+}
+
+/* 返回当前任务pid,用户进程直接从vdso页读取 */
 uint32_t
 getpid () {
+  const volatile struct vdso_data* vdso= vdso_page ();
+  if (vdso != NULL) {
+    return vdso->pid;
+  }
   return _syscall0 (SYS_GETPID);
 }
 
@@ -64,3 +178,208 @@ void
 free (void* ptr) {
   _syscall1 (SYS_FREE, ptr);
 }
+
+/* 获取时钟clock_id的当前时间,存入tp,用户进程由vdso页算出 */
+int32_t
+clock_gettime (int32_t clock_id, struct timespec* tp) {
+  const volatile struct vdso_data* vdso= vdso_page ();
+  if (vdso == NULL || clock_id != CLOCK_MONOTONIC || tp == NULL) {
+    return _syscall2 (SYS_CLOCK_GETTIME, clock_id, tp);
+  }
+  uint32_t nsec;
+  tp->tv_sec = (uint32_t) div_u64_rem (vdso_ktime_ns (vdso), NSEC_PER_SEC, &nsec);
+  tp->tv_nsec= nsec;
+  return 0;
+}
+
+/* 返回开机以来的秒数,tloc不为NULL时也存入其中 */
+uint32_t
+time (uint32_t* tloc) {
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  if (tloc != NULL) {
+    *tloc= ts.tv_sec;
+  }
+  return ts.tv_sec;
+}
+
+/* 在addr上执行futex操作op */
+int32_t
+futex (uint32_t* addr, int32_t op, uint32_t val) {
+  return _syscall3 (SYS_FUTEX, addr, op, val);
+}
+
+/* 以状态status结束当前进程 */
+void
+exit (int32_t status) {
+  _syscall1 (SYS_EXIT, status);
+}
+
+/* 等待子进程退出,返回其pid,status带回其退出状态 */
+int16_t
+wait (int32_t* status) {
+  return _syscall1 (SYS_WAIT, status);
+}
+
+/* 取得调度统计和至多cnt个任务的快照,返回快照中的任务数 */
+int32_t
+ps (struct sched_info* info, struct task_info* tasks, uint32_t cnt) {
+  return _syscall3 (SYS_PS, info, tasks, cnt);
+}
+
+/* 以flags打开文件pathname,返回文件描述符 */
+int32_t
+open (char* pathname, uint8_t flags) {
+  return _syscall2 (SYS_OPEN, pathname, flags);
+}
+
+/* 关闭文件描述符fd */
+int32_t
+close (int32_t fd) {
+  return _syscall1 (SYS_CLOSE, fd);
+}
+
+/* 从文件描述符fd中读取count个字节到buf */
+int32_t
+read (int32_t fd, void* buf, uint32_t count) {
+  return _syscall3 (SYS_READ, fd, buf, count);
+}
+
+/* 重置用于文件读写操作的偏移指针 */
+int32_t
+lseek (int32_t fd, int32_t offset, uint8_t whence) {
+  return _syscall3 (SYS_LSEEK, fd, offset, whence);
+}
+
+/* 删除文件pathname */
+int32_t
+unlink (const char* pathname) {
+  return _syscall1 (SYS_UNLINK, pathname);
+}
+
+/* 创建目录pathname */
+int32_t
+mkdir (const char* pathname) {
+  return _syscall1 (SYS_MKDIR, pathname);
+}
+
+/* 打开目录name */
+struct dir*
+opendir (const char* name) {
+  return (struct dir*) _syscall1 (SYS_OPENDIR, name);
+}
+
+/* 关闭目录dir */
+int32_t
+closedir (struct dir* dir) {
+  return _syscall1 (SYS_CLOSEDIR, dir);
+}
+
+/* 读取目录dir中的下一个目录项 */
+struct dir_entry*
+readdir (struct dir* dir) {
+  return (struct dir_entry*) _syscall1 (SYS_READDIR, dir);
+}
+
+/* 回归目录指针 */
+void
+rewinddir (struct dir* dir) {
+  _syscall1 (SYS_REWINDDIR, dir);
+}
+
+/* 删除空目录pathname */
+int32_t
+rmdir (const char* pathname) {
+  return _syscall1 (SYS_RMDIR, pathname);
+}
+
+/* 获取当前工作目录 */
+char*
+getcwd (char* buf, uint32_t size) {
+  return (char*) _syscall2 (SYS_GETCWD, buf, size);
+}
+
+/* 改变当前工作目录 */
+int32_t
+chdir (const char* path) {
+  return _syscall1 (SYS_CHDIR, path);
+}
+
+/* 获取path的属性到buf中 */
+int32_t
+stat (const char* path, struct stat* buf) {
+  return _syscall2 (SYS_STAT, path, buf);
+}
+
+/* 建立本进程的异步I/O环 */
+struct uring_ring*
+uring_setup (void) {
+  return (struct uring_ring*) _syscall0 (SYS_URING_SETUP);
+}
+
+/* 通知内核新提交了to_submit项,并等待至少min_complete个完成项 */
+int32_t
+uring_enter (uint32_t to_submit, uint32_t min_complete) {
+  return _syscall2 (SYS_URING_ENTER, to_submit, min_complete);
+}
+
+/* 从fd中依次读出数据填满iov的iovcnt段 */
+int32_t
+readv (int32_t fd, const struct iovec* iov, uint32_t iovcnt) {
+  return _syscall3 (SYS_READV, fd, iov, iovcnt);
+}
+
+/* 把iov中iovcnt段数据依次写入fd */
+int32_t
+writev (int32_t fd, const struct iovec* iov, uint32_t iovcnt) {
+  return _syscall3 (SYS_WRITEV, fd, iov, iovcnt);
+}
+
+/* 从fd的offset处读count个字节到buf,不移动读写位置 */
+int32_t
+pread (int32_t fd, void* buf, uint32_t count, uint32_t offset) {
+  return _syscall4 (SYS_PREAD, fd, buf, count, offset);
+}
+
+/* 把buf中count个字节写到fd的offset处,不移动读写位置 */
+int32_t
+pwrite (int32_t fd, const void* buf, uint32_t count, uint32_t offset) {
+  return _syscall4 (SYS_PWRITE, fd, buf, count, offset);
+}
+
+/* 在内核中把fd_in从当前位置起的len个字节追加到fd_out */
+int32_t
+copy_file_range (int32_t fd_in, int32_t fd_out, uint32_t len) {
+  return _syscall3 (SYS_COPY_FILE_RANGE, fd_in, fd_out, len);
+}
+
+/* 取子功能号nr的调用次数,出错次数和延迟直方图 */
+int32_t
+syscall_stat (uint32_t nr, struct syscall_stat* st) {
+  return _syscall2 (SYS_SYSCALL_STAT, nr, st);
+}
+
+/* 开启或关闭进程pid的系统调用跟踪 */
+int32_t
+systrace (pid_t pid, bool enable) {
+  return _syscall2 (SYS_SYSTRACE, pid, enable);
+}
+
+/* 从进程pid的跟踪环中取出至多cnt条记录 */
+int32_t
+systrace_read (pid_t pid, struct systrace_rec* recs, uint32_t cnt,
+               uint32_t* dropped) {
+  return _syscall4 (SYS_SYSTRACE_READ, pid, recs, cnt, dropped);
+}
+
+/* 取第idx个块设备或分区的读写统计,idx超出范围时返回-1 */
+int32_t
+iostat (uint32_t idx, struct io_stat* st) {
+  return _syscall2 (SYS_IOSTAT, idx, st);
+}
+
+/* 取第idx把已登记锁的竞争及优先级反转统计,idx超出范围时返回-1 */
+int32_t
+lockstat (uint32_t idx, struct lock_stat_info* info) {
+  return _syscall2 (SYS_LOCK_STAT, idx, info);
+}
@@ -1,9 +1,87 @@
 #ifndef __LIB_USER_SYSCALL_H
 #define __LIB_USER_SYSCALL_H
+#include "fs.h"
+#include "futex.h"
+#include "iostat.h"
 #include "stdint.h"
-enum SYSCALL_NR { SYS_GETPID, SYS_WRITE, SYS_MALLOC, SYS_FREE };
+#include "sync.h"
+#include "systrace.h"
+#include "thread.h"
+#include "time.h"
+#include "uring.h"
+#include "vdso.h"
+enum SYSCALL_NR {
+  SYS_GETPID,
+  SYS_WRITE,
+  SYS_MALLOC,
+  SYS_FREE,
+  SYS_CLOCK_GETTIME,
+  SYS_FUTEX,
+  SYS_EXIT,
+  SYS_WAIT,
+  SYS_PS,
+  SYS_OPEN,
+  SYS_CLOSE,
+  SYS_READ,
+  SYS_LSEEK,
+  SYS_UNLINK,
+  SYS_MKDIR,
+  SYS_OPENDIR,
+  SYS_CLOSEDIR,
+  SYS_READDIR,
+  SYS_REWINDDIR,
+  SYS_RMDIR,
+  SYS_GETCWD,
+  SYS_CHDIR,
+  SYS_STAT,
+  SYS_URING_SETUP,
+  SYS_URING_ENTER,
+  SYS_READV,
+  SYS_WRITEV,
+  SYS_PREAD,
+  SYS_PWRITE,
+  SYS_COPY_FILE_RANGE,
+  SYS_SYSCALL_STAT,
+  SYS_SYSTRACE,
+  SYS_SYSTRACE_READ,
+  SYS_IOSTAT,
+  SYS_LOCK_STAT
+};
 uint32_t getpid (void);
 uint32_t write (int32_t fd, const void* buf, uint32_t count);
 void*    malloc (uint32_t size);
 void     free (void* ptr);
+int32_t  clock_gettime (int32_t clock_id, struct timespec* tp);
+uint32_t time (uint32_t* tloc);
+int32_t  futex (uint32_t* addr, int32_t op, uint32_t val);
+void     exit (int32_t status);
+int16_t  wait (int32_t* status);
+int32_t  ps (struct sched_info* info, struct task_info* tasks, uint32_t cnt);
+int32_t  open (char* pathname, uint8_t flags);
+int32_t  close (int32_t fd);
+int32_t  read (int32_t fd, void* buf, uint32_t count);
+int32_t  lseek (int32_t fd, int32_t offset, uint8_t whence);
+int32_t  unlink (const char* pathname);
+int32_t  mkdir (const char* pathname);
+struct dir*       opendir (const char* name);
+int32_t           closedir (struct dir* dir);
+struct dir_entry* readdir (struct dir* dir);
+void              rewinddir (struct dir* dir);
+int32_t           rmdir (const char* pathname);
+char*             getcwd (char* buf, uint32_t size);
+int32_t           chdir (const char* path);
+int32_t           stat (const char* path, struct stat* buf);
+struct uring_ring* uring_setup (void);
+int32_t uring_enter (uint32_t to_submit, uint32_t min_complete);
+int32_t readv (int32_t fd, const struct iovec* iov, uint32_t iovcnt);
+int32_t writev (int32_t fd, const struct iovec* iov, uint32_t iovcnt);
+int32_t pread (int32_t fd, void* buf, uint32_t count, uint32_t offset);
+int32_t pwrite (int32_t fd, const void* buf, uint32_t count, uint32_t offset);
+int32_t copy_file_range (int32_t fd_in, int32_t fd_out, uint32_t len);
+int32_t syscall_stat (uint32_t nr, struct syscall_stat* st);
+int32_t systrace (pid_t pid, bool enable);
+int32_t systrace_read (pid_t pid, struct systrace_rec* recs, uint32_t cnt,
+                       uint32_t* dropped);
+int32_t iostat (uint32_t idx, struct io_stat* st);
+int32_t lockstat (uint32_t idx, struct lock_stat_info* info);
 #endif
@@ -0,0 +1,88 @@
+#include "futex.h"
+#include "global.h"
+#include "interrupt.h"
+#include "memory.h"
+#include "print.h"
+#include "sync.h"
+
+#define FUTEX_HASH_BITS 5
+#define FUTEX_HASH_SIZE (1 << FUTEX_HASH_BITS)
+
+/* 以物理地址为键散列到各桶,不同进程映射同一物理页时也能互相唤醒 */
+static struct wait_queue futex_queues[FUTEX_HASH_SIZE];
+
+static struct wait_queue*
+futex_hash (uint32_t key) {
+  return &futex_queues[((key >> 2) * 0x9e370001) >> (32 - FUTEX_HASH_BITS)];
+}
+
+/* 把用户地址转换为物理地址作为键,地址非法时返回0 */
+static uint32_t
+futex_key (uint32_t* addr) {
+  uint32_t vaddr= (uint32_t) addr;
+  if (vaddr == 0 || (vaddr & 0x3) != 0 || !addr_is_mapped (vaddr)) {
+    return 0;
+  }
+  return addr_v2p (vaddr);
+}
+
+/* 若*addr仍等于val就在addr上睡眠,被唤醒返回0,*addr已改变或地址非法返回-1 */
+static int32_t
+futex_wait (uint32_t* addr, uint32_t val) {
+  enum intr_status old_status= intr_disable ();
+  uint32_t         key       = futex_key (addr);
+
+  /* 关中断后比较与入队之间不会有唤醒插进来,不会丢失唤醒 */
+  if (key == 0 || *addr != val) {
+    intr_set_status (old_status);
+    return -1;
+  }
+
+  struct wait_queue*      wq= futex_hash (key);
+  struct wait_queue_entry entry;
+  wait_queue_add (wq, &entry, true);
+  entry.key= key;
+  wait_queue_sleep (&entry, 0);
+
+  intr_set_status (old_status);
+  return 0;
+}
+
+/* 唤醒至多nr个在addr上睡眠的任务,返回唤醒的任务数,地址非法返回-1 */
+static int32_t
+futex_wake (uint32_t* addr, uint32_t nr) {
+  enum intr_status old_status= intr_disable ();
+  uint32_t         key       = futex_key (addr);
+  int32_t          woken_cnt = -1;
+  if (key != 0) {
+    woken_cnt= wait_queue_wake_key (futex_hash (key), key, nr);
+  }
+  intr_set_status (old_status);
+  return woken_cnt;
+}
+
+/* futex系统调用 */
+int32_t
+sys_futex (uint32_t* addr, int32_t op, uint32_t val) {
+  switch (op) {
+  case FUTEX_WAIT:
+    return futex_wait (addr, val);
+  case FUTEX_WAKE:
+    return futex_wake (addr, val);
+  default:
+    return -1;
+  }
+}
+
+/* 初始化futex散列表 */
+void
+futex_init (void) {
+  put_str ("futex_init start\n");
+  uint32_t idx= 0;
+  while (idx < FUTEX_HASH_SIZE) {
+    wait_queue_init (&futex_queues[idx]);
+    futex_queues[idx].reason= BLOCK_FUTEX;
+    idx++;
+  }
+  put_str ("futex_init done\n");
+}
@@ -0,0 +1,11 @@
+#ifndef __THREAD_FUTEX_H
+#define __THREAD_FUTEX_H
+#include "stdint.h"
+
+/* futex的操作 */
+#define FUTEX_WAIT 0 // 若*addr仍等于val则睡眠,直到被FUTEX_WAKE唤醒
+#define FUTEX_WAKE 1 // 唤醒至多val个在addr上睡眠的任务
+
+void    futex_init (void);
+int32_t sys_futex (uint32_t* addr, int32_t op, uint32_t val);
+#endif
@@ -1,11 +1,185 @@
 #include "sync.h"
+#include "clocksource.h"
 #include "debug.h"
 #include "interrupt.h"
+#include "stdio-kernel.h"
+#include "string.h"
+#include "timer.h"
 
+#define LOCK_DONATE_DEPTH 8 // 优先级捐赠沿锁链传递的最大深度
+
+static struct list lock_stat_list; // 已登记统计的锁
+
+void
+wait_queue_init (struct wait_queue* wq) {
+  list_init (&wq->waiters);
+  wq->reason= BLOCK_WAIT;
+}
+
+/* 把当前任务以entry加入等待队列,此后须调用wait_queue_sleep等待,调用时须关中断 */
 void
-semaphore_init (struct semaphore* psem, uint8_t value) {
+wait_queue_add (struct wait_queue* wq, struct wait_queue_entry* entry,
+                bool exclusive) {
+  ASSERT (intr_get_status () == INTR_OFF);
+  entry->task     = running_thread ();
+  entry->exclusive= exclusive;
+  entry->woken    = false;
+  entry->timed_out= false;
+  entry->key      = 0;
+  entry->reason   = wq->reason;
+  list_append (&wq->waiters, &entry->tag);
+}
+
+/* 唤醒entry对应的任务,任务可能还未来得及阻塞 */
+static void
+wait_queue_wake_entry (struct wait_queue_entry* entry) {
+  list_remove (&entry->tag);
+  entry->woken= true;
+  if (entry->task->status == TASK_BLOCKED) {
+    thread_unblock (entry->task);
+  }
+}
+
+/* 等待超时,把entry从等待队列中摘下并唤醒任务 */
+static void
+wait_queue_timeout (void* arg) {
+  struct wait_queue_entry* entry= arg;
+  if (!entry->woken) {
+    list_remove (&entry->tag);
+    entry->timed_out= true;
+    if (entry->task->status == TASK_BLOCKED) {
+      thread_unblock (entry->task);
+    }
+    timer_resched ();
+  }
+}
+
+/* 阻塞直到entry被唤醒或到达deadline,deadline为0表示不超时.
+ * 被唤醒返回true,超时返回false */
+static bool
+wait_queue_sleep_until (struct wait_queue_entry* entry, uint64_t deadline) {
+  ASSERT (intr_get_status () == INTR_OFF);
+  struct ktimer timer;
+  if (deadline != 0) {
+    timer.func= wait_queue_timeout;
+    timer.arg = entry;
+    ktimer_add (&timer, deadline);
+  }
+
+  while (!entry->woken && !entry->timed_out) {
+    thread_block_reason (TASK_BLOCKED, entry->reason);
+  }
+
+  if (deadline != 0) {
+    ktimer_del (&timer);
+  }
+  return entry->woken;
+}
+
+/* 超时u_seconds微秒的时刻,u_seconds为0表示不超时 */
+static uint64_t
+wait_deadline (uint32_t u_seconds) {
+  return u_seconds == 0 ? 0 : timer_clock_now () + timer_us2clock (u_seconds);
+}
+
+/* 阻塞直到entry被唤醒或等待u_seconds微秒,u_seconds为0表示不超时 */
+bool
+wait_queue_sleep (struct wait_queue_entry* entry, uint32_t u_seconds) {
+  return wait_queue_sleep_until (entry, wait_deadline (u_seconds));
+}
+
+/* 在等待队列wq上等待一次,调用者须关中断并在返回后重新检查等待的条件 */
+bool
+wait_queue_wait (struct wait_queue* wq, bool exclusive, uint32_t u_seconds) {
+  struct wait_queue_entry entry;
+  wait_queue_add (wq, &entry, exclusive);
+  return wait_queue_sleep (&entry, u_seconds);
+}
+
+/* 找出优先级最高的独占等待者,优先级相同时先来先得 */
+static struct wait_queue_entry*
+wait_queue_max_exclusive (struct wait_queue* wq) {
+  struct wait_queue_entry* max = NULL;
+  struct list_elem*        elem= wq->waiters.head.next;
+  while (elem != &wq->waiters.tail) {
+    struct wait_queue_entry* entry=
+        elem2entry (struct wait_queue_entry, tag, elem);
+    if (entry->exclusive &&
+        (max == NULL || entry->task->priority > max->task->priority)) {
+      max= entry;
+    }
+    elem= elem->next;
+  }
+  return max;
+}
+
+/* 唤醒全部非独占等待者和至多nr_exclusive个独占等待者,返回唤醒的任务数 */
+uint32_t
+wait_queue_wake (struct wait_queue* wq, uint32_t nr_exclusive) {
+  enum intr_status old_status= intr_disable ();
+  uint32_t         woken_cnt = 0;
+
+  struct list_elem* elem= wq->waiters.head.next;
+  while (elem != &wq->waiters.tail) {
+    struct list_elem*        next = elem->next;
+    struct wait_queue_entry* entry=
+        elem2entry (struct wait_queue_entry, tag, elem);
+    if (!entry->exclusive) {
+      wait_queue_wake_entry (entry);
+      woken_cnt++;
+    }
+    elem= next;
+  }
+
+  while (nr_exclusive > 0) {
+    struct wait_queue_entry* entry= wait_queue_max_exclusive (wq);
+    if (entry == NULL) {
+      break;
+    }
+    wait_queue_wake_entry (entry);
+    woken_cnt++;
+    nr_exclusive--;
+  }
+  intr_set_status (old_status);
+  return woken_cnt;
+}
+
+/* 唤醒等待队列上的所有任务 */
+uint32_t
+wait_queue_wake_all (struct wait_queue* wq) {
+  return wait_queue_wake (wq, 0xffffffff);
+}
+
+/* 按入队顺序唤醒至多nr个等待对象为key的任务,返回唤醒的任务数 */
+uint32_t
+wait_queue_wake_key (struct wait_queue* wq, uint32_t key, uint32_t nr) {
+  enum intr_status old_status= intr_disable ();
+  uint32_t         woken_cnt = 0;
+
+  struct list_elem* elem= wq->waiters.head.next;
+  while (elem != &wq->waiters.tail && woken_cnt < nr) {
+    struct list_elem*        next = elem->next;
+    struct wait_queue_entry* entry=
+        elem2entry (struct wait_queue_entry, tag, elem);
+    if (entry->key == key) {
+      wait_queue_wake_entry (entry);
+      woken_cnt++;
+    }
+    elem= next;
+  }
+  intr_set_status (old_status);
+  return woken_cnt;
+}
+
+bool
+wait_queue_empty (struct wait_queue* wq) {
+  return list_empty (&wq->waiters);
+}
+
+void
+semaphore_init (struct semaphore* psem, uint32_t value) {
   psem->value= value;
-  list_init (&psem->waiters);
+  wait_queue_init (&psem->waiters);
 }
 
 void
@@ -13,6 +187,14 @@ lock_init (struct lock* lock) {
   lock->holder           = NULL;
   lock->holder_repeat_num= 0;
   semaphore_init (&lock->semaphore, 1);
+  lock->semaphore.waiters.reason= BLOCK_LOCK;
+  lock->stat.name            = NULL;
+  lock->stat.acquire_cnt     = 0;
+  lock->stat.contended_cnt   = 0;
+  lock->stat.inversion_cnt   = 0;
+  lock->stat.inversion_ns    = 0;
+  lock->stat.inversion_max_ns= 0;
+  lock->stat.inverting       = false;
 }
 
 void
@@ -20,48 +202,162 @@ semaphore_down (struct semaphore* psem) {
   enum intr_status old_status= intr_disable ();
 
   while (psem->value == 0) {
-    struct task_struct* cur= running_thread ();
-    ASSERT (!list_find (&psem->waiters, &cur->general_tag));
-    list_append (&psem->waiters, &cur->general_tag);
-    thread_block (TASK_BLOCKED);
+    wait_queue_wait (&psem->waiters, true, 0);
   }
 
   psem->value--;
-  ASSERT (psem->value == 0);
   intr_set_status (old_status);
 }
 
-void
-semaphore_up (struct semaphore* psem) {
+/* 在u_seconds微秒内获得信号量返回true,超时返回false */
+bool
+semaphore_down_timeout (struct semaphore* psem, uint32_t u_seconds) {
   enum intr_status old_status= intr_disable ();
-  ASSERT (psem->value == 0);
+  uint64_t         deadline  = wait_deadline (u_seconds);
 
-  if (!list_empty (&psem->waiters)) {
-    struct task_struct* waiter=
-        elem2entry (struct task_struct, general_tag, list_pop (&psem->waiters));
-    thread_unblock (waiter);
+  while (psem->value == 0) {
+    struct wait_queue_entry entry;
+    wait_queue_add (&psem->waiters, &entry, true);
+    if (!wait_queue_sleep_until (&entry, deadline)) {
+      intr_set_status (old_status);
+      return false;
+    }
   }
 
+  psem->value--;
+  intr_set_status (old_status);
+  return true;
+}
+
+/* 信号量加1,只唤醒一个等待者,避免惊群 */
+void
+semaphore_up (struct semaphore* psem) {
+  enum intr_status old_status= intr_disable ();
   psem->value++;
-  ASSERT (psem->value == 1);
+  wait_queue_wake (&psem->waiters, 1);
   intr_set_status (old_status);
 }
 
+/* 修改任务的当前优先级,时间片按差值同步增减 */
+static void
+task_set_priority (struct task_struct* task, uint8_t prio) {
+  if (prio > task->priority) {
+    task->ticks+= prio - task->priority;
+  }
+  else if (task->ticks > prio) {
+    task->ticks= prio;
+  }
+  task->priority= prio;
+}
+
+/* 锁plock上等待者的最高优先级,没有等待者时为0 */
+static uint8_t
+lock_waiter_priority (struct lock* plock) {
+  uint8_t           prio   = 0;
+  struct list*      waiters= &plock->semaphore.waiters.waiters;
+  struct list_elem* elem   = waiters->head.next;
+  while (elem != &waiters->tail) {
+    struct wait_queue_entry* entry=
+        elem2entry (struct wait_queue_entry, tag, elem);
+    if (entry->task->priority > prio) {
+      prio= entry->task->priority;
+    }
+    elem= elem->next;
+  }
+  return prio;
+}
+
+/* 重新计算任务的优先级:取自身的基础优先级与所持各锁上最高等待者的较大值 */
+static void
+lock_refresh_priority (struct task_struct* task) {
+  uint8_t           prio     = task->base_priority;
+  struct list_elem* lock_elem= task->held_locks.head.next;
+  while (lock_elem != &task->held_locks.tail) {
+    struct lock* plock= elem2entry (struct lock, holder_tag, lock_elem);
+    uint8_t      wprio= lock_waiter_priority (plock);
+    if (wprio > prio) {
+      prio= wprio;
+    }
+    lock_elem= lock_elem->next;
+  }
+  task_set_priority (task, prio);
+}
+
+/* 把优先级prio捐赠给锁plock的持有者,若持有者也在等锁则沿锁链继续捐赠 */
+static void
+lock_donate_priority (struct lock* plock, uint8_t prio) {
+  uint32_t depth= 0;
+  while (plock != NULL && depth < LOCK_DONATE_DEPTH) {
+    struct task_struct* holder= plock->holder;
+    if (holder == NULL || holder->priority >= prio) {
+      break;
+    }
+    task_set_priority (holder, prio);
+
+    /* 持有者已就绪时移到就绪队列最前面,使其尽快运行并释放锁 */
+    if (holder->status == TASK_READY) {
+      list_remove (&holder->general_tag);
+      list_push (&thread_ready_list, &holder->general_tag);
+    }
+    plock= holder->waiting_lock;
+    depth++;
+  }
+}
+
+/* 持有者释放锁,结束本次优先级反转的计时 */
+static void
+lock_stat_inversion_end (struct lock* plock) {
+  if (!plock->stat.inverting) {
+    return;
+  }
+  uint64_t duration     = ktime_get_ns () - plock->stat.inversion_start;
+  plock->stat.inverting = false;
+  plock->stat.inversion_ns+= duration;
+  if (duration > plock->stat.inversion_max_ns) {
+    plock->stat.inversion_max_ns= duration;
+  }
+}
+
 /**
  * 申请锁.
  */
 void
 lock_acquire (struct lock* plock) {
   struct task_struct* cur= running_thread ();
-  if (plock->holder != cur) {
-    semaphore_down (&plock->semaphore);
+  if (plock->holder == cur) {
+    plock->holder_repeat_num++;
+    return;
+  }
+
+  enum intr_status old_status= intr_disable ();
+  if (plock->holder == NULL) {
+    semaphore_down (&plock->semaphore); // 锁空闲,不会阻塞
     plock->holder= cur;
-    ASSERT (plock->holder_repeat_num == 0);
-    plock->holder_repeat_num= 1;
+    list_append (&cur->held_locks, &plock->holder_tag);
   }
   else {
-    plock->holder_repeat_num++;
+    /* 锁被占用,把自己的优先级捐赠给持有者后等待持有者把锁直接交给自己 */
+    plock->stat.contended_cnt++;
+    /* 只与持有者的基础优先级比较,持有者因别的锁被提升的不影响本锁的统计 */
+    if (cur->priority > plock->holder->base_priority
+        && !plock->stat.inverting) {
+      plock->stat.inversion_cnt++;
+      plock->stat.inversion_start= ktime_get_ns ();
+      plock->stat.inverting      = true;
+    }
+    cur->waiting_lock= plock;
+    lock_donate_priority (plock, cur->priority);
+
+    struct wait_queue_entry entry;
+    wait_queue_add (&plock->semaphore.waiters, &entry, true);
+    wait_queue_sleep (&entry, 0);
+    ASSERT (plock->holder == cur);
+    cur->waiting_lock= NULL;
   }
+  ASSERT (plock->holder_repeat_num == 0);
+  plock->holder_repeat_num= 1;
+  plock->stat.acquire_cnt++;
+  intr_set_status (old_status);
 }
 
 /**
@@ -69,7 +365,8 @@ lock_acquire (struct lock* plock) {
  */
 void
 lock_release (struct lock* plock) {
-  ASSERT (plock->holder == running_thread ());
+  struct task_struct* cur= running_thread ();
+  ASSERT (plock->holder == cur);
 
   if (plock->holder_repeat_num > 1) {
     plock->holder_repeat_num--;
@@ -78,7 +375,220 @@ lock_release (struct lock* plock) {
 
   ASSERT (plock->holder_repeat_num == 1);
 
-  plock->holder           = NULL;
-  plock->holder_repeat_num= 0;
-  semaphore_up (&plock->semaphore);
+  enum intr_status old_status= intr_disable ();
+  plock->holder_repeat_num   = 0;
+  list_remove (&plock->holder_tag);
+  lock_stat_inversion_end (plock);
+
+  struct task_struct* next= NULL;
+  if (wait_queue_empty (&plock->semaphore.waiters)) {
+    plock->holder= NULL;
+    semaphore_up (&plock->semaphore);
+  }
+  else {
+    /* 直接把锁交给优先级最高的等待者,避免被其它任务抢走后捐赠失效 */
+    struct wait_queue_entry* entry=
+        wait_queue_max_exclusive (&plock->semaphore.waiters);
+    next         = entry->task;
+    plock->holder= next;
+    list_append (&next->held_locks, &plock->holder_tag);
+    wait_queue_wake_entry (entry);
+    lock_refresh_priority (next);
+
+    /* 本锁剩余等待者的优先级仍高于新持有者的基础优先级,反转继续.
+     * 新持有者因等待其它锁的任务被提升不算本锁的反转 */
+    if (lock_waiter_priority (plock) > next->base_priority) {
+      plock->stat.inversion_cnt++;
+      plock->stat.inversion_start= ktime_get_ns ();
+      plock->stat.inverting      = true;
+    }
+  }
+
+  /* 归还捐赠来的优先级,若被唤醒的任务优先级更高就让出cpu */
+  lock_refresh_priority (cur);
+  if (next != NULL && next->priority > cur->priority) {
+    thread_yield ();
+  }
+  intr_set_status (old_status);
+}
+
+/* 登记锁plock,使其统计信息能被lock_stat_print输出 */
+void
+lock_stat_register (struct lock* plock, const char* name) {
+  enum intr_status old_status= intr_disable ();
+  if (lock_stat_list.head.next == NULL) {
+    list_init (&lock_stat_list);
+  }
+  plock->stat.name= name;
+  list_append (&lock_stat_list, &plock->stat.stat_tag);
+  intr_set_status (old_status);
+}
+
+/**
+ * 把已登记的第idx把锁的统计复制到info,idx超出范围时返回-1.
+ * 依次取到返回-1为止即可列出全部,正在进行的反转计入inversion_ns.
+ */
+int32_t
+sys_lock_stat (uint32_t idx, struct lock_stat_info* info) {
+  if (info == NULL) {
+    return -1;
+  }
+  enum intr_status old_status= intr_disable ();
+  if (lock_stat_list.head.next == NULL) {
+    intr_set_status (old_status);
+    return -1;
+  }
+  struct list_elem* elem= lock_stat_list.head.next;
+  while (elem != &lock_stat_list.tail && idx > 0) {
+    elem= elem->next;
+    idx--;
+  }
+  if (elem == &lock_stat_list.tail) {
+    intr_set_status (old_status);
+    return -1;
+  }
+  struct lock_stat* stat= elem2entry (struct lock_stat, stat_tag, elem);
+  uint32_t          len = strlen (stat->name);
+  if (len >= sizeof (info->name)) {
+    len= sizeof (info->name) - 1;
+  }
+  memcpy (info->name, stat->name, len);
+  info->name[len]       = '\0';
+  info->acquire_cnt     = stat->acquire_cnt;
+  info->contended_cnt   = stat->contended_cnt;
+  info->inversion_cnt   = stat->inversion_cnt;
+  info->inversion_ns    = stat->inversion_ns;
+  info->inversion_max_ns= stat->inversion_max_ns;
+  if (stat->inverting) {
+    info->inversion_ns+= ktime_get_ns () - stat->inversion_start;
+  }
+  intr_set_status (old_status);
+  return 0;
+}
+
+/* 打印已登记锁的竞争及优先级反转统计,时长单位为微秒 */
+void
+lock_stat_print (void) {
+  if (lock_stat_list.head.next == NULL) {
+    return;
+  }
+  struct list_elem* elem= lock_stat_list.head.next;
+  while (elem != &lock_stat_list.tail) {
+    struct lock_stat* stat= elem2entry (struct lock_stat, stat_tag, elem);
+    printk ("%s: acquire %d, contended %d, inversion %d, total %dus, max %dus\n",
+            stat->name, stat->acquire_cnt, stat->contended_cnt,
+            stat->inversion_cnt,
+            (uint32_t) div_u64_rem (stat->inversion_ns, NSEC_PER_USEC, NULL),
+            (uint32_t) div_u64_rem (stat->inversion_max_ns, NSEC_PER_USEC,
+                                    NULL));
+    elem= elem->next;
+  }
+}
+
+void
+condition_init (struct condition* cond) {
+  wait_queue_init (&cond->waiters);
+}
+
+/* 释放锁并等待条件成立,被唤醒后重新获得锁.
+ * 先入队再释放锁,中间不会丢失唤醒;返回后调用者须重新检查条件 */
+bool
+condition_wait_timeout (struct condition* cond, struct lock* plock,
+                        uint32_t u_seconds) {
+  ASSERT (plock->holder == running_thread ());
+  ASSERT (plock->holder_repeat_num == 1);
+
+  enum intr_status        old_status= intr_disable ();
+  struct wait_queue_entry entry;
+  wait_queue_add (&cond->waiters, &entry, true);
+  lock_release (plock);
+  bool woken= wait_queue_sleep (&entry, u_seconds);
+  intr_set_status (old_status);
+
+  lock_acquire (plock);
+  return woken;
+}
+
+void
+condition_wait (struct condition* cond, struct lock* plock) {
+  condition_wait_timeout (cond, plock, 0);
+}
+
+/* 唤醒一个等待条件的任务 */
+void
+condition_signal (struct condition* cond) {
+  wait_queue_wake (&cond->waiters, 1);
+}
+
+/* 唤醒所有等待条件的任务 */
+void
+condition_broadcast (struct condition* cond) {
+  wait_queue_wake_all (&cond->waiters);
+}
+
+void
+rwlock_init (struct rwlock* rw) {
+  rw->readers        = 0;
+  rw->writers_waiting= 0;
+  rw->writer         = NULL;
+  wait_queue_init (&rw->read_waiters);
+  wait_queue_init (&rw->write_waiters);
+  rw->read_waiters.reason = BLOCK_LOCK;
+  rw->write_waiters.reason= BLOCK_LOCK;
+}
+
+/* 申请读锁,有写者持有或等待时排队 */
+void
+rwlock_read_acquire (struct rwlock* rw) {
+  enum intr_status old_status= intr_disable ();
+  ASSERT (rw->writer != running_thread ());
+  if (rw->writer == NULL && rw->writers_waiting == 0) {
+    rw->readers++;
+  }
+  else {
+    /* 被唤醒时写者已经把读锁交给了这一批读者,readers已经计入自己 */
+    wait_queue_wait (&rw->read_waiters, false, 0);
+  }
+  intr_set_status (old_status);
+}
+
+/* 释放读锁,最后一个读者离开时唤醒一个写者 */
+void
+rwlock_read_release (struct rwlock* rw) {
+  enum intr_status old_status= intr_disable ();
+  ASSERT (rw->readers > 0);
+  if (--rw->readers == 0) {
+    wait_queue_wake (&rw->write_waiters, 1);
+  }
+  intr_set_status (old_status);
+}
+
+/* 申请写锁 */
+void
+rwlock_write_acquire (struct rwlock* rw) {
+  enum intr_status    old_status= intr_disable ();
+  struct task_struct* cur       = running_thread ();
+  ASSERT (rw->writer != cur);
+  while (rw->writer != NULL || rw->readers > 0) {
+    rw->writers_waiting++;
+    wait_queue_wait (&rw->write_waiters, true, 0);
+    rw->writers_waiting--;
+  }
+  rw->writer= cur;
+  intr_set_status (old_status);
+}
+
+/* 释放写锁,优先放行排队的全部读者,没有读者时再交给下一个写者 */
+void
+rwlock_write_release (struct rwlock* rw) {
+  enum intr_status old_status= intr_disable ();
+  ASSERT (rw->writer == running_thread ());
+  rw->writer= NULL;
+  if (!wait_queue_empty (&rw->read_waiters)) {
+    rw->readers+= wait_queue_wake_all (&rw->read_waiters);
+  }
+  else {
+    wait_queue_wake (&rw->write_waiters, 1);
+  }
+  intr_set_status (old_status);
 }
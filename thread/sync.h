@@ -1,29 +1,125 @@
 #ifndef _THREAD_SYNC_H
 #define _THREAD_SYNC_H
 
+#include "global.h"
 #include "kernel/list.h"
 #include "stdint.h"
 #include "thread.h"
 
+/**
+ * 等待队列中的一项,分配在等待者自己的栈上.
+ * 独占等待者每次只唤醒一个,非独占等待者一次全部唤醒.
+ */
+struct wait_queue_entry {
+  struct task_struct* task;
+  struct list_elem    tag; // 在等待队列中的结点
+  bool                exclusive;
+  bool                woken;     // 已被wait_queue_wake唤醒
+  bool                timed_out; // 等待超时
+  uint32_t            key; // 等待的对象,多个对象共用一个队列时用于区分
+  uint8_t             reason; // 阻塞原因,取自等待队列
+};
+
+/**
+ * 等待队列.
+ */
+struct wait_queue {
+  struct list waiters;
+  uint8_t     reason; // 在此等待的任务的阻塞原因,默认为BLOCK_WAIT
+};
+
 /**
  * 信号量.
  */
 struct semaphore {
-  uint8_t     value;
-  struct list waiters;
+  uint32_t          value;
+  struct wait_queue waiters;
+};
+
+/**
+ * 锁的竞争与优先级反转统计.
+ */
+struct lock_stat {
+  const char*      name;
+  struct list_elem stat_tag;         // 在已登记统计的锁队列中的结点
+  uint32_t         acquire_cnt;      // 获得锁的次数
+  uint32_t         contended_cnt;    // 需要等待的次数
+  uint32_t         inversion_cnt;    // 发生优先级反转的次数
+  uint64_t         inversion_ns;     // 优先级反转的累计时长
+  uint64_t         inversion_max_ns; // 单次优先级反转的最长时长
+  uint64_t         inversion_start;  // 本次优先级反转的开始时刻
+  bool             inverting;        // 是否正处于优先级反转中
+};
+
+/* sys_lock_stat复制给用户的一把锁的统计,时长单位为纳秒 */
+struct lock_stat_info {
+  char     name[16];
+  uint32_t acquire_cnt;
+  uint32_t contended_cnt;
+  uint32_t inversion_cnt;
+  uint64_t inversion_ns;
+  uint64_t inversion_max_ns;
 };
 
 struct lock {
   struct task_struct* holder;
   struct semaphore    semaphore;
   uint32_t            holder_repeat_num;
+  struct list_elem    holder_tag; // 在持有者held_locks队列中的结点
+  struct lock_stat    stat;
+};
+
+/**
+ * 读写锁,写者优先:有写者在等待时新来的读者需要排队,
+ * 写者释放锁时一次放行所有排队的读者,读者不会被连续的写者饿死.
+ * 读锁不可重入,持有写锁时也不能再申请读锁.
+ */
+struct rwlock {
+  uint32_t            readers;         // 持有读锁的任务数
+  uint32_t            writers_waiting; // 等待写锁的任务数
+  struct task_struct* writer;          // 持有写锁的任务
+  struct wait_queue   read_waiters;    // 等待读锁的任务,一批全部唤醒
+  struct wait_queue   write_waiters;   // 等待写锁的任务,每次唤醒一个
+};
+
+/**
+ * 条件变量,须与一把锁配合使用.
+ */
+struct condition {
+  struct wait_queue waiters;
 };
 
-void semaphore_init (struct semaphore* psem, uint8_t value);
-void lock_init (struct lock* lock);
-void semaphore_down (struct semaphore* psem);
-void semaphore_up (struct semaphore* psem);
-void lock_acquire (struct lock* plock);
-void lock_release (struct lock* plock);
+void     wait_queue_init (struct wait_queue* wq);
+void     wait_queue_add (struct wait_queue* wq, struct wait_queue_entry* entry,
+                         bool exclusive);
+bool     wait_queue_sleep (struct wait_queue_entry* entry, uint32_t u_seconds);
+bool     wait_queue_wait (struct wait_queue* wq, bool exclusive,
+                          uint32_t u_seconds);
+uint32_t wait_queue_wake (struct wait_queue* wq, uint32_t nr_exclusive);
+uint32_t wait_queue_wake_all (struct wait_queue* wq);
+uint32_t wait_queue_wake_key (struct wait_queue* wq, uint32_t key,
+                              uint32_t nr);
+bool     wait_queue_empty (struct wait_queue* wq);
+void     semaphore_init (struct semaphore* psem, uint32_t value);
+void     lock_init (struct lock* lock);
+void     semaphore_down (struct semaphore* psem);
+bool     semaphore_down_timeout (struct semaphore* psem, uint32_t u_seconds);
+void     semaphore_up (struct semaphore* psem);
+void     lock_acquire (struct lock* plock);
+void     lock_release (struct lock* plock);
+void     lock_stat_register (struct lock* plock, const char* name);
+void     lock_stat_print (void);
+int32_t  sys_lock_stat (uint32_t idx, struct lock_stat_info* info);
+void     condition_init (struct condition* cond);
+void     condition_wait (struct condition* cond, struct lock* plock);
+bool     condition_wait_timeout (struct condition* cond, struct lock* plock,
+                                 uint32_t u_seconds);
+void     condition_signal (struct condition* cond);
+void     condition_broadcast (struct condition* cond);
+void     rwlock_init (struct rwlock* rw);
+void     rwlock_read_acquire (struct rwlock* rw);
+void     rwlock_read_release (struct rwlock* rw);
+void     rwlock_write_acquire (struct rwlock* rw);
+void     rwlock_write_release (struct rwlock* rw);
 
 #endif
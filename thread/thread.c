@@ -1,5 +1,8 @@
 #include "thread.h"
+#include "bitmap.h"
+#include "clocksource.h"
 #include "debug.h"
+#include "fs.h"
 #include "global.h"
 #include "interrupt.h"
 #include "memory.h"
@@ -8,6 +11,30 @@
 #include "stdint.h"
 #include "string.h"
 #include "sync.h"
+#include "systrace.h"
+#include "timer.h"
+#include "uring.h"
+#include "vdso.h"
+
+#define MAX_PID_CNT 1024 // pid从1开始,0表示没有任务
+#define PCB_CACHE_MAX 16 // 缓存的空闲pcb页上限
+
+/* pid池,回收的pid可再分配 */
+static uint8_t       pid_bits[MAX_PID_CNT / 8];
+static struct bitmap pid_bitmap= {MAX_PID_CNT / 8, pid_bits};
+static struct lock   pid_lock; // 分配pid锁
+
+/* 回收的pcb页,内核栈与pcb同页,一并复用 */
+static struct list pcb_cache;
+static uint32_t    pcb_cache_cnt;
+
+/* 任务退出时唤醒等待在此的父任务,等待对象为父任务的pid */
+static struct wait_queue child_exit_queue;
+
+/* 回收孤儿和主线程创建的任务 */
+static struct task_struct* reaper_thread;
+
+static uint32_t nr_switches; // 任务切换总次数
 
 extern void switch_to (struct task_struct* cur, struct task_struct* next);
 
@@ -15,9 +42,13 @@ extern void switch_to (struct task_struct* cur, struct task_struct* next);
 static void
 idle (void* arg) {
   while (1) {
-    thread_block (TASK_BLOCKED);
+    thread_block_reason (TASK_BLOCKED, BLOCK_IDLE);
+    intr_disable ();
+    timer_idle_enter (); // 停掉周期时钟,只在最近的定时器到期时产生中断
     // 执行hlt时必须要保证目前处在开中断的情况下
     asm volatile ("sti; hlt" : : : "memory");
+    intr_disable ();
+    timer_idle_exit (); // 被其它中断唤醒,恢复周期时钟
   }
 }
 
@@ -36,16 +67,56 @@ kernel_thread (thread_func* function, void* func_arg) {
   /* 执行function前要开中断,避免后面的时钟中断被屏蔽,而无法调度其它线程 */
   intr_enable ();
   function (func_arg);
+  thread_exit (0);
 }
 
-/* 分配pid */
+/* 分配pid,优先复用最小的空闲pid */
 static pid_t
 allocate_pid (void) {
-  static pid_t next_pid= 0;
   lock_acquire (&pid_lock);
-  next_pid++;
+  int32_t bit_idx= bitmap_scan (&pid_bitmap, 1);
+  if (bit_idx == -1) {
+    PANIC ("allocate_pid: no free pid\n");
+  }
+  bitmap_set (&pid_bitmap, bit_idx, 1);
+  lock_release (&pid_lock);
+  return bit_idx + 1;
+}
+
+/* 释放pid */
+static void
+release_pid (pid_t pid) {
+  lock_acquire (&pid_lock);
+  bitmap_set (&pid_bitmap, pid - 1, 0);
   lock_release (&pid_lock);
-  return next_pid;
+}
+
+/* 申请一页做pcb,优先复用已回收的pcb */
+struct task_struct*
+thread_pcb_alloc (void) {
+  enum intr_status old_status= intr_disable ();
+  if (!list_empty (&pcb_cache)) {
+    struct list_elem* elem= list_pop (&pcb_cache);
+    pcb_cache_cnt--;
+    intr_set_status (old_status);
+    return elem2entry (struct task_struct, general_tag, elem);
+  }
+  intr_set_status (old_status);
+  return get_kernel_pages (1);
+}
+
+/* 归还pcb页,缓存已满时才真正释放 */
+static void
+thread_pcb_free (struct task_struct* pcb) {
+  enum intr_status old_status= intr_disable ();
+  if (pcb_cache_cnt < PCB_CACHE_MAX) {
+    list_push (&pcb_cache, &pcb->general_tag);
+    pcb_cache_cnt++;
+    intr_set_status (old_status);
+    return;
+  }
+  intr_set_status (old_status);
+  mfree_kernel_pages (pcb, 1);
 }
 
 /* 初始化线程栈thread_stack,将待执行的函数和参数放到thread_stack中相应的位置 */
@@ -70,9 +141,19 @@ thread_create (struct task_struct* pthread, thread_func function,
 void
 init_thread (struct task_struct* pthread, char* name, int prio) {
   memset (pthread, 0, sizeof (*pthread));
+  list_init (&pthread->held_locks);
   pthread->pid= allocate_pid ();
   strcpy (pthread->name, name);
 
+  /* 主线程从不回收子任务,它创建的任务交给reaper */
+  struct task_struct* cur= running_thread ();
+  if (cur == main_thread || cur == pthread) {
+    pthread->parent_pid= reaper_thread == NULL ? 0 : reaper_thread->pid;
+  }
+  else {
+    pthread->parent_pid= cur->pid;
+  }
+
   if (pthread == main_thread) {
     /* 由于把main函数也封装成一个线程,并且它一直是运行的,故将其直接设为TASK_RUNNING
      */
@@ -85,6 +166,7 @@ init_thread (struct task_struct* pthread, char* name, int prio) {
   /* self_kstack是线程自己在内核态下使用的栈顶地址 */
   pthread->self_kstack  = (uint32_t*) ((uint32_t) pthread + PG_SIZE);
   pthread->priority     = prio;
+  pthread->base_priority= prio;
   pthread->ticks        = prio;
   pthread->elapsed_ticks= 0;
   pthread->pgdir        = NULL;
@@ -100,6 +182,7 @@ init_thread (struct task_struct* pthread, char* name, int prio) {
     fd_idx++;
   }
   pthread->cwd_inode_nr= 0;          // 以根目录做为默认工作路径
+  pthread->sched_stat.last_switch= ktime_get_ns (); // 从此刻起在就绪队列中等待
   pthread->stack_magic = 0x19870916; // 自定义的魔数
 }
 
@@ -107,7 +190,7 @@ init_thread (struct task_struct* pthread, char* name, int prio) {
 struct task_struct*
 thread_start (char* name, int prio, thread_func function, void* func_arg) {
   /* pcb都位于内核空间,包括用户进程的pcb也是在内核空间 */
-  struct task_struct* thread= get_kernel_pages (1);
+  struct task_struct* thread= thread_pcb_alloc ();
   init_thread (thread, name, prio);
   thread_create (thread, function, func_arg);
 
@@ -138,12 +221,43 @@ make_main_thread (void) {
   list_append (&thread_all_list, &main_thread->all_list_tag);
 }
 
+/* 记录cur换下,next换上时的调度统计,preempted表示cur是被抢占的 */
+static void
+sched_stat_switch (struct task_struct* cur, struct task_struct* next,
+                   bool preempted) {
+  uint64_t           now     = ktime_get_ns ();
+  struct sched_stat* cur_stat= &cur->sched_stat;
+  cur_stat->run_ns+= now - cur_stat->last_switch;
+  cur_stat->last_switch= now; // 此后记录的是cur进入就绪队列或阻塞的时刻
+  if (next == cur) {          // 只有cur可运行,继续运行不算切换
+    return;
+  }
+
+  if (preempted) {
+    cur_stat->nivcsw++;
+  }
+  else {
+    cur_stat->nvcsw++;
+  }
+  nr_switches++;
+
+  struct sched_stat* next_stat= &next->sched_stat;
+  uint64_t           wait_ns  = now - next_stat->last_switch;
+  next_stat->wait_ns+= wait_ns;
+  if (wait_ns > next_stat->wait_max_ns) {
+    next_stat->wait_max_ns= wait_ns;
+  }
+  next_stat->run_cnt++;
+  next_stat->last_switch= now;
+}
+
 /* 实现任务调度 */
 void
 schedule () {
   ASSERT (intr_get_status () == INTR_OFF);
 
-  struct task_struct* cur= running_thread ();
+  struct task_struct* cur      = running_thread ();
+  bool                preempted= cur->status == TASK_RUNNING;
   if (cur->status ==
       TASK_RUNNING) { // 若此线程只是cpu时间片到了,将其加入到就绪队列尾
     ASSERT (!list_find (&thread_ready_list, &cur->general_tag));
@@ -168,6 +282,7 @@ schedule () {
   struct task_struct* next=
       elem2entry (struct task_struct, general_tag, thread_tag);
   next->status= TASK_RUNNING;
+  sched_stat_switch (cur, next, preempted);
 
   /* 击活任务页表等 */
   process_activate (next);
@@ -178,12 +293,20 @@ schedule () {
 /* 当前线程将自己阻塞,标志其状态为stat. */
 void
 thread_block (enum task_status stat) {
+  thread_block_reason (stat, BLOCK_WAIT);
+}
+
+/* 当前线程因reason阻塞,标志其状态为stat. */
+void
+thread_block_reason (enum task_status stat, enum block_reason reason) {
   /* stat取值为TASK_BLOCKED,TASK_WAITING,TASK_HANGING,也就是只有这三种状态才不会被调度*/
   ASSERT (((stat == TASK_BLOCKED) || (stat == TASK_WAITING) ||
            (stat == TASK_HANGING)));
   enum intr_status    old_status= intr_disable ();
   struct task_struct* cur_thread= running_thread ();
   cur_thread->status            = stat; // 置其状态为stat
+
+  cur_thread->sched_stat.block_reason= reason;
   schedule ();                          // 将当前线程换下处理器
   /* 待当前线程被解除阻塞后才继续运行下面的intr_set_status */
   intr_set_status (old_status);
@@ -204,6 +327,13 @@ thread_unblock (struct task_struct* pthread) {
     list_push (&thread_ready_list,
                &pthread->general_tag); // 放到队列的最前面,使其尽快得到调度
     pthread->status= TASK_READY;
+
+    /* 记录阻塞的时长,此后开始计算就绪等待时长 */
+    struct sched_stat* stat= &pthread->sched_stat;
+    uint64_t           now = ktime_get_ns ();
+    stat->block_ns[stat->block_reason]+= now - stat->last_switch;
+    stat->block_cnt[stat->block_reason]++;
+    stat->last_switch= now;
   }
   intr_set_status (old_status);
 }
@@ -220,6 +350,211 @@ thread_yield (void) {
   intr_set_status (old_status);
 }
 
+/* 根据pid找任务,找不到返回NULL */
+struct task_struct*
+pid2thread (pid_t pid) {
+  enum intr_status  old_status= intr_disable ();
+  struct task_struct* found  = NULL;
+  struct list_elem*   elem   = thread_all_list.head.next;
+  while (elem != &thread_all_list.tail) {
+    struct task_struct* pthread=
+        elem2entry (struct task_struct, all_list_tag, elem);
+    if (pthread->pid == pid) {
+      found= pthread;
+      break;
+    }
+    elem= elem->next;
+  }
+  intr_set_status (old_status);
+  return found;
+}
+
+/**
+ * 当前任务退出,状态为status.
+ * 任务在此释放打开的文件和用户空间,然后挂起成为僵尸,
+ * 页目录,虚拟地址位图,pcb和pid由父任务或reaper回收.
+ */
+void
+thread_exit (int32_t status) {
+  struct task_struct* cur= running_thread ();
+  ASSERT (cur != main_thread && cur != idle_thread && cur != reaper_thread);
+  ASSERT (list_empty (&cur->held_locks));
+  cur->exit_status= status;
+
+  /* 先停下异步I/O,它还在使用进程的文件和用户空间 */
+  uring_exit (cur);
+
+  uint8_t fd_idx= 3;
+  while (fd_idx < MAX_FILES_OPEN_PER_PROC) {
+    if (cur->fd_table[fd_idx] != -1) {
+      sys_close (fd_idx);
+    }
+    fd_idx++;
+  }
+
+  /* 用户空间只能在进程自己的页表下释放 */
+  if (cur->pgdir != NULL) {
+    vdso_unmap (cur);
+    mfree_user_space ();
+  }
+
+  intr_disable ();
+  /* 子任务过继给reaper */
+  bool              adopt_zombie= false;
+  struct list_elem* elem        = thread_all_list.head.next;
+  while (elem != &thread_all_list.tail) {
+    struct task_struct* child=
+        elem2entry (struct task_struct, all_list_tag, elem);
+    if (child->parent_pid == cur->pid) {
+      child->parent_pid= reaper_thread->pid;
+      if (child->status == TASK_HANGING) {
+        adopt_zombie= true;
+      }
+    }
+    elem= elem->next;
+  }
+  if (adopt_zombie) {
+    wait_queue_wake_key (&child_exit_queue, reaper_thread->pid, 0xffffffff);
+  }
+
+  if (pid2thread (cur->parent_pid) == NULL) {
+    cur->parent_pid= reaper_thread->pid;
+  }
+  wait_queue_wake_key (&child_exit_queue, cur->parent_pid, 0xffffffff);
+  thread_block (TASK_HANGING);
+  PANIC ("thread_exit: zombie is scheduled\n");
+}
+
+/* 找parent的子任务中已退出的一个,pid为-1表示任意子任务,
+ * has_child返回是否存在符合条件的子任务.调用时须关中断 */
+static struct task_struct*
+child_zombie_find (pid_t parent, pid_t pid, bool* has_child) {
+  *has_child            = false;
+  struct list_elem* elem= thread_all_list.head.next;
+  while (elem != &thread_all_list.tail) {
+    struct task_struct* child=
+        elem2entry (struct task_struct, all_list_tag, elem);
+    if (child->parent_pid == parent && (pid == -1 || child->pid == pid)) {
+      *has_child= true;
+      if (child->status == TASK_HANGING) {
+        return child;
+      }
+    }
+    elem= elem->next;
+  }
+  return NULL;
+}
+
+/* 等待一个子任务退出,调用时须关中断 */
+static void
+child_exit_wait (pid_t parent) {
+  struct wait_queue_entry entry;
+  wait_queue_add (&child_exit_queue, &entry, false);
+  entry.key= parent;
+  wait_queue_sleep (&entry, 0);
+}
+
+/* 释放僵尸任务剩下的页目录,虚拟地址位图,pid和pcb */
+static void
+thread_reap (struct task_struct* zombie) {
+  if (zombie->pgdir != NULL) {
+    struct bitmap* btmp= &zombie->userprog_vaddr.vaddr_bitmap;
+    mfree_kernel_pages (btmp->bits,
+                        DIV_ROUND_UP (btmp->btmp_bytes_len, PG_SIZE));
+    mfree_kernel_pages (zombie->pgdir, 1);
+    vdso_free (zombie);
+  }
+  systrace_free (zombie);
+  release_pid (zombie->pid);
+  thread_pcb_free (zombie);
+}
+
+/**
+ * 等待子任务pid退出并回收它,pid为-1表示任意子任务.
+ * 返回被回收任务的pid,status带回其退出状态,没有这样的子任务返回-1.
+ */
+pid_t
+thread_join (pid_t pid, int32_t* status) {
+  struct task_struct* cur       = running_thread ();
+  enum intr_status    old_status= intr_disable ();
+  struct task_struct* zombie;
+  bool                has_child;
+
+  while ((zombie= child_zombie_find (cur->pid, pid, &has_child)) == NULL) {
+    if (!has_child) {
+      intr_set_status (old_status);
+      return -1;
+    }
+    child_exit_wait (cur->pid);
+  }
+  /* 摘下后其它任务就看不到它了,可以开中断慢慢释放 */
+  list_remove (&zombie->all_list_tag);
+  intr_set_status (old_status);
+
+  pid_t zombie_pid= zombie->pid;
+  if (status != NULL) {
+    *status= zombie->exit_status;
+  }
+  thread_reap (zombie);
+  return zombie_pid;
+}
+
+/* 回收孤儿和主线程创建的任务 */
+static void
+reaper (void* arg UNUSED) {
+  struct task_struct* cur= running_thread ();
+  while (1) {
+    if (thread_join (-1, NULL) == -1) {
+      /* 暂时没有子任务,等有任务过继过来并退出 */
+      enum intr_status old_status= intr_disable ();
+      bool             has_child;
+      if (child_zombie_find (cur->pid, -1, &has_child) == NULL) {
+        child_exit_wait (cur->pid);
+      }
+      intr_set_status (old_status);
+    }
+  }
+}
+
+/**
+ * 取得全局调度统计和至多cnt个任务的调度统计快照,返回快照中的任务数.
+ * info或tasks为NULL时不取相应的部分.
+ */
+int32_t
+sys_ps (struct sched_info* info, struct task_info* tasks, uint32_t cnt) {
+  enum intr_status    old_status= intr_disable ();
+  uint64_t            now       = ktime_get_ns ();
+  struct task_struct* cur       = running_thread ();
+
+  if (info != NULL) {
+    info->uptime_ns  = now;
+    info->nr_switches= nr_switches;
+    info->nr_tasks   = list_length (&thread_all_list);
+    info->nr_ready   = list_length (&thread_ready_list);
+  }
+
+  uint32_t          filled= 0;
+  struct list_elem* elem  = thread_all_list.head.next;
+  while (tasks != NULL && filled < cnt && elem != &thread_all_list.tail) {
+    struct task_struct* pthread=
+        elem2entry (struct task_struct, all_list_tag, elem);
+    struct task_info* ti= &tasks[filled++];
+    ti->pid             = pthread->pid;
+    ti->parent_pid      = pthread->parent_pid;
+    memcpy (ti->name, pthread->name, sizeof (ti->name));
+    ti->status       = pthread->status;
+    ti->priority     = pthread->priority;
+    ti->elapsed_ticks= pthread->elapsed_ticks;
+    ti->sched_stat   = pthread->sched_stat;
+    if (pthread == cur) { // 当前任务本次上cpu以来的运行时长还未计入
+      ti->sched_stat.run_ns+= now - pthread->sched_stat.last_switch;
+    }
+    elem= elem->next;
+  }
+  intr_set_status (old_status);
+  return filled;
+}
+
 /* 初始化线程环境 */
 void
 thread_init (void) {
@@ -227,7 +562,11 @@ thread_init (void) {
 
   list_init (&thread_ready_list);
   list_init (&thread_all_list);
+  list_init (&pcb_cache);
+  wait_queue_init (&child_exit_queue);
+  child_exit_queue.reason= BLOCK_CHILD;
   lock_init (&pid_lock);
+  lock_stat_register (&pid_lock, "pid");
 
   /* 将当前main函数创建为线程 */
   make_main_thread ();
@@ -235,5 +574,8 @@ thread_init (void) {
   /* 创建idle线程 */
   idle_thread= thread_start ("idle", 10, idle, NULL);
 
+  /* 创建reaper线程 */
+  reaper_thread= thread_start ("reaper", 10, reaper, NULL);
+
   put_str ("thread_init done\n");
 }
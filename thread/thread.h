@@ -12,7 +12,6 @@ struct task_struct*      main_thread;       // 主线程PCB
 struct task_struct*      idle_thread;       // idle线程
 struct list              thread_ready_list; // 就绪队列
 struct list              thread_all_list;   // 所有任务队列
-struct lock*             pid_lock;          // 分配pid锁
 static struct list_elem* thread_tag; // 用于保存队列中的线程结点
 
 typedef void    thread_func (void*);
@@ -28,6 +27,32 @@ enum task_status {
   TASK_DIED
 };
 
+/* 任务阻塞的原因 */
+enum block_reason {
+  BLOCK_WAIT,  // 一般的等待队列,如条件变量
+  BLOCK_SLEEP, // 睡眠
+  BLOCK_LOCK,  // 等锁
+  BLOCK_IO,    // 等待硬盘或键盘等设备
+  BLOCK_FUTEX, // 用户态futex
+  BLOCK_CHILD, // 等待子任务退出
+  BLOCK_IDLE,  // 无事可做,如idle和空闲的工作者线程
+  BLOCK_REASON_CNT
+};
+
+/* 任务的调度统计,时间单位为纳秒 */
+struct sched_stat {
+  uint64_t run_ns;                     // 在cpu上运行的总时长
+  uint64_t wait_ns;                    // 在就绪队列中等待的总时长
+  uint64_t wait_max_ns;                // 单次就绪等待的最长时长
+  uint64_t block_ns[BLOCK_REASON_CNT]; // 按原因统计的阻塞总时长
+  uint32_t block_cnt[BLOCK_REASON_CNT]; // 按原因统计的阻塞次数
+  uint32_t run_cnt;                     // 被调度上cpu的次数
+  uint32_t nvcsw;        // 主动让出cpu的次数,包括阻塞和thread_yield
+  uint32_t nivcsw;       // 时间片用完被抢占的次数
+  uint64_t last_switch;  // 最近一次上cpu,进入就绪队列或阻塞的时刻
+  uint8_t  block_reason; // 当前的阻塞原因
+};
+
 /***********   中断栈intr_stack   ***********
  * 此结构用于中断发生时保护程序(线程或进程)的上下文环境:
  * 进程或线程被外部中断或软中断打断时,会按照此结构压入上下文
@@ -89,7 +114,8 @@ struct task_struct {
   pid_t            pid;
   enum task_status status;
   char             name[16];
-  uint8_t          priority;
+  uint8_t          priority;      // 当前优先级,可能来自锁等待者的捐赠
+  uint8_t          base_priority; // 任务自身的优先级
   uint8_t          ticks; // 每次在处理器上执行的时间嘀嗒数
   /* 此任务自上cpu运行后至今占用了多少cpu嘀嗒数,
    * 也就是此任务执行了多久*/
@@ -103,9 +129,37 @@ struct task_struct {
   struct mem_block_desc u_block_desc[DESC_CNT]; // 用户进程内存块描述符
   int32_t  fd_table[MAX_FILES_OPEN_PER_PROC];   // 已打开文件数组
   uint32_t cwd_inode_nr; // 进程所在的工作目录的inode编号
+  struct lock* waiting_lock; // 正在等待的锁,用于沿锁链捐赠优先级
+  struct list  held_locks;   // 已持有的锁
+  pid_t        parent_pid;   // 父任务的pid,0表示没有父任务
+  int32_t      exit_status;  // 退出状态,由回收者读取
+  struct sched_stat sched_stat; // 调度统计
+  struct vdso_data* vdso; // 用户进程的vdso页(内核虚拟地址),线程为NULL
+  struct uring*     uring; // 进程的异步I/O环
+  uint32_t* borrowed_pgdir; // 代用户进程做I/O的内核线程借用的页目录
+  struct systrace_ring* systrace; // 系统调用跟踪环,未开启过跟踪时为NULL
   uint32_t stack_magic; // 用这串数字做栈的边界标记,用于检测栈的溢出
 };
 
+/* sys_ps返回的单个任务的快照 */
+struct task_info {
+  pid_t             pid;
+  pid_t             parent_pid;
+  char              name[16];
+  uint8_t           status;
+  uint8_t           priority;
+  uint32_t          elapsed_ticks;
+  struct sched_stat sched_stat;
+};
+
+/* sys_ps返回的全局调度统计 */
+struct sched_info {
+  uint64_t uptime_ns;   // 时钟源初始化以来的时长
+  uint32_t nr_switches; // 任务切换总次数
+  uint32_t nr_tasks;    // 任务总数
+  uint32_t nr_ready;    // 就绪队列中的任务数
+};
+
 extern struct list thread_ready_list;
 extern struct list thread_all_list;
 
@@ -118,6 +172,12 @@ struct task_struct* running_thread (void);
 void                schedule (void);
 void                thread_init (void);
 void                thread_block (enum task_status stat);
+void thread_block_reason (enum task_status stat, enum block_reason reason);
 void                thread_unblock (struct task_struct* pthread);
 void                thread_yield (void);
+struct task_struct* thread_pcb_alloc (void);
+struct task_struct* pid2thread (pid_t pid);
+void                thread_exit (int32_t status);
+pid_t               thread_join (pid_t pid, int32_t* status);
+int32_t sys_ps (struct sched_info* info, struct task_info* tasks, uint32_t cnt);
 #endif
@@ -0,0 +1,233 @@
+#include "workqueue.h"
+#include "debug.h"
+#include "interrupt.h"
+#include "print.h"
+#include "string.h"
+
+static struct workqueue system_wq; // 供schedule_work使用的公共工作队列
+
+/* 工作项是否正由wq的某个工作者执行,调用时须关中断 */
+static bool
+work_running (struct workqueue* wq, struct work_struct* work) {
+  uint32_t idx= 0;
+  while (idx < wq->nr_workers) {
+    if (wq->workers[idx].current == work) {
+      return true;
+    }
+    idx++;
+  }
+  return false;
+}
+
+/* 取下一个可执行的工作项,正在别的工作者上执行的跳过,调用时须关中断 */
+static struct work_struct*
+work_next (struct workqueue* wq) {
+  struct list_elem* elem= wq->works.head.next;
+  while (elem != &wq->works.tail) {
+    struct work_struct* work= elem2entry (struct work_struct, entry, elem);
+    if (!work_running (wq, work)) {
+      return work;
+    }
+    elem= elem->next;
+  }
+  return NULL;
+}
+
+/* 工作项入队并唤醒一个空闲的工作者,调用时须关中断 */
+static void
+work_insert (struct workqueue* wq, struct work_struct* work) {
+  list_append (&wq->works, &work->entry);
+  if (wait_queue_wake (&wq->more_work, 1) != 0) {
+    timer_resched (); // 在中断中入队时,让工作者在本次时钟中断后尽快运行
+  }
+}
+
+/* 工作者线程,依次执行队列中的工作项 */
+static void
+worker_thread (void* arg) {
+  struct worker*    worker= arg;
+  struct workqueue* wq    = worker->wq;
+
+  intr_disable ();
+  while (1) {
+    struct work_struct* work= work_next (wq);
+    if (work == NULL) {
+      wait_queue_wait (&wq->more_work, true, 0);
+      continue;
+    }
+    list_remove (&work->entry);
+    work->pending  = false;
+    worker->current= work;
+    work_func* func= work->func;
+    void*      farg= work->arg;
+
+    /* 执行期间开中断,执行完后不再访问work,它可能已被func释放 */
+    intr_enable ();
+    func (farg);
+    intr_disable ();
+
+    worker->current= NULL;
+    wait_queue_wake_all (&wq->done);
+  }
+}
+
+/* 用wq创建名为name的工作队列,启动nr_workers个优先级为prio的工作者线程 */
+void
+workqueue_create (struct workqueue* wq, char* name, uint32_t nr_workers,
+                  int prio) {
+  ASSERT (nr_workers > 0 && nr_workers <= WQ_MAX_WORKERS);
+  ASSERT (strlen (name) < sizeof (wq->name));
+  strcpy (wq->name, name);
+  list_init (&wq->works);
+  wait_queue_init (&wq->more_work);
+  wait_queue_init (&wq->done);
+  wq->more_work.reason= BLOCK_IDLE;
+  wq->nr_workers= nr_workers;
+
+  uint32_t idx= 0;
+  while (idx < nr_workers) {
+    wq->workers[idx].wq     = wq;
+    wq->workers[idx].current= NULL;
+    wq->workers[idx].task=
+        thread_start (name, prio, worker_thread, &wq->workers[idx]);
+    idx++;
+  }
+}
+
+void
+work_init (struct work_struct* work, work_func* func, void* arg) {
+  work->func   = func;
+  work->arg    = arg;
+  work->wq     = NULL;
+  work->pending= false;
+}
+
+void
+delayed_work_init (struct delayed_work* dwork, work_func* func, void* arg) {
+  work_init (&dwork->work, func, arg);
+  memset (&dwork->timer, 0, sizeof (dwork->timer));
+}
+
+/* 将work加入wq,work尚未执行时返回false,可在中断处理程序中调用 */
+bool
+queue_work (struct workqueue* wq, struct work_struct* work) {
+  enum intr_status old_status= intr_disable ();
+  if (work->pending) {
+    intr_set_status (old_status);
+    return false;
+  }
+  work->pending= true;
+  work->wq     = wq;
+  work_insert (wq, work);
+  intr_set_status (old_status);
+  return true;
+}
+
+/* 延迟工作的定时器到期,在时钟中断中把工作项加入队列 */
+static void
+delayed_work_timeout (void* arg) {
+  struct delayed_work* dwork= arg;
+  work_insert (dwork->work.wq, &dwork->work);
+}
+
+/* u_seconds微秒后将dwork加入wq,dwork尚未执行时返回false */
+bool
+queue_delayed_work (struct workqueue* wq, struct delayed_work* dwork,
+                    uint32_t u_seconds) {
+  if (u_seconds == 0) {
+    return queue_work (wq, &dwork->work);
+  }
+
+  enum intr_status old_status= intr_disable ();
+  if (dwork->work.pending) {
+    intr_set_status (old_status);
+    return false;
+  }
+  dwork->work.pending= true;
+  dwork->work.wq     = wq;
+  dwork->timer.func  = delayed_work_timeout;
+  dwork->timer.arg   = dwork;
+  ktimer_add (&dwork->timer, timer_clock_now () + timer_us2clock (u_seconds));
+  intr_set_status (old_status);
+  return true;
+}
+
+bool
+schedule_work (struct work_struct* work) {
+  return queue_work (&system_wq, work);
+}
+
+bool
+schedule_delayed_work (struct delayed_work* dwork, uint32_t u_seconds) {
+  return queue_delayed_work (&system_wq, dwork, u_seconds);
+}
+
+/* 等待work最近一次入队的执行完成 */
+void
+flush_work (struct work_struct* work) {
+  enum intr_status  old_status= intr_disable ();
+  struct workqueue* wq        = work->wq;
+  if (wq != NULL) {
+    while (work->pending || work_running (wq, work)) {
+      wait_queue_wait (&wq->done, false, 0);
+    }
+  }
+  intr_set_status (old_status);
+}
+
+/* 等待wq中所有已入队的工作项执行完,尚在定时器中的延迟工作不等待 */
+void
+flush_workqueue (struct workqueue* wq) {
+  enum intr_status old_status= intr_disable ();
+  while (1) {
+    bool     busy= !list_empty (&wq->works);
+    uint32_t idx = 0;
+    while (!busy && idx < wq->nr_workers) {
+      busy= wq->workers[idx].current != NULL;
+      idx++;
+    }
+    if (!busy) {
+      break;
+    }
+    wait_queue_wait (&wq->done, false, 0);
+  }
+  intr_set_status (old_status);
+}
+
+/* 取消尚未执行的work并等待正在进行的执行结束,work原本在队列中时返回true */
+bool
+cancel_work_sync (struct work_struct* work) {
+  enum intr_status old_status= intr_disable ();
+  bool             pending   = work->pending;
+  if (pending) {
+    list_remove (&work->entry);
+    work->pending= false;
+  }
+  if (work->wq != NULL) {
+    while (work_running (work->wq, work)) {
+      wait_queue_wait (&work->wq->done, false, 0);
+    }
+  }
+  intr_set_status (old_status);
+  return pending;
+}
+
+/* 取消延迟工作并等待正在进行的执行结束,定时器未到期时直接撤销定时器 */
+bool
+cancel_delayed_work_sync (struct delayed_work* dwork) {
+  enum intr_status old_status= intr_disable ();
+  bool             pending   = ktimer_del (&dwork->timer);
+  if (pending) {
+    dwork->work.pending= false;
+  }
+  intr_set_status (old_status);
+  return cancel_work_sync (&dwork->work) || pending;
+}
+
+/* 创建公共工作队列 */
+void
+workqueue_init (void) {
+  put_str ("workqueue_init start\n");
+  workqueue_create (&system_wq, "events", 2, 31);
+  put_str ("workqueue_init done\n");
+}
@@ -0,0 +1,66 @@
+#ifndef __THREAD_WORKQUEUE_H
+#define __THREAD_WORKQUEUE_H
+#include "list.h"
+#include "stdint.h"
+#include "sync.h"
+#include "thread.h"
+#include "timer.h"
+
+#define WQ_MAX_WORKERS 4 // 每个工作队列最多的工作者线程数
+
+typedef void work_func (void*);
+
+/**
+ * 工作项,由工作者线程在进程上下文中执行func(arg).
+ * 同一工作项不会被两个工作者同时执行,func中可以释放工作项自身.
+ */
+struct work_struct {
+  struct list_elem  entry; // 在工作队列中的结点
+  work_func*        func;
+  void*             arg;
+  struct workqueue* wq;      // 最近一次加入的工作队列
+  bool              pending; // 已加入队列或定时器,尚未开始执行
+};
+
+/**
+ * 延迟工作项,定时器到期后才加入工作队列.
+ */
+struct delayed_work {
+  struct work_struct work;
+  struct ktimer      timer;
+};
+
+/* 工作者线程 */
+struct worker {
+  struct task_struct* task;
+  struct workqueue*   wq;
+  struct work_struct* current; // 正在执行的工作项
+};
+
+/**
+ * 工作队列,工作项可在任何上下文(包括中断处理程序)中加入.
+ */
+struct workqueue {
+  char              name[16];
+  struct list       works;     // 待执行的工作项
+  struct wait_queue more_work; // 空闲的工作者线程
+  struct wait_queue done;      // 等待工作项执行完的任务
+  uint32_t          nr_workers;
+  struct worker     workers[WQ_MAX_WORKERS];
+};
+
+void workqueue_init (void);
+void workqueue_create (struct workqueue* wq, char* name, uint32_t nr_workers,
+                       int prio);
+void work_init (struct work_struct* work, work_func* func, void* arg);
+void delayed_work_init (struct delayed_work* dwork, work_func* func, void* arg);
+bool queue_work (struct workqueue* wq, struct work_struct* work);
+bool queue_delayed_work (struct workqueue* wq, struct delayed_work* dwork,
+                         uint32_t u_seconds);
+bool schedule_work (struct work_struct* work);
+bool schedule_delayed_work (struct delayed_work* dwork, uint32_t u_seconds);
+void flush_work (struct work_struct* work);
+void flush_workqueue (struct workqueue* wq);
+bool cancel_work_sync (struct work_struct* work);
+bool cancel_delayed_work_sync (struct delayed_work* dwork);
+#endif
@@ -8,6 +8,7 @@
 #include "string.h"
 #include "thread.h"
 #include "tss.h"
+#include "vdso.h"
 
 extern void intr_exit (void);
 
@@ -46,6 +47,9 @@ page_dir_activate (struct task_struct* p_thread) {
   if (p_thread->pgdir != NULL) { // 用户态进程有自己的页目录表
     pagedir_phy_addr= addr_v2p ((uint32_t) p_thread->pgdir);
   }
+  else if (p_thread->borrowed_pgdir != NULL) { // 代进程做I/O的内核线程
+    pagedir_phy_addr= addr_v2p ((uint32_t) p_thread->borrowed_pgdir);
+  }
 
   /* 更新页目录寄存器cr3,使新页表生效 */
   asm volatile ("movl %0, %%cr3" : : "r"(pagedir_phy_addr) : "memory");
@@ -63,13 +67,15 @@ process_activate (struct task_struct* p_thread) {
   if (p_thread->pgdir) {
     /* 更新该进程的esp0,用于此进程被中断时保留上下文 */
     update_tss_esp (p_thread);
+    /* 不在cpu上时vdso页不更新,换上cpu时补上 */
+    vdso_update (p_thread);
   }
 }
 
-/* 创建页目录表,将当前页表的表示内核空间的pde复制,
- * 成功则返回页目录的虚拟地址,否则返回-1 */
+/* 创建页目录表,将当前页表的表示内核空间的pde复制并映射vdso页,
+ * 成功则返回页目录的虚拟地址,否则返回NULL */
 uint32_t*
-create_page_dir (void) {
+create_page_dir (struct task_struct* user_prog) {
 
   /* 用户进程的页表不能让用户直接访问到,所以在内核空间来申请 */
   uint32_t* page_dir_vaddr= get_kernel_pages (1);
@@ -91,6 +97,15 @@ create_page_dir (void) {
   /* 页目录地址是存入在页目录的最后一项,更新页目录地址为新页目录的物理地址 */
   page_dir_vaddr[1023]= new_page_dir_phy_addr | PG_US_U | PG_RW_W | PG_P_1;
   /*****************************************************************************/
+
+  /************************** 3  映射只读的vdso页
+   * **********************************/
+  if (!vdso_map (user_prog, page_dir_vaddr)) {
+    console_put_str ("create_page_dir: vdso_map failed!");
+    mfree_kernel_pages (page_dir_vaddr, 1);
+    return NULL;
+  }
+  /*****************************************************************************/
   return page_dir_vaddr;
 }
 
@@ -104,17 +119,25 @@ create_user_vaddr_bitmap (struct task_struct* user_prog) {
   user_prog->userprog_vaddr.vaddr_bitmap.btmp_bytes_len=
       (0xc0000000 - USER_VADDR_START) / PG_SIZE / 8;
   bitmap_init (&user_prog->userprog_vaddr.vaddr_bitmap);
+  /* vdso独占整个页目录项,其覆盖的4MB都不参与分配,否则其中的用户页
+   * 会映射在vdso的页表中,进程退出时随vdso_unmap丢失而无法回收 */
+  uint32_t bit_idx= (VDSO_VADDR - USER_VADDR_START) / PG_SIZE;
+  uint32_t pg_idx = 0;
+  while (pg_idx < 1024) {
+    bitmap_set (&user_prog->userprog_vaddr.vaddr_bitmap, bit_idx + pg_idx, 1);
+    pg_idx++;
+  }
 }
 
 /* 创建用户进程 */
 void
 process_execute (void* filename, char* name) {
   /* pcb内核的数据结构,由内核来维护进程信息,因此要在内核内存池中申请 */
-  struct task_struct* thread= get_kernel_pages (1);
+  struct task_struct* thread= thread_pcb_alloc ();
   init_thread (thread, name, default_prio);
   create_user_vaddr_bitmap (thread);
   thread_create (thread, start_process, filename);
-  thread->pgdir= create_page_dir ();
+  thread->pgdir= create_page_dir (thread);
   block_desc_init (thread->u_block_desc);
 
   enum intr_status old_status= intr_disable ();
@@ -9,6 +9,6 @@ void      process_execute (void* filename, char* name);
 void      start_process (void* filename_);
 void      process_activate (struct task_struct* p_thread);
 void      page_dir_activate (struct task_struct* p_thread);
-uint32_t* create_page_dir (void);
+uint32_t* create_page_dir (struct task_struct* user_prog);
 void      create_user_vaddr_bitmap (struct task_struct* user_prog);
 #endif
@@ -1,26 +1,109 @@
 #include "syscall-init.h"
+#include "clocksource.h"
+#include "fs.h"
+#include "futex.h"
+#include "iostat.h"
+#include "memory.h"
 #include "print.h"
 #include "stdint.h"
+#include "sync.h"
 #include "syscall.h"
+#include "systrace.h"
 #include "thread.h"
+#include "uring.h"
 
-#define syscall_nr 32
 typedef void* syscall;
 syscall       syscall_table[syscall_nr];
 
+/* 按最多4个参数调用系统调用,参数由调用者清理,参数少的函数也可这样调用 */
+typedef uint32_t syscall_func (uint32_t, uint32_t, uint32_t, uint32_t);
+
 /* 返回当前任务的pid */
 uint32_t
 sys_getpid (void) {
   return running_thread ()->pid;
 }
 
+/* 未实现的系统调用 */
+int32_t
+sys_nosys (void) {
+  return -1;
+}
+
+/* 结束当前任务,退出状态为status */
+void
+sys_exit (int32_t status) {
+  thread_exit (status);
+}
+
+/* 等待任意一个子任务退出,返回其pid,status带回其退出状态 */
+pid_t
+sys_wait (int32_t* status) {
+  return thread_join (-1, status);
+}
+
+/**
+ * 由kernel.S调用,按子功能号nr调用syscall_table中的函数,
+ * 越界的子功能号调用sys_nosys. 调用前后读时钟源,把时长记入统计.
+ * sys_exit不会返回,也就不会被记下.
+ */
+uint32_t
+syscall_dispatch (uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4,
+                  uint32_t nr) {
+  if (nr >= syscall_nr) {
+    return sys_nosys ();
+  }
+  uint32_t args[4]= {arg1, arg2, arg3, arg4};
+  uint64_t start  = clocksource_read ();
+  uint32_t ret=
+      ((syscall_func*) syscall_table[nr]) (arg1, arg2, arg3, arg4);
+  systrace_account (nr, args, ret, clocksource_read () - start);
+  return ret;
+}
+
 /* 初始化系统调用 */
 void
 syscall_init (void) {
   put_str ("syscall_init start\n");
-  int SYS_GETPID           = 0;
-  int SYS_WRITE            = 0;
-  syscall_table[SYS_GETPID]= sys_getpid ();
-  syscall_table[SYS_WRITE] = sys_write ("");
+  uint32_t nr= 0;
+  while (nr < syscall_nr) {
+    syscall_table[nr]= sys_nosys;
+    nr++;
+  }
+  syscall_table[SYS_GETPID]       = sys_getpid;
+  syscall_table[SYS_WRITE]        = sys_write;
+  syscall_table[SYS_MALLOC]       = sys_malloc;
+  syscall_table[SYS_FREE]         = sys_free;
+  syscall_table[SYS_CLOCK_GETTIME]= sys_clock_gettime;
+  syscall_table[SYS_FUTEX]        = sys_futex;
+  syscall_table[SYS_EXIT]         = sys_exit;
+  syscall_table[SYS_WAIT]         = sys_wait;
+  syscall_table[SYS_PS]           = sys_ps;
+  syscall_table[SYS_OPEN]         = sys_open;
+  syscall_table[SYS_CLOSE]        = sys_close;
+  syscall_table[SYS_READ]         = sys_read;
+  syscall_table[SYS_LSEEK]        = sys_lseek;
+  syscall_table[SYS_UNLINK]       = sys_unlink;
+  syscall_table[SYS_MKDIR]        = sys_mkdir;
+  syscall_table[SYS_OPENDIR]      = sys_opendir;
+  syscall_table[SYS_CLOSEDIR]     = sys_closedir;
+  syscall_table[SYS_READDIR]      = sys_readdir;
+  syscall_table[SYS_REWINDDIR]    = sys_rewinddir;
+  syscall_table[SYS_RMDIR]        = sys_rmdir;
+  syscall_table[SYS_GETCWD]       = sys_getcwd;
+  syscall_table[SYS_CHDIR]        = sys_chdir;
+  syscall_table[SYS_STAT]         = sys_stat;
+  syscall_table[SYS_URING_SETUP]  = sys_uring_setup;
+  syscall_table[SYS_URING_ENTER]  = sys_uring_enter;
+  syscall_table[SYS_READV]        = sys_readv;
+  syscall_table[SYS_WRITEV]       = sys_writev;
+  syscall_table[SYS_PREAD]        = sys_pread;
+  syscall_table[SYS_PWRITE]       = sys_pwrite;
+  syscall_table[SYS_COPY_FILE_RANGE]= sys_copy_file_range;
+  syscall_table[SYS_SYSCALL_STAT] = sys_syscall_stat;
+  syscall_table[SYS_SYSTRACE]     = sys_systrace;
+  syscall_table[SYS_SYSTRACE_READ]= sys_systrace_read;
+  syscall_table[SYS_IOSTAT]       = sys_iostat;
+  syscall_table[SYS_LOCK_STAT]    = sys_lock_stat;
   put_str ("syscall_init done\n");
 }
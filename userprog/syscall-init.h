@@ -1,6 +1,15 @@
 #ifndef __USERPROG_SYSCALLINIT_H
 #define __USERPROG_SYSCALLINIT_H
 #include "stdint.h"
+#include "thread.h"
+
+#define syscall_nr 64 // 系统调用表的大小
+
 void     syscall_init (void);
+uint32_t syscall_dispatch (uint32_t arg1, uint32_t arg2, uint32_t arg3,
+                           uint32_t arg4, uint32_t nr);
 uint32_t sys_getpid (void);
+int32_t  sys_nosys (void);
+void     sys_exit (int32_t status);
+pid_t    sys_wait (int32_t* status);
 #endif
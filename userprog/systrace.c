@@ -0,0 +1,160 @@
+#include "systrace.h"
+#include "interrupt.h"
+#include "memory.h"
+#include "string.h"
+#include "syscall-init.h"
+
+static struct syscall_stat syscall_stats[syscall_nr]; // 按子功能号的统计
+
+/* 时长所在的直方图桶,即其以2为底的对数 */
+static uint32_t
+cycles_bucket (uint64_t cycles) {
+  uint32_t high= (uint32_t) (cycles >> 32);
+  uint32_t low = (uint32_t) cycles;
+  uint32_t bit;
+  if (high != 0) {
+    asm ("bsr %1, %0" : "=r"(bit) : "rm"(high));
+    bit+= 32;
+  }
+  else if (low != 0) {
+    asm ("bsr %1, %0" : "=r"(bit) : "rm"(low));
+  }
+  else {
+    return 0;
+  }
+  return bit < SYSCALL_HIST_BUCKETS ? bit : SYSCALL_HIST_BUCKETS - 1;
+}
+
+/* 在跟踪环尾部追加一条记录,环满时覆盖最旧的,调用时须关中断 */
+static void
+systrace_push (struct systrace_ring* ring, struct systrace_rec* rec) {
+  uint32_t idx= (ring->head + ring->cnt) % SYSTRACE_RECS;
+  ring->recs[idx]= *rec;
+  if (ring->cnt == SYSTRACE_RECS) {
+    ring->head= (ring->head + 1) % SYSTRACE_RECS;
+    ring->dropped++;
+  }
+  else {
+    ring->cnt++;
+  }
+}
+
+/**
+ * 由syscall_dispatch在系统调用返回后调用,记下子功能号nr的一次调用,
+ * args为调用的4个参数,ret为返回值,cycles为调用时长.
+ * 当前进程开启了跟踪时再向其跟踪环追加一条记录.
+ */
+void
+systrace_account (uint32_t nr, uint32_t* args, uint32_t ret, uint64_t cycles) {
+  enum intr_status     old_status= intr_disable ();
+  struct task_struct*  cur       = running_thread ();
+  struct syscall_stat* st        = &syscall_stats[nr];
+
+  st->calls++;
+  if ((int32_t) ret == -1) {
+    st->errors++;
+  }
+  st->cycles+= cycles;
+  st->hist[cycles_bucket (cycles)]++;
+
+  struct systrace_ring* ring= cur->systrace;
+  if (ring != NULL && ring->enabled) {
+    struct systrace_rec rec;
+    rec.pid   = cur->pid;
+    rec.nr    = nr;
+    memcpy (rec.args, args, sizeof (rec.args));
+    rec.ret   = ret;
+    rec.cycles= cycles;
+    systrace_push (ring, &rec);
+  }
+  intr_set_status (old_status);
+}
+
+/* 回收任务时释放其跟踪环 */
+void
+systrace_free (struct task_struct* pthread) {
+  if (pthread->systrace != NULL) {
+    mfree_kernel_pages (pthread->systrace, 1);
+    pthread->systrace= NULL;
+  }
+}
+
+/* 把子功能号nr的统计复制到st,nr无效时返回-1 */
+int32_t
+sys_syscall_stat (uint32_t nr, struct syscall_stat* st) {
+  if (nr >= syscall_nr || st == NULL) {
+    return -1;
+  }
+  enum intr_status old_status= intr_disable ();
+  *st                        = syscall_stats[nr];
+  intr_set_status (old_status);
+  return 0;
+}
+
+/**
+ * 开启或关闭进程pid的系统调用跟踪,成功返回0.
+ * 第一次开启时分配跟踪环,关闭后环中的记录仍可读出,环随进程回收而释放.
+ */
+int32_t
+sys_systrace (pid_t pid, bool enable) {
+  /* 分配内存可能阻塞,须在关中断前完成 */
+  struct systrace_ring* ring= NULL;
+  if (enable) {
+    ring= get_kernel_pages (1);
+    if (ring == NULL) {
+      return -1;
+    }
+  }
+
+  enum intr_status    old_status= intr_disable ();
+  struct task_struct* pthread   = pid2thread (pid);
+  int32_t             ret       = -1;
+  /* 只有用户进程才会发起系统调用 */
+  if (pthread != NULL && pthread->pgdir != NULL
+      && pthread->status != TASK_HANGING) {
+    if (enable && pthread->systrace == NULL) {
+      pthread->systrace= ring;
+      ring             = NULL;
+    }
+    if (pthread->systrace != NULL) {
+      pthread->systrace->enabled= enable;
+    }
+    ret= 0;
+  }
+  intr_set_status (old_status);
+
+  if (ring != NULL) {
+    mfree_kernel_pages (ring, 1);
+  }
+  return ret;
+}
+
+/**
+ * 从进程pid的跟踪环中按时间顺序取出至多cnt条记录到recs,返回取出的条数.
+ * dropped不为NULL时带回上次读出后因环满被覆盖的记录数.
+ * 进程不存在或从未开启跟踪时返回-1,进程退出后在被回收前仍可读.
+ */
+int32_t
+sys_systrace_read (pid_t pid, struct systrace_rec* recs, uint32_t cnt,
+                   uint32_t* dropped) {
+  enum intr_status    old_status= intr_disable ();
+  struct task_struct* pthread   = pid2thread (pid);
+  if (pthread == NULL || pthread->systrace == NULL) {
+    intr_set_status (old_status);
+    return -1;
+  }
+
+  struct systrace_ring* ring= pthread->systrace;
+  uint32_t              read= 0;
+  while (read < cnt && ring->cnt > 0) {
+    recs[read++]= ring->recs[ring->head];
+    ring->head  = (ring->head + 1) % SYSTRACE_RECS;
+    ring->cnt--;
+  }
+  if (dropped != NULL) {
+    *dropped= ring->dropped;
+  }
+  ring->dropped= 0;
+  intr_set_status (old_status);
+  return read;
+}
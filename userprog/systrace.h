@@ -0,0 +1,46 @@
+#ifndef __USERPROG_SYSTRACE_H
+#define __USERPROG_SYSTRACE_H
+#include "global.h"
+#include "stdint.h"
+#include "thread.h"
+
+#define SYSCALL_HIST_BUCKETS 32 // 延迟直方图的桶数
+#define SYSTRACE_RECS 127       // 每个进程跟踪环中的记录数,环正好占一页
+
+/**
+ * 单个系统调用的统计,时长单位为时钟源的计数(有tsc时即cpu周期).
+ * hist[i]为时长落在[2^i, 2^(i+1))中的次数,最后一个桶包含更长的.
+ */
+struct syscall_stat {
+  uint32_t calls;  // 调用次数
+  uint32_t errors; // 返回-1的次数
+  uint64_t cycles; // 总时长
+  uint32_t hist[SYSCALL_HIST_BUCKETS];
+};
+
+/* 跟踪模式下每次系统调用返回时记下的一条记录 */
+struct systrace_rec {
+  pid_t    pid;
+  uint16_t nr;
+  uint32_t args[4];
+  uint32_t ret;
+  uint64_t cycles; // 调用时长
+};
+
+/* 进程的跟踪环,环满时覆盖最旧的记录 */
+struct systrace_ring {
+  bool     enabled;
+  uint32_t head;    // 最旧记录的下标
+  uint32_t cnt;     // 环中的记录数
+  uint32_t dropped; // 上次读出后被覆盖的记录数
+  struct systrace_rec recs[SYSTRACE_RECS];
+};
+
+void    systrace_account (uint32_t nr, uint32_t* args, uint32_t ret,
+                          uint64_t cycles);
+void    systrace_free (struct task_struct* pthread);
+int32_t sys_syscall_stat (uint32_t nr, struct syscall_stat* st);
+int32_t sys_systrace (pid_t pid, bool enable);
+int32_t sys_systrace_read (pid_t pid, struct systrace_rec* recs, uint32_t cnt,
+                           uint32_t* dropped);
+#endif
@@ -1,5 +1,6 @@
 #include "tss.h"
 #include "global.h"
+#include "interrupt.h"
 #include "print.h"
 #include "stdint.h"
 #include "string.h"
@@ -36,10 +37,53 @@ struct tss {
 };
 static struct tss tss;
 
-/* 更新tss中esp0字段的值为pthread的0级线 */
+/* sysenter使用的MSR */
+#define MSR_SYSENTER_CS 0x174
+#define MSR_SYSENTER_ESP 0x175
+#define MSR_SYSENTER_EIP 0x176
+#define CPUID_SEP 0x800 // cpuid(1)的edx中表示支持sysenter的位
+
+extern void sysenter_entry (void);
+static bool sysenter_enabled= false;
+static bool sysenter_armed  = false; // 是否已写入SYSENTER_CS,见update_tss_esp
+
+static void
+wrmsr (uint32_t msr, uint32_t value) {
+  asm volatile ("wrmsr" : : "c"(msr), "a"(value), "d"(0));
+}
+
+/* 更新tss中esp0字段的值为pthread的0级线,sysenter的内核栈也随之更新 */
 void
 update_tss_esp (struct task_struct* pthread) {
   tss.esp0= (uint32_t*) ((uint32_t) pthread + PG_SIZE);
+  if (sysenter_enabled) {
+    wrmsr (MSR_SYSENTER_ESP, (uint32_t) tss.esp0);
+    if (!sysenter_armed) {
+      wrmsr (MSR_SYSENTER_CS, SELECTOR_SYSENTER_CS);
+      sysenter_armed= true;
+    }
+  }
+}
+
+/**
+ * cpu支持时启用sysenter,早期Pentium Pro会把SEP误报为1,需排除.
+ * SYSENTER_CS和SYSENTER_ESP等第一个用户进程换上cpu时才由update_tss_esp写入,
+ * 此前SYSENTER_CS为0,误用sysenter会引发#GP,而不是把栈压到地址0之下
+ */
+static void
+sysenter_init (void) {
+  uint32_t eax= 1, ebx, ecx, edx;
+  asm volatile ("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+  uint32_t family= (eax >> 8) & 0xf, model= (eax >> 4) & 0xf;
+  uint32_t stepping= eax & 0xf;
+  if (!(edx & CPUID_SEP) || (family == 6 && model < 3 && stepping < 3)) {
+    put_str ("sysenter not supported, use int 0x80\n");
+    return;
+  }
+  enum intr_status old_status= intr_disable ();
+  wrmsr (MSR_SYSENTER_EIP, (uint32_t) sysenter_entry);
+  sysenter_enabled= true;
+  intr_set_status (old_status);
 }
 
 /* 创建gdt描述符 */
@@ -79,10 +123,22 @@ tss_init () {
   *((struct gdt_desc*) 0xc0000930)= make_gdt_desc (
       (uint32_t*) 0, 0xfffff, GDT_DATA_ATTR_LOW_DPL3, GDT_ATTR_HIGH);
 
+  /* sysenter/sysexit由SYSENTER_CS推算各段选择子,在0x938起放置相邻的
+   * 内核代码段,内核数据段,用户代码段和用户数据段 */
+  *((struct gdt_desc*) 0xc0000938)= make_gdt_desc (
+      (uint32_t*) 0, 0xfffff, GDT_CODE_ATTR_LOW_DPL0, GDT_ATTR_HIGH);
+  *((struct gdt_desc*) 0xc0000940)= make_gdt_desc (
+      (uint32_t*) 0, 0xfffff, GDT_DATA_ATTR_LOW_DPL0, GDT_ATTR_HIGH);
+  *((struct gdt_desc*) 0xc0000948)= make_gdt_desc (
+      (uint32_t*) 0, 0xfffff, GDT_CODE_ATTR_LOW_DPL3, GDT_ATTR_HIGH);
+  *((struct gdt_desc*) 0xc0000950)= make_gdt_desc (
+      (uint32_t*) 0, 0xfffff, GDT_DATA_ATTR_LOW_DPL3, GDT_ATTR_HIGH);
+
   /* gdt 16位的limit 32位的段基址 */
   uint64_t gdt_operand=
-      ((8 * 7 - 1) | ((uint64_t) (uint32_t) 0xc0000900 << 16)); // 7个描述符大小
+      ((8 * 11 - 1) | ((uint64_t) (uint32_t) 0xc0000900 << 16)); // 11个描述符大小
   asm volatile ("lgdt %0" : : "m"(gdt_operand));
   asm volatile ("ltr %w0" : : "r"(SELECTOR_TSS));
   put_str ("tss_init and ltr done\n");
+  sysenter_init ();
 }
@@ -0,0 +1,77 @@
+#include "vdso.h"
+#include "clocksource.h"
+#include "global.h"
+#include "memory.h"
+#include "timer.h"
+
+#define VDSO_PDE_IDX (VDSO_VADDR >> 22)
+#define VDSO_PTE_IDX ((VDSO_VADDR & 0x003ff000) >> 12)
+
+/**
+ * 为用户进程分配vdso页并以只读方式映射到page_dir的VDSO_VADDR处.
+ * 页表和数据页一起从内核内存池申请,前一页为页表,后一页为数据页.
+ */
+bool
+vdso_map (struct task_struct* user_prog, uint32_t* page_dir) {
+  uint32_t* page_table= get_kernel_pages (2);
+  if (page_table == NULL) {
+    return false;
+  }
+  struct vdso_data* vdso= (struct vdso_data*) ((uint32_t) page_table + PG_SIZE);
+
+  page_table[VDSO_PTE_IDX]=
+      addr_v2p ((uint32_t) vdso) | PG_US_U | PG_RW_R | PG_P_1;
+  page_dir[VDSO_PDE_IDX]=
+      addr_v2p ((uint32_t) page_table) | PG_US_U | PG_RW_W | PG_P_1;
+
+  const struct clocksource* cs= clocksource_current ();
+  if (cs != NULL && cs->user_readable) {
+    vdso->clock_mode= VCLOCK_TSC;
+    vdso->mult      = cs->mult;
+    vdso->shift     = cs->shift;
+    vdso->base      = cs->base;
+  }
+  else {
+    vdso->clock_mode= VCLOCK_COARSE;
+  }
+  vdso->pid      = user_prog->pid;
+  vdso->cpu      = 0;
+  user_prog->vdso= vdso;
+  vdso_update (user_prog);
+  return true;
+}
+
+/**
+ * 进程退出时从页目录中摘除vdso页,
+ * 以免mfree_user_space把内核内存池的页当作用户页释放.
+ */
+void
+vdso_unmap (struct task_struct* user_prog) {
+  if (user_prog->vdso != NULL) {
+    user_prog->pgdir[VDSO_PDE_IDX]= 0;
+  }
+}
+
+/* 回收vdso页和它的页表 */
+void
+vdso_free (struct task_struct* user_prog) {
+  if (user_prog->vdso != NULL) {
+    mfree_kernel_pages ((void*) ((uint32_t) user_prog->vdso - PG_SIZE), 2);
+    user_prog->vdso= NULL;
+  }
+}
+
+/* 更新vdso页中的时间,在时钟中断中和进程换上cpu时调用 */
+void
+vdso_update (struct task_struct* user_prog) {
+  struct vdso_data* vdso= user_prog->vdso;
+  if (vdso == NULL) {
+    return;
+  }
+  vdso->seq++;
+  asm volatile ("" : : : "memory");
+  vdso->ticks  = ticks;
+  vdso->tick_ns= ktime_get_ns ();
+  asm volatile ("" : : : "memory");
+  vdso->seq++;
+}
@@ -0,0 +1,34 @@
+#ifndef __USERPROG_VDSO_H
+#define __USERPROG_VDSO_H
+#include "stdint.h"
+#include "thread.h"
+
+/* vdso页在每个用户进程中的虚拟地址,独占第0x2fe个页目录项 */
+#define VDSO_VADDR 0xbf800000
+
+/* 用户态取时间的方式 */
+#define VCLOCK_COARSE 0 // 只能取最近一次时钟中断的时刻
+#define VCLOCK_TSC 1    // 可在用户态rdtsc后按mult和shift换算
+
+/**
+ * 内核与用户进程共享的只读数据页,内核在时钟中断和任务换上cpu时更新,
+ * 用户态读取getpid,time和clock_gettime所需的数据时不必陷入内核.
+ * 内核只在本进程运行时更新它,用户态按seq重读即可得到一致的数据.
+ */
+struct vdso_data {
+  uint32_t seq;        // 内核更新前后各加1,为奇数时正在更新
+  uint32_t ticks;      // 同内核的ticks
+  uint64_t tick_ns;    // 最近一次更新时的ktime
+  uint32_t clock_mode; // VCLOCK_COARSE或VCLOCK_TSC
+  uint32_t mult;       // 以下三项同当前时钟源,仅VCLOCK_TSC时有效
+  uint32_t shift;
+  uint64_t base;
+  pid_t    pid;
+  uint32_t cpu; // 所在cpu的编号,目前只有0号cpu
+};
+
+bool vdso_map (struct task_struct* user_prog, uint32_t* page_dir);
+void vdso_unmap (struct task_struct* user_prog);
+void vdso_free (struct task_struct* user_prog);
+void vdso_update (struct task_struct* user_prog);
+#endif